@@ -240,6 +240,7 @@ lw_import       lw_bool  lw_random                   (char * buffer, size_t size
   lw_import           void  lw_pump_remove               (lw_pump, lw_pump_watch);
   lw_import           void  lw_pump_post_remove          (lw_pump, lw_pump_watch);
   lw_import           void  lw_pump_post                 (lw_pump, void * fn, void * param);
+  lw_import        lw_bool  lw_pump_post_work            (lw_pump, void * work, void * done, void * param);
   lw_import           void* lw_pump_tag                  (lw_pump);
   lw_import           void  lw_pump_set_tag              (lw_pump, void *);
 
@@ -308,13 +309,77 @@ lw_import       lw_bool  lw_random                   (char * buffer, size_t size
 /* EventPump */
 
   lw_import   lw_eventpump  lw_eventpump_new                  ();
+  lw_import   lw_eventpump  lw_eventpump_new_threaded         (int num_threads);
+  lw_import   lw_eventpump  lw_eventpump_new_uring            ();
   lw_import       lw_error  lw_eventpump_tick                 (lw_eventpump);
+  lw_import           long  lw_eventpump_tick_for             (lw_eventpump, long budget_us);
   lw_import       lw_error  lw_eventpump_start_eventloop      (lw_eventpump);
   lw_import       lw_error  lw_eventpump_start_sleepy_ticking (lw_eventpump, void (lw_callback * on_tick_needed) (lw_eventpump));
   lw_import           void  lw_eventpump_post_eventloop_exit  (lw_eventpump);
 
+  /* Returns false if the pump can't busy poll (the Windows eventpump can't),
+   * in which case the setting is ignored.
+   */
+  lw_import        lw_bool  lw_eventpump_set_busy_poll        (lw_eventpump, long microseconds);
+
+  #ifndef _WIN32
+
+    /* For running the pump from another event loop: poll lw_eventpump_fd for
+     * readability (with lw_eventpump_timeout as the timeout), and call
+     * lw_eventpump_dispatch when it's ready or the timeout expires.
+     */
+    lw_import            int  lw_eventpump_fd                 (lw_eventpump);
+    lw_import           long  lw_eventpump_timeout            (lw_eventpump);
+    lw_import       lw_error  lw_eventpump_dispatch           (lw_eventpump);
+
+  #endif
+
+  /* Bucket 0 counts zeroes, and bucket n counts values from 2^(n-1) up to
+   * 2^n - 1.  The last bucket also counts anything larger.
+   */
+  #define lw_pump_histogram_buckets  32
+
+  typedef struct lw_pump_histogram
+  {
+     lw_ui64 count, total, max;
+     lw_ui64 buckets [lw_pump_histogram_buckets];
+
+  } lw_pump_histogram;
+
+  typedef struct lw_pump_stats
+  {
+     lw_ui64 wakeups, events, posts, timers;
+
+     lw_pump_histogram batch_size;    /* events per wakeup */
+     lw_pump_histogram tick_us;       /* wakeup to waiting again */
+     lw_pump_histogram callback_us;   /* each watch callback */
+     lw_pump_histogram post_depth;    /* posts waiting when drained */
+     lw_pump_histogram timer_lag_us;  /* how late each timer ran */
+
+     /* The tag of the watch with the slowest single callback so far
+      */
+     void * slowest_tag;
+     lw_ui64 slowest_us;
+
+  } lw_pump_stats;
+
+  /* lw_eventpump_enable_stats returns false if the pump can't collect stats
+   * (the Windows eventpump doesn't), and lw_eventpump_get_stats returns false
+   * unless they're being collected.
+   */
+  lw_import        lw_bool  lw_eventpump_enable_stats         (lw_eventpump, lw_bool enabled);
+  lw_import        lw_bool  lw_eventpump_get_stats            (lw_eventpump, lw_pump_stats *);
+  lw_import           void  lw_eventpump_reset_stats          (lw_eventpump);
+
 /* Stream */
 
+  typedef struct lw_iovec
+  {
+     const char * buffer;
+     size_t length;
+
+  } lw_iovec;
+
   lw_import      void  lw_stream_delete                (lw_stream);
   lw_import    size_t  lw_stream_bytes_left            (lw_stream);
   lw_import      void  lw_stream_read                  (lw_stream, size_t bytes);
@@ -323,6 +388,8 @@ lw_import       lw_bool  lw_random                   (char * buffer, size_t size
   lw_import      void  lw_stream_end_queue             (lw_stream);
   lw_import      void  lw_stream_end_queue_hb          (lw_stream, int num_head_buffers, const char ** buffers, size_t * lengths);
   lw_import      void  lw_stream_write                 (lw_stream, const char * buffer, size_t length);
+  lw_import      void  lw_stream_write_buffer          (lw_stream, const char * buffer, size_t length, void * free_fn, void * tag);
+  lw_import      void  lw_stream_write_vec             (lw_stream, const lw_iovec *, int count);
   lw_import      void  lw_stream_write_text            (lw_stream, const char * buffer);
   lw_import      void  lw_stream_writef                (lw_stream, const char * format, ...);
   lw_import      void  lw_stream_writev                (lw_stream, const char * format, va_list);
@@ -346,11 +413,55 @@ lw_import       lw_bool  lw_random                   (char * buffer, size_t size
   lw_import void lw_stream_add_hook_data (lw_stream, lw_stream_hook_data, void * tag);
   lw_import void lw_stream_remove_hook_data (lw_stream, lw_stream_hook_data, void * tag);
 
+  /* From a data hook: if the data is held in a refcounted buffer (e.g. from
+   * lw_fdstream_pooled_read), keeps it alive after the hook returns and
+   * returns a handle to pass to lw_stream_release_data.  Otherwise returns 0,
+   * and the data must be copied if it's still needed.
+   */
+
+  lw_import void * lw_stream_retain_data (lw_stream);
+  lw_import void lw_stream_release_data (void *);
+
   typedef void (lw_callback * lw_stream_hook_close) (lw_stream, void * tag);
 
   lw_import void lw_stream_add_hook_close (lw_stream, lw_stream_hook_close, void * tag);
   lw_import void lw_stream_remove_hook_close (lw_stream, lw_stream_hook_close, void * tag);
 
+  /* Once more than high bytes are queued to be written, on_queue_full is
+   * called and any streams reading into this one are paused.  When the queue
+   * drops to low bytes again, they resume and on_queue_drained is called.
+   * A high watermark of 0 (the default) disables this.
+   */
+
+  lw_import void lw_stream_set_watermarks (lw_stream, size_t high, size_t low);
+
+  typedef void (lw_callback * lw_stream_hook_queue) (lw_stream);
+
+  lw_import void lw_stream_on_queue_full (lw_stream, lw_stream_hook_queue);
+  lw_import void lw_stream_on_queue_drained (lw_stream, lw_stream_hook_queue);
+
+  /* Counters kept for every stream.  For a socket, bytes_sent is what was
+   * written to it and bytes_received what was read from it; for a filter,
+   * what went in and what came out.
+   */
+  typedef struct lw_stream_stats
+  {
+     lw_ui64 bytes_sent, bytes_received;
+
+     size_t queued_bytes;       /* waiting in the queues right now */
+     size_t max_queued_bytes;   /* most ever waiting at once */
+
+     size_t front_queue, back_queue;   /* items in each queue */
+
+     /* How long the queues have been non-empty, or 0 if they're empty
+      */
+     lw_ui64 queued_ms;
+
+  } lw_stream_stats;
+
+  lw_import void lw_stream_get_stats (lw_stream, lw_stream_stats *);
+  lw_import void lw_stream_reset_stats (lw_stream);
+
   /* For stream implementors */
 
    typedef struct lw_streamdef
@@ -370,11 +481,28 @@ lw_import       lw_bool  lw_random                   (char * buffer, size_t size
 
       size_t tail_size;
 
+      /* Optional: sink several buffers at once (e.g. with writev).  Returns
+       * the total number of bytes written.  After tail_size, so that defs
+       * built against older headers keep their layout.
+       */
+      size_t (* sink_data_vec) (lw_stream, const lw_iovec *, int count);
+
+      /* Optional: called when reading was paused because something
+       * downstream had a full queue (see lw_stream_is_paused), and may now
+       * continue.
+       */
+      void (* resume_read) (lw_stream);
+
    } lw_streamdef;
 
    lw_import lw_stream lw_stream_new (const lw_streamdef *, lw_pump);
    lw_import const lw_streamdef * lw_stream_get_def (lw_stream);
    
+   /* True if something this stream's data goes to has a full queue, in
+    * which case reading should stop until resume_read is called.
+    */
+   lw_import lw_bool lw_stream_is_paused (lw_stream);
+
    lw_import void * lw_stream_tail (lw_stream);
    lw_import lw_stream lw_stream_from_tail (void *);
 
@@ -387,9 +515,16 @@ lw_import       lw_bool  lw_random                   (char * buffer, size_t size
   lw_import         void  lw_fdstream_cork        (lw_fdstream);
   lw_import         void  lw_fdstream_uncork      (lw_fdstream);
   lw_import         void  lw_fdstream_nagle       (lw_fdstream, lw_bool nagle);
+  lw_import         void  lw_fdstream_pooled_read (lw_fdstream, lw_bool enabled);
+  lw_import         void  lw_fdstream_auto_cork   (lw_fdstream, lw_bool enabled);
   lw_import      lw_bool  lw_fdstream_valid       (lw_fdstream);
 
-/* File */
+/* File (a mode with 'm', such as "rbm", maps the file into memory and reads
+ * from the mapping without copying.  Small files are read into a cache
+ * instead, up to lw_file_set_cache_size bytes in all.  A bigger file should
+ * not be truncated while it's mapped: replace it by renaming a new file over
+ * it instead.)
+ */
 
   lw_import lw_file lw_file_new (lw_pump);
 
@@ -403,15 +538,42 @@ lw_import       lw_bool  lw_random                   (char * buffer, size_t size
 
   lw_import const char * lw_file_name (lw_file);
 
+  lw_import void lw_file_set_cache_size (size_t bytes);
+
 /* Pipe */
   
   lw_import  lw_stream  lw_pipe_new  (lw_pump);
 
+/* Deflate (a filter stream compressing everything written to it - only
+ * available if built with ENABLE_ZLIB, otherwise lw_deflate_filter_new
+ * returns 0)
+ */
+
+  #define lw_deflate_raw   0
+  #define lw_deflate_zlib  1
+  #define lw_deflate_gzip  2
+
+  lw_import  lw_stream  lw_deflate_filter_new         (lw_pump, int level, int format);
+  lw_import       void  lw_deflate_filter_mem_level   (lw_stream, int mem_level);
+  lw_import       void  lw_deflate_filter_auto_flush  (lw_stream, lw_bool);
+  lw_import       void  lw_deflate_filter_flush       (lw_stream);
+  lw_import       void  lw_deflate_filter_finish      (lw_stream);
+
+/* RateLimit (a filter stream passing data on at no more than bytes_per_sec,
+ * after an initial burst of up to burst bytes (0 for a second's worth).
+ * Anything more is queued, and whatever is reading into it is paused while
+ * a burst's worth waits.)
+ */
+
+  lw_import  lw_stream  lw_ratelimit_new  (lw_pump, size_t bytes_per_sec, size_t burst);
+  lw_import       void  lw_ratelimit_set  (lw_stream, size_t bytes_per_sec, size_t burst);
+
 /* Timer */
   
   lw_import       lw_timer  lw_timer_new                  (lw_pump);
   lw_import           void  lw_timer_delete               (lw_timer);
   lw_import           void  lw_timer_start                (lw_timer, long milliseconds);
+  lw_import           void  lw_timer_start_once           (lw_timer, long milliseconds);
   lw_import        lw_bool  lw_timer_started              (lw_timer);
   lw_import           void  lw_timer_stop                 (lw_timer);
   lw_import           void  lw_timer_force_tick           (lw_timer);
@@ -497,8 +659,17 @@ lw_import       lw_bool  lw_random                   (char * buffer, size_t size
   lw_import         const char* lw_server_client_npn               (lw_server_client);
   lw_import            lw_addr  lw_server_client_addr              (lw_server_client);
   lw_import             size_t  lw_server_num_clients              (lw_server);
+
+/* A server on a threaded pump has clients disconnecting on other threads at
+ * any time, so it's only safe to walk its clients with a pump that isn't
+ * threaded (lw_server_num_clients and lw_server_get_stats are safe with any).
+ */
+
   lw_import   lw_server_client  lw_server_client_first             (lw_server);
   lw_import   lw_server_client  lw_server_client_next              (lw_server_client);
+
+  lw_import               void  lw_server_set_rate_limit           (lw_server, size_t send_rate, size_t receive_rate, size_t burst);
+  lw_import               void  lw_server_get_stats                (lw_server, lw_stream_stats *);
   lw_import               void* lw_server_tag                      (lw_server);
   lw_import               void  lw_server_set_tag                  (lw_server, void *);
 
@@ -758,6 +929,8 @@ struct _pump
 
    void post (void * proc, void * parameter = 0);
 
+   lw_import bool post_work (void * work, void * done, void * parameter = 0);
+
    lw_import void tag (void *);
    lw_import void * tag ();
 };
@@ -776,14 +949,29 @@ struct _eventpump : public _pump
 
    lw_import error start_eventloop ();
    lw_import error tick ();
+   lw_import long tick_for (long budget_us);
 
    lw_import error start_sleepy_ticking
       (void (lw_callback * on_tick_needed) (eventpump));
 
    lw_import void post_eventloop_exit ();
+
+   lw_import bool set_busy_poll (long microseconds);
+
+   #ifndef _WIN32
+      lw_import int fd ();
+      lw_import long timeout ();
+      lw_import error dispatch ();
+   #endif
+
+   lw_import bool enable_stats (bool enabled = true);
+   lw_import bool get_stats (lw_pump_stats &);
+   lw_import void reset_stats ();
 };
 
 lw_import eventpump eventpump_new ();
+lw_import eventpump eventpump_new (int num_threads);
+lw_import eventpump eventpump_new_uring ();
 
 
 /** thread **/
@@ -816,6 +1004,7 @@ struct _timer
    lw_class_wraps (timer);
 
    lw_import void start    (long msec);
+   lw_import void start_once (long msec);
    lw_import void stop     ();
    lw_import bool started  ();
 
@@ -870,11 +1059,25 @@ struct _stream
      lw_import void add_hook_data (hook_data, void * tag = 0);
      lw_import void remove_hook_data (hook_data, void * tag = 0);
 
+     /* See lw_stream_retain_data (release with stream_release_data) */
+
+     lw_import void * retain_data ();
+
    typedef void (lw_callback * hook_close) (stream, void * tag);
 
      lw_import void add_hook_close (hook_close, void * tag);
      lw_import void remove_hook_close (hook_close, void * tag);
 
+   typedef void (lw_callback * hook_queue) (stream);
+
+     lw_import void on_queue_full (hook_queue);
+     lw_import void on_queue_drained (hook_queue);
+
+   lw_import void set_watermarks (size_t high, size_t low);
+
+   lw_import void get_stats (lw_stream_stats &);
+   lw_import void reset_stats ();
+
    lw_import size_t bytes_left (); /* if -1, read() does nothing */
    lw_import void read (size_t bytes = -1); /* -1 = until EOF */
 
@@ -893,6 +1096,17 @@ struct _stream
 
    lw_import void write (const char * buffer, size_t size = -1);
 
+   /* Queues buffer by reference rather than copying it.  free_fn (if not 0)
+    * is called with tag once nothing needs the buffer any more.
+    */
+   lw_import void write_buffer
+       (const char * buffer, size_t size, void * free_fn = 0, void * tag = 0);
+
+   /* Writes count buffers, handing them to the stream in one go (one writev
+    * for an fdstream) where possible.
+    */
+   lw_import void write_vec (const lw_iovec * vec, int count);
+
    lw_import void writef (const char * format, ...);
 
    lw_import void write
@@ -915,6 +1129,7 @@ struct _stream
 };
 
 lw_import stream stream_new (const lw_streamdef *, pump);
+lw_import void stream_release_data (void *);
 lw_import void stream_delete (stream);
 
 
@@ -931,6 +1146,43 @@ lw_import pipe pipe_new ();
 lw_import pipe pipe_new (pump);
 
 
+/** deflate **/
+
+typedef struct _deflate * deflate;
+
+struct _deflate : public _stream
+{
+   lw_class_wraps (deflate);
+
+   /* Only takes effect if set before anything is written */
+
+   lw_import void mem_level (int);
+
+   lw_import void auto_flush (bool);
+
+   lw_import void flush ();
+   lw_import void finish ();
+};
+
+lw_import deflate deflate_filter_new
+    (pump, int level = -1, int format = lw_deflate_gzip);
+
+
+/** ratelimit **/
+
+typedef struct _ratelimit * ratelimit;
+
+struct _ratelimit : public _stream
+{
+   lw_class_wraps (ratelimit);
+
+   lw_import void set (size_t bytes_per_sec, size_t burst = 0);
+};
+
+lw_import ratelimit ratelimit_new
+    (pump, size_t bytes_per_sec, size_t burst = 0);
+
+
 /** fdstream **/ 
 
 typedef struct _fdstream * fdstream;
@@ -949,6 +1201,16 @@ struct _fdstream : public _stream
 
    lw_import void nagle (bool);
 
+   /* Read into pooled, refcounted buffers (see stream::retain_data) */
+
+   lw_import void pooled_read (bool);
+
+   /* Hold writes until the end of the current pump tick, then send them all
+    * with a single writev
+    */
+
+   lw_import void auto_cork (bool enabled = true);
+
 };
 
 lw_import fdstream fdstream_new (pump);
@@ -971,6 +1233,8 @@ struct _file : public _fdstream
 lw_import file file_new (pump);
 lw_import file file_new (pump, const char * filename, const char * mode = "rb");
 
+lw_import void file_set_cache_size (size_t bytes);
+
 
 /** address **/
 
@@ -1108,6 +1372,19 @@ struct _server
    lw_import size_t num_clients ();
    lw_import server_client client_first ();
 
+   /* Rate limits for each client connecting after this is called (0 means
+    * unlimited).  See ratelimit.
+    */
+
+   lw_import void rate_limit
+      (size_t send_rate, size_t receive_rate, size_t burst = 0);
+
+   /* The stream stats of every client added together (apart from
+    * max_queued_bytes and queued_ms, which are the largest of any client)
+    */
+
+   lw_import void get_stats (lw_stream_stats &);
+
    typedef void (lw_callback * hook_connect) (server, server_client);
    typedef void (lw_callback * hook_disconnect) (server, server_client);
 
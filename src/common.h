@@ -149,6 +149,7 @@ void lwp_init ();
 #endif
 
 #include "heapbuffer.h"
+#include "refbuffer.h"
 
 #include "../deps/uthash/uthash.h"
 #include "nvhash.h"
@@ -175,6 +176,17 @@ void lwp_init ();
 
 #define lwp_default_buffer_size (1024 * 64)
 
+#ifdef _MSC_VER
+   #define lwp_thread_local __declspec (thread)
+#else
+   #define lwp_thread_local __thread
+#endif
+
+/* Calls proc once when the calling thread exits, to free anything it keeps
+ * in thread local storage (such as a free list).
+ */
+void lwp_thread_on_exit (void (* proc) (void));
+
 
 void lwp_disable_ipv6_only (lwp_socket socket);
 
@@ -197,6 +209,10 @@ ssize_t lwp_format (char ** output, const char * format, va_list args);
 
 void lwp_to_lowercase (char * str);
 
+/* Milliseconds from a monotonic clock, for measuring intervals */
+
+lw_i64 lwp_time_ms ();
+
 extern const char * const lwp_weekdays [];
 extern const char * const lwp_months [];
 
@@ -204,6 +220,11 @@ time_t lwp_parse_time (const char *);
 
 lwp_socket lwp_create_server_socket (lw_filter, int type, int protocol, lw_error);
 
+/* Keeps all of a server's clients on the thread running the server's own
+ * pump, rather than spreading them over the threads of a threaded pump.
+ */
+void lwp_server_set_single_threaded (lw_server);
+
 #ifdef __cplusplus
 
    } /* extern "C" */
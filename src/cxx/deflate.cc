@@ -0,0 +1,57 @@
+
+/* vim: set et ts=3 sw=3 ft=cpp:
+ *
+ * Copyright (C) 2013 James McLaughlin et al.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "../common.h"
+
+deflate lacewing::deflate_filter_new (lacewing::pump pump, int level,
+                                      int format)
+{
+   return (deflate) lw_deflate_filter_new ((lw_pump) pump, level, format);
+}
+
+void _deflate::mem_level (int mem_level)
+{
+   lw_deflate_filter_mem_level ((lw_stream) this, mem_level);
+}
+
+void _deflate::auto_flush (bool enabled)
+{
+   lw_deflate_filter_auto_flush ((lw_stream) this, enabled);
+}
+
+void _deflate::flush ()
+{
+   lw_deflate_filter_flush ((lw_stream) this);
+}
+
+void _deflate::finish ()
+{
+   lw_deflate_filter_finish ((lw_stream) this);
+}
+
@@ -34,6 +34,16 @@ eventpump lacewing::eventpump_new ()
    return (eventpump) lw_eventpump_new ();
 }
 
+eventpump lacewing::eventpump_new (int num_threads)
+{
+   return (eventpump) lw_eventpump_new_threaded (num_threads);
+}
+
+eventpump lacewing::eventpump_new_uring ()
+{
+   return (eventpump) lw_eventpump_new_uring ();
+}
+
 error _eventpump::start_eventloop ()
 {
    return (error) lw_eventpump_start_eventloop ((lw_eventpump) this);
@@ -44,6 +54,11 @@ error _eventpump::tick ()
    return (error) lw_eventpump_tick ((lw_eventpump) this);
 }
 
+long _eventpump::tick_for (long budget_us)
+{
+   return lw_eventpump_tick_for ((lw_eventpump) this, budget_us);
+}
+
 error _eventpump::start_sleepy_ticking
       (void (lw_callback * on_tick_needed) (eventpump))
 {
@@ -56,4 +71,43 @@ void _eventpump::post_eventloop_exit ()
    lw_eventpump_post_eventloop_exit ((lw_eventpump) this);
 }
 
+#ifndef _WIN32
+
+int _eventpump::fd ()
+{
+   return lw_eventpump_fd ((lw_eventpump) this);
+}
+
+long _eventpump::timeout ()
+{
+   return lw_eventpump_timeout ((lw_eventpump) this);
+}
+
+error _eventpump::dispatch ()
+{
+   return (error) lw_eventpump_dispatch ((lw_eventpump) this);
+}
+
+#endif
+
+bool _eventpump::set_busy_poll (long microseconds)
+{
+   return lw_eventpump_set_busy_poll ((lw_eventpump) this, microseconds);
+}
+
+bool _eventpump::enable_stats (bool enabled)
+{
+   return lw_eventpump_enable_stats ((lw_eventpump) this, enabled);
+}
+
+bool _eventpump::get_stats (lw_pump_stats &stats)
+{
+   return lw_eventpump_get_stats ((lw_eventpump) this, &stats);
+}
+
+void _eventpump::reset_stats ()
+{
+   lw_eventpump_reset_stats ((lw_eventpump) this);
+}
+
 
@@ -59,4 +59,14 @@ void _fdstream::nagle (bool enabled)
    lw_fdstream_nagle ((lw_fdstream) this, enabled);
 }
 
+void _fdstream::pooled_read (bool enabled)
+{
+   lw_fdstream_pooled_read ((lw_fdstream) this, enabled);
+}
+
+void _fdstream::auto_cork (bool enabled)
+{
+   lw_fdstream_auto_cork ((lw_fdstream) this, enabled);
+}
+
 
@@ -39,6 +39,11 @@ file lacewing::file_new (lacewing::pump pump, const char * filename, const char
    return (file) lw_file_new_open ((lw_pump) pump, filename, mode);
 }
 
+void lacewing::file_set_cache_size (size_t bytes)
+{
+   lw_file_set_cache_size (bytes);
+}
+
 bool _file::open (const char * filename, const char * mode)
 {
    return lw_file_open ((lw_file) this, filename, mode);
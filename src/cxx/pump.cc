@@ -95,6 +95,11 @@ void _pump::post (void * func, void * param)
    lw_pump_post ((lw_pump) this, func, param);
 }
 
+bool _pump::post_work (void * work, void * done, void * param)
+{
+   return lw_pump_post_work ((lw_pump) this, work, done, param);
+}
+
 void _pump::post_remove (lw_pump_watch watch)
 {
    lw_pump_post_remove ((lw_pump) this, watch);
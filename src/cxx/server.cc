@@ -96,6 +96,16 @@ size_t _server::num_clients ()
    return lw_server_num_clients ((lw_server) this);
 }
 
+void _server::rate_limit (size_t send_rate, size_t receive_rate, size_t burst)
+{
+   lw_server_set_rate_limit ((lw_server) this, send_rate, receive_rate, burst);
+}
+
+void _server::get_stats (lw_stream_stats &stats)
+{
+   lw_server_get_stats ((lw_server) this, &stats);
+}
+
 server_client _server::client_first ()
 {
    return (server_client) lw_server_client_first ((lw_server) this);
@@ -59,6 +59,41 @@ void _stream::remove_hook_close (hook_close hook, void * tag)
    lw_stream_remove_hook_close ((lw_stream) this, (lw_stream_hook_close) hook, tag);
 }
 
+void * _stream::retain_data ()
+{
+   return lw_stream_retain_data ((lw_stream) this);
+}
+
+void lacewing::stream_release_data (void * data)
+{
+   lw_stream_release_data (data);
+}
+
+void _stream::on_queue_full (hook_queue hook)
+{
+   lw_stream_on_queue_full ((lw_stream) this, (lw_stream_hook_queue) hook);
+}
+
+void _stream::on_queue_drained (hook_queue hook)
+{
+   lw_stream_on_queue_drained ((lw_stream) this, (lw_stream_hook_queue) hook);
+}
+
+void _stream::set_watermarks (size_t high, size_t low)
+{
+   lw_stream_set_watermarks ((lw_stream) this, high, low);
+}
+
+void _stream::get_stats (lw_stream_stats &stats)
+{
+   lw_stream_get_stats ((lw_stream) this, &stats);
+}
+
+void _stream::reset_stats ()
+{
+   lw_stream_reset_stats ((lw_stream) this);
+}
+
 size_t _stream::bytes_left ()
 {
    return lw_stream_bytes_left ((lw_stream) this);
@@ -95,6 +130,17 @@ void _stream::write (const char * buffer, size_t size)
    lw_stream_write ((lw_stream) this, buffer, size);
 }
 
+void _stream::write_buffer (const char * buffer, size_t size,
+                            void * free_fn, void * tag)
+{
+   lw_stream_write_buffer ((lw_stream) this, buffer, size, free_fn, tag);
+}
+
+void _stream::write_vec (const lw_iovec * vec, int count)
+{
+   lw_stream_write_vec ((lw_stream) this, vec, count);
+}
+
 void _stream::writef (const char * format, ...)
 {
    va_list args;
@@ -44,6 +44,11 @@ void _timer::start (long msec)
    lw_timer_start ((lw_timer) this, msec);
 }
 
+void _timer::start_once (long msec)
+{
+   lw_timer_start_once ((lw_timer) this, msec);
+}
+
 void _timer::stop ()
 {
    lw_timer_stop ((lw_timer) this);
@@ -0,0 +1,345 @@
+
+/* vim: set et ts=3 sw=3 ft=c:
+ *
+ * Copyright (C) 2013 James McLaughlin et al.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+#include "stream.h"
+
+#ifdef ENABLE_ZLIB
+
+#include <zlib.h>
+
+#define lwp_deflate_flag_auto_flush  1
+#define lwp_deflate_flag_finished    2
+
+/* Initialised z_streams are kept per thread, since deflateInit2 allocates
+ * several hundred KB for the window and hash tables.
+ */
+
+#define lwp_deflate_pool_depth  4
+
+typedef struct _lwp_deflate_state
+{
+   z_stream z;
+
+   int level, window_bits, mem_level;
+
+} * lwp_deflate_state;
+
+static lwp_thread_local struct
+{
+   int count;
+   lwp_deflate_state states [lwp_deflate_pool_depth];
+
+   lw_bool on_exit;
+
+} pool;
+
+static void pool_free (void)
+{
+   while (pool.count > 0)
+   {
+      lwp_deflate_state state = pool.states [-- pool.count];
+
+      deflateEnd (&state->z);
+      free (state);
+   }
+
+   pool.on_exit = lw_false;
+}
+
+typedef struct _lwp_deflate
+{
+   struct _lw_stream stream;
+
+   lwp_deflate_state state;
+
+   int level, window_bits, mem_level;
+
+   char flags;
+
+} * lwp_deflate;
+
+const static lw_streamdef def_deflate;
+
+static lwp_deflate_state state_get (int level, int window_bits, int mem_level)
+{
+   for (int i = 0; i < pool.count; ++ i)
+   {
+      lwp_deflate_state state = pool.states [i];
+
+      if (state->level == level && state->window_bits == window_bits
+            && state->mem_level == mem_level)
+      {
+         pool.states [i] = pool.states [-- pool.count];
+         return state;
+      }
+   }
+
+   lwp_deflate_state state = (lwp_deflate_state) calloc (sizeof (*state), 1);
+
+   if (!state)
+      return 0;
+
+   if (deflateInit2 (&state->z, level, Z_DEFLATED,
+                     window_bits, mem_level, Z_DEFAULT_STRATEGY) != Z_OK)
+   {
+      free (state);
+      return 0;
+   }
+
+   state->level = level;
+   state->window_bits = window_bits;
+   state->mem_level = mem_level;
+
+   return state;
+}
+
+static void state_put (lwp_deflate_state state)
+{
+   if (pool.count < lwp_deflate_pool_depth && deflateReset (&state->z) == Z_OK)
+   {
+      if (!pool.on_exit)
+      {
+         lwp_thread_on_exit (pool_free);
+         pool.on_exit = lw_true;
+      }
+
+      pool.states [pool.count ++] = state;
+      return;
+   }
+
+   deflateEnd (&state->z);
+   free (state);
+}
+
+/* Runs deflate over buffer, pushing out whatever it produces as it goes */
+
+static void deflate_data (lwp_deflate ctx, const char * buffer, size_t size,
+                          int flush)
+{
+   if (!ctx->state)
+   {
+      if (! (ctx->state = state_get (ctx->level, ctx->window_bits,
+                                     ctx->mem_level)))
+      {
+         lwp_trace ("deflate: failed to initialise z_stream");
+         return;
+      }
+   }
+   else if (ctx->flags & lwp_deflate_flag_finished)
+   {
+      /* More data after a finish starts a new stream (or gzip member) */
+
+      deflateReset (&ctx->state->z);
+   }
+
+   ctx->flags &= ~ lwp_deflate_flag_finished;
+
+   if (flush == Z_FINISH)
+      ctx->flags |= lwp_deflate_flag_finished;
+
+   z_stream * z = &ctx->state->z;
+
+   z->next_in = (Bytef *) buffer;
+   z->avail_in = (uInt) size;
+
+   char output [lwp_default_buffer_size];
+
+   lwp_retain (ctx, "deflate_data");
+
+   do
+   {
+      z->next_out = (Bytef *) output;
+      z->avail_out = sizeof (output);
+
+      if (deflate (z, flush) == Z_STREAM_ERROR)
+      {
+         lwp_trace ("deflate: Z_STREAM_ERROR");
+         break;
+      }
+
+      size_t produced = sizeof (output) - z->avail_out;
+
+      if (produced > 0)
+      {
+         lw_stream_data (&ctx->stream, output, produced);
+
+         /* Pushing the data may have deleted us (and given the z_stream
+          * back to the pool)
+          */
+
+         if (ctx->stream.flags & lwp_stream_flag_dead)
+            break;
+      }
+
+   } while (z->avail_out == 0);
+
+   lwp_release (ctx, "deflate_data");
+}
+
+static size_t def_sink_data (lw_stream stream, const char * buffer,
+                             size_t size)
+{
+   lwp_deflate ctx = (lwp_deflate) stream;
+
+   deflate_data (ctx, buffer, size, (ctx->flags & lwp_deflate_flag_auto_flush) ?
+                                    Z_SYNC_FLUSH : Z_NO_FLUSH);
+
+   return size;
+}
+
+static lw_bool def_close (lw_stream stream, lw_bool immediate)
+{
+   lwp_deflate ctx = (lwp_deflate) stream;
+
+   if (ctx->state && ! (ctx->flags & lwp_deflate_flag_finished))
+      deflate_data (ctx, 0, 0, Z_FINISH);
+
+   return lw_true;
+}
+
+static void def_cleanup (lw_stream stream)
+{
+   lwp_deflate ctx = (lwp_deflate) stream;
+
+   if (ctx->state)
+   {
+      state_put (ctx->state);
+      ctx->state = 0;
+   }
+}
+
+const static lw_streamdef def_deflate =
+{
+   def_sink_data,
+   0, /* sink_stream */
+   0, /* retry */
+   0, /* is_transparent */
+   def_close,
+   0, /* bytes_left */
+   0, /* read */
+   def_cleanup
+};
+
+lw_stream lw_deflate_filter_new (lw_pump pump, int level, int format)
+{
+   int window_bits;
+
+   switch (format)
+   {
+      case lw_deflate_raw:   window_bits = -MAX_WBITS;      break;
+      case lw_deflate_zlib:  window_bits = MAX_WBITS;       break;
+      case lw_deflate_gzip:  window_bits = MAX_WBITS + 16;  break;
+
+      default:
+         return 0;
+   }
+
+   lwp_deflate ctx = (lwp_deflate) malloc (sizeof (*ctx));
+
+   if (!ctx)
+      return 0;
+
+   lwp_stream_init (&ctx->stream, &def_deflate, pump);
+
+   ctx->state = 0;
+   ctx->level = level;
+   ctx->window_bits = window_bits;
+   ctx->mem_level = 8;
+   ctx->flags = lwp_deflate_flag_auto_flush;
+
+   return (lw_stream) ctx;
+}
+
+void lw_deflate_filter_mem_level (lw_stream stream, int mem_level)
+{
+   assert (lw_stream_get_def (stream) == &def_deflate);
+
+   ((lwp_deflate) stream)->mem_level = mem_level;
+}
+
+void lw_deflate_filter_auto_flush (lw_stream stream, lw_bool enabled)
+{
+   assert (lw_stream_get_def (stream) == &def_deflate);
+
+   lwp_deflate ctx = (lwp_deflate) stream;
+
+   if (enabled)
+      ctx->flags |= lwp_deflate_flag_auto_flush;
+   else
+      ctx->flags &= ~ lwp_deflate_flag_auto_flush;
+}
+
+void lw_deflate_filter_flush (lw_stream stream)
+{
+   assert (lw_stream_get_def (stream) == &def_deflate);
+
+   lwp_deflate ctx = (lwp_deflate) stream;
+
+   if (ctx->state && ! (ctx->flags & lwp_deflate_flag_finished))
+      deflate_data (ctx, 0, 0, Z_SYNC_FLUSH);
+}
+
+void lw_deflate_filter_finish (lw_stream stream)
+{
+   assert (lw_stream_get_def (stream) == &def_deflate);
+
+   lwp_deflate ctx = (lwp_deflate) stream;
+
+   if (! (ctx->flags & lwp_deflate_flag_finished))
+      deflate_data (ctx, 0, 0, Z_FINISH);
+}
+
+#else
+
+/* Built without zlib */
+
+lw_stream lw_deflate_filter_new (lw_pump pump, int level, int format)
+{
+   return 0;
+}
+
+void lw_deflate_filter_mem_level (lw_stream stream, int mem_level)
+{
+}
+
+void lw_deflate_filter_auto_flush (lw_stream stream, lw_bool enabled)
+{
+}
+
+void lw_deflate_filter_flush (lw_stream stream)
+{
+}
+
+void lw_deflate_filter_finish (lw_stream stream)
+{
+}
+
+#endif
+
@@ -29,51 +29,182 @@
 
 #include "common.h"
 
+/* Heapbuffers are allocated in power of two size classes from
+ * lwp_heapbuffer_min_block up to lwp_heapbuffer_max_pooled, and freed blocks
+ * of those sizes are kept in a small per-thread pool for reuse.  Since each
+ * pump is driven by one thread, this is in effect a pool per pump without
+ * heapbuffers needing to know about pumps.  Anything bigger comes straight
+ * from malloc, and grows by at most lwp_heapbuffer_max_step at a time.
+ */
+
+#define lwp_heapbuffer_min_block     64
+#define lwp_heapbuffer_num_classes   11  /* 64 bytes to 64 KB */
+#define lwp_heapbuffer_max_pooled    (lwp_heapbuffer_min_block << (lwp_heapbuffer_num_classes - 1))
+#define lwp_heapbuffer_pool_depth    16
+#define lwp_heapbuffer_max_step      (1024 * 1024)
+
+/* lwp_heapbuffer_shrink gives back an empty buffer bigger than this, rather
+ * than keeping it around for the next burst of data.
+ */
+#define lwp_heapbuffer_keep          (16 * 1024)
+
+#define lwp_heapbuffer_header  offsetof (struct _lwp_heapbuffer, buffer)
+
+static lwp_thread_local struct
+{
+   int count [lwp_heapbuffer_num_classes];
+   void * blocks [lwp_heapbuffer_num_classes] [lwp_heapbuffer_pool_depth];
+
+   lw_bool on_exit;
+
+} pool;
+
+static void pool_free (void)
+{
+   for (int i = 0; i < lwp_heapbuffer_num_classes; ++ i)
+   {
+      while (pool.count [i] > 0)
+         free (pool.blocks [i] [-- pool.count [i]]);
+   }
+
+   pool.on_exit = lw_false;
+}
+
+static int size_class (size_t size)
+{
+   if (size > lwp_heapbuffer_max_pooled)
+      return -1;
+
+   int index = 0;
+
+   for (size_t block = lwp_heapbuffer_min_block; block < size; block <<= 1)
+      ++ index;
+
+   return index;
+}
+
+static lwp_heapbuffer block_alloc (size_t size)
+{
+   int index = size_class (size);
+
+   if (index != -1 && pool.count [index] > 0)
+      return (lwp_heapbuffer) pool.blocks [index] [-- pool.count [index]];
+
+   return (lwp_heapbuffer) malloc (size);
+}
+
+static void block_free (lwp_heapbuffer block)
+{
+   int index = size_class (lwp_heapbuffer_header + block->allocated);
+
+   if (index != -1 && pool.count [index] < lwp_heapbuffer_pool_depth)
+   {
+      if (!pool.on_exit)
+      {
+         lwp_thread_on_exit (pool_free);
+         pool.on_exit = lw_true;
+      }
+
+      pool.blocks [index] [pool.count [index] ++] = block;
+      return;
+   }
+
+   free (block);
+}
+
+/* Move the data down to the start of the buffer, discarding whatever has
+ * already been trimmed from the left.
+ */
+static void compact (lwp_heapbuffer ctx)
+{
+   if (!ctx->offset)
+      return;
+
+   memmove (ctx->buffer, ctx->buffer + ctx->offset, ctx->length - ctx->offset);
+
+   ctx->length -= ctx->offset;
+   ctx->offset = 0;
+}
+
+static lw_bool grow (lwp_heapbuffer * ctx, size_t length)
+{
+   lwp_heapbuffer old = *ctx;
+
+   size_t needed = lwp_heapbuffer_header + length,
+          size = old ? lwp_heapbuffer_header + old->allocated
+                     : lwp_heapbuffer_min_block;
+
+   while (size < needed)
+      size += size < lwp_heapbuffer_max_step ? size : lwp_heapbuffer_max_step;
+
+   if (old && size_class (size) == -1
+         && size_class (lwp_heapbuffer_header + old->allocated) == -1)
+   {
+      /* Neither block is pooled - let realloc do its thing */
+
+      compact (old);
+
+      lwp_heapbuffer buffer = (lwp_heapbuffer) realloc (old, size);
+
+      if (!buffer)
+         return lw_false;
+
+      buffer->allocated = size - lwp_heapbuffer_header;
+      *ctx = buffer;
+
+      return lw_true;
+   }
+
+   lwp_heapbuffer buffer = block_alloc (size);
+
+   if (!buffer)
+      return lw_false;
+
+   buffer->offset = buffer->length = 0;
+   buffer->allocated = size - lwp_heapbuffer_header;
+
+   if (old)
+   {
+      buffer->length = old->length - old->offset;
+      memcpy (buffer->buffer, old->buffer + old->offset, buffer->length);
+
+      block_free (old);
+   }
+
+   *ctx = buffer;
+
+   return lw_true;
+}
+
 void lwp_heapbuffer_free (lwp_heapbuffer * ctx)
 {
    if (!*ctx)
       return;
 
-   free (*ctx);
+   block_free (*ctx);
    *ctx = 0;
 }
 
 lw_bool lwp_heapbuffer_add (lwp_heapbuffer * ctx, const char * buffer, size_t length)
 {
-   /* TODO: discard data before the offset (might save a realloc) */
-
    if (length == -1)
       length = strlen (buffer);
 
    if (length == 0)
       return lw_true;  /* nothing to do */
 
-   if (!*ctx)
+   if ((!*ctx) || (*ctx)->length + length > (*ctx)->allocated)
    {
-      size_t init_alloc = (length * 3);
+      size_t live = lwp_heapbuffer_length (ctx) + length;
 
-      if (! (*ctx = (lwp_heapbuffer) malloc (sizeof (**ctx) + init_alloc)))
-         return lw_false;
+      /* If discarding what's been trimmed from the left makes enough room,
+       * do that instead of growing.
+       */
 
-      memset (*ctx, 0, sizeof (**ctx));
-
-      (*ctx)->allocated = init_alloc;
-   }
-   else
-   {
-      size_t new_length = (*ctx)->length + length;
-
-      if (new_length > (*ctx)->allocated)
-      {
-         while (new_length > (*ctx)->allocated)
-            (*ctx)->allocated *= 3;
-
-         if (! (*ctx = (lwp_heapbuffer) realloc
-                    (*ctx, sizeof (**ctx) + (*ctx)->allocated)))
-         {
-            return lw_false;
-         }
-      }
+      if (*ctx && live <= (*ctx)->allocated)
+         compact (*ctx);
+      else if (!grow (ctx, live))
+         return lw_false;
    }
 
    memcpy ((*ctx)->buffer + (*ctx)->length, buffer, length);
@@ -81,7 +212,6 @@ lw_bool lwp_heapbuffer_add (lwp_heapbuffer * ctx, const char * buffer, size_t le
 
    return lw_true;
 }
-
 void lwp_heapbuffer_addf (lwp_heapbuffer * ctx, const char * format, ...)
 {
    va_list args;
@@ -99,6 +229,8 @@ void lwp_heapbuffer_addf (lwp_heapbuffer * ctx, const char * format, ...)
    va_end (args);
 }
 
+/* Never frees the buffer, as a parser may still be reading from it */
+
 void lwp_heapbuffer_reset (lwp_heapbuffer * ctx)
 {
    if (!*ctx)
@@ -107,6 +239,15 @@ void lwp_heapbuffer_reset (lwp_heapbuffer * ctx)
    (*ctx)->length = (*ctx)->offset = 0;
 }
 
+void lwp_heapbuffer_shrink (lwp_heapbuffer * ctx)
+{
+   if (*ctx && lwp_heapbuffer_length (ctx) == 0
+         && (*ctx)->allocated > lwp_heapbuffer_keep)
+   {
+      lwp_heapbuffer_free (ctx);
+   }
+}
+
 size_t lwp_heapbuffer_length (lwp_heapbuffer * ctx)
 {
    if (!*ctx)
@@ -129,6 +270,11 @@ void lwp_heapbuffer_trim_left (lwp_heapbuffer * ctx, size_t length)
       return;
 
    (*ctx)->offset += length;
+
+   /* Once everything has been trimmed, start again from the beginning */
+
+   if ((*ctx)->offset >= (*ctx)->length)
+      lwp_heapbuffer_reset (ctx);
 }
 
 void lwp_heapbuffer_trim_right (lwp_heapbuffer * ctx, size_t length)
@@ -44,6 +44,10 @@ void lwp_heapbuffer_trim_left (lwp_heapbuffer *, size_t);
 void lwp_heapbuffer_trim_right (lwp_heapbuffer *, size_t);
 
 void lwp_heapbuffer_reset (lwp_heapbuffer *);
+
+/* Frees the buffer if it's empty and bigger than is worth keeping */
+void lwp_heapbuffer_shrink (lwp_heapbuffer *);
+
 size_t lwp_heapbuffer_length (lwp_heapbuffer *);
 
 char * lwp_heapbuffer_buffer (lwp_heapbuffer *);
@@ -27,26 +27,129 @@
  * SUCH DAMAGE.
  */
 
-#include "list.h"
+#include "common.h"
 
 /* This file contains private helper functions for the macros defined in list.h.
  *
  * These functions provide the actual linked list logic, keeping it out of the
  * macros (and therefore out of anything but list.o).
+ *
+ * Most lists only ever hold a handful of elements, so the head is allocated
+ * with room for the first few elements inline (up to list_inline_bytes of
+ * them), and a list that stays that short never allocates anything else.
+ * Beyond that, elements come from per-thread pools of free nodes, one for
+ * each size class, and go back there when removed.
  */
 
+#define list_inline_max       4
+#define list_inline_bytes     192
+
+#define list_pool_granularity 16
+#define list_pool_classes     16   /* so nodes of up to 256 bytes are pooled */
+#define list_pool_depth       64
+
 struct list_head
 {
    list_element * first, * last;
    size_t length;
+
+   size_t value_size;
+
+   int num_inline;
+   unsigned int inline_used;  /* bit n set if inline node n is in use */
+
+   /* num_inline nodes follow */
 };
 
 struct list_element
 {
    list_head * list;
    list_element * prev, * next;
+
+   int slot;  /* 1 + the index of the inline node, or 0 if pooled */
 };
 
+static lwp_thread_local struct
+{
+   void * nodes [list_pool_classes];
+   int count [list_pool_classes];
+
+   lw_bool on_exit;
+
+} pool;
+
+static void pool_empty (void)
+{
+   for (int i = 0; i < list_pool_classes; ++ i)
+   {
+      while (pool.nodes [i])
+      {
+         void * node = pool.nodes [i];
+         pool.nodes [i] = *(void **) node;
+
+         free (node);
+      }
+
+      pool.count [i] = 0;
+   }
+
+   pool.on_exit = lw_false;
+}
+
+static void * pool_alloc (size_t size)
+{
+   size_t index = (size - 1) / list_pool_granularity;
+
+   if (index >= list_pool_classes)
+      return malloc (size);
+
+   void * node = pool.nodes [index];
+
+   if (node)
+   {
+      pool.nodes [index] = *(void **) node;
+      -- pool.count [index];
+
+      return node;
+   }
+
+   return malloc ((index + 1) * list_pool_granularity);
+}
+
+static void pool_free (void * node, size_t size)
+{
+   size_t index = (size - 1) / list_pool_granularity;
+
+   if (index >= list_pool_classes || pool.count [index] >= list_pool_depth)
+   {
+      free (node);
+      return;
+   }
+
+   if (!pool.on_exit)
+   {
+      lwp_thread_on_exit (pool_empty);
+      pool.on_exit = lw_true;
+   }
+
+   *(void **) node = pool.nodes [index];
+   pool.nodes [index] = node;
+
+   ++ pool.count [index];
+}
+
+static size_t node_size (size_t value_size)
+{
+   size_t size = sizeof (list_element) + value_size;
+
+   return (size + sizeof (void *) - 1) & ~ (sizeof (void *) - 1);
+}
+
+static size_t head_size (list_head * list)
+{
+   return sizeof (list_head) + list->num_inline * node_size (list->value_size);
+}
+
 static list_element * get_element (list_element * elem)
 {
    return elem ? (elem - 1) : 0;
@@ -57,27 +160,79 @@ static void * get_value_ptr (list_element * elem)
    return elem ? (elem + 1) : 0;
 }
 
-size_t _list_length (list_head * list)
+static list_head * get_head (list_head ** p_list, size_t value_size)
 {
-   return list ? list->length : 0;
+   if (*p_list)
+      return *p_list;
+
+   int num_inline = list_inline_bytes / node_size (value_size);
+
+   if (num_inline > list_inline_max)
+      num_inline = list_inline_max;
+
+   size_t size = sizeof (list_head) + num_inline * node_size (value_size);
+
+   list_head * list = (list_head *) pool_alloc (size);
+
+   memset (list, 0, sizeof (*list));
+
+   list->value_size = value_size;
+   list->num_inline = num_inline;
+
+   return *p_list = list;
 }
 
-void _list_push (list_head ** p_list, size_t value_size, void * value)
+static list_element * new_element (list_head * list, void * value)
 {
-   if (!*p_list)
-      *p_list = (list_head *) calloc (sizeof (list_head), 1);
+   list_element * elem = 0;
+   int slot = 0;
 
-   list_head * list = *p_list;
+   for (int i = 0; i < list->num_inline; ++ i)
+   {
+      if (! (list->inline_used & (1u << i)))
+      {
+         list->inline_used |= (1u << i);
 
-   ++ list->length;
+         elem = (list_element *) (((char *) (list + 1))
+                     + i * node_size (list->value_size));
 
-   list_element * elem = (list_element *)
-       malloc (sizeof (*elem) + value_size);
+         slot = i + 1;
+         break;
+      }
+   }
+
+   if (!elem)
+      elem = (list_element *) pool_alloc (node_size (list->value_size));
 
    memset (elem, 0, sizeof (*elem));
-   memcpy (get_value_ptr (elem), value, value_size);
+   memcpy (get_value_ptr (elem), value, list->value_size);
 
    elem->list = list;
+   elem->slot = slot;
+
+   ++ list->length;
+
+   return elem;
+}
+
+static void free_element (list_element * elem)
+{
+   if (elem->slot)
+      elem->list->inline_used &= ~ (1u << (elem->slot - 1));
+   else
+      pool_free (elem, node_size (elem->list->value_size));
+}
+
+size_t _list_length (list_head * list)
+{
+   return list ? list->length : 0;
+}
+
+void _list_push (list_head ** p_list, size_t value_size, void * value)
+{
+   list_head * list = get_head (p_list, value_size);
+   list_element * elem = new_element (list, value);
+
    elem->prev = list->last;
 
    if (list->last)
@@ -93,20 +248,9 @@ void _list_push (list_head ** p_list, size_t value_size, void * value)
 
 void _list_push_front (list_head ** p_list, size_t value_size, void * value)
 {
-   if (!*p_list)
-      *p_list = (list_head *) calloc (sizeof (list_head), 1);
-
-   list_head * list = *p_list;
-
-   ++ list->length;
-
-   list_element * elem = (list_element *)
-       malloc (sizeof (*elem) + value_size);
+   list_head * list = get_head (p_list, value_size);
+   list_element * elem = new_element (list, value);
 
-   memset (elem, 0, sizeof (*elem));
-   memcpy (get_value_ptr (elem), value, value_size);
-
-   elem->list = list;
    elem->next = list->first;
 
    if (list->first)
@@ -169,7 +313,7 @@ void _list_remove (list_element * elem)
    if (elem == list->last)
       list->last = elem->prev;
 
-   free (elem);
+   free_element (elem);
 }
 
 void _list_clear (list_head ** list, size_t value_size)
@@ -182,12 +326,10 @@ void _list_clear (list_head ** list, size_t value_size)
    while (elem)
    {
       list_element * next = elem->next;
-      free (elem);
+      free_element (elem);
       elem = next;
    }
 
-   free (*list);
+   pool_free (*list, head_size (*list));
    *list = 0;
 }
-
-
@@ -52,6 +52,9 @@ typedef struct list_element list_element;
  *  - The macros are intuitive and do not require any unnecessary parameters.
  *    In particular, the list type does not need to be passed to each operation.
  *
+ *  - Short lists are cheap: the first few elements are stored inline in the
+ *    list head, and the rest come from per-thread node pools (see list.c)
+ *
  * To accomplish this we use a boatload of unholy macro tricks, rampant and
  * sadistic subversion of the C type system, and a liberal sprinkling of GCC
  * extensions to stamp out any remaining chance of portability.
@@ -64,7 +67,7 @@ typedef struct list_element list_element;
  *   list_pop(list)                   Pop and return value from back
  *   list_pop_front(list)             Pop and return value from front
  *   list_length(list)                Returns the list length
- *   list_remove(list, value)         Remove first occurrence of value from list
+ *   list_remove(list, value)         Remove first occurrence of value (O(n))
  *   list_clear(list)                 Clear the list (freeing all memory)
  *
  * Element operations:
@@ -75,6 +78,10 @@ typedef struct list_element list_element;
  *   list_elem_prev(elem)             Returns element before elem
  *   list_elem_remove(elem)           Remove element elem
  *
+ * An element stays where it is until it's removed, so an element pointer (e.g.
+ * list_elem_back straight after list_push) can be kept as a handle for an O(1)
+ * list_elem_remove later, rather than list_remove searching for the value.
+ *
  * Loops:
  * 
  *   list_each(list, elem) { ... }
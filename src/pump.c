@@ -64,20 +64,33 @@ void lw_pump_delete (lw_pump ctx)
    if (!ctx)
       return;
 
+   lwp_workpool_delete (ctx->workpool);
+
    if (ctx->def->cleanup)
       ctx->def->cleanup (ctx);
 
    free (ctx);
 }
 
+/* Users may be added and removed from worker threads and the loop threads
+ * of a threaded pump.
+ */
 void lw_pump_add_user (lw_pump ctx)
 {
-   ++ ctx->use_count;
+   #ifdef _WIN32
+      InterlockedIncrement (&ctx->use_count);
+   #else
+      __sync_add_and_fetch (&ctx->use_count, 1);
+   #endif
 }
 
 void lw_pump_remove_user (lw_pump ctx)
 {
-   -- ctx->use_count;
+   #ifdef _WIN32
+      InterlockedDecrement (&ctx->use_count);
+   #else
+      __sync_sub_and_fetch (&ctx->use_count, 1);
+   #endif
 }
 
 lw_bool lw_pump_in_use (lw_pump ctx)
@@ -90,6 +103,61 @@ void lw_pump_post (lw_pump ctx, void * proc, void * param)
    ctx->def->post (ctx, proc, param);
 }
 
+static lwp_workpool get_workpool (lw_pump ctx)
+{
+   if (!ctx->workpool)
+   {
+      lwp_workpool workpool;
+
+      if (ctx->parent)
+      {
+         /* Each loop pump of a threaded pump only has its own done queue,
+          * rather than num_cpus workers of its own.
+          */
+         lwp_workpool shared = get_workpool (ctx->parent);
+
+         workpool = shared ? lwp_workpool_new_shared (ctx, shared) : 0;
+      }
+      else
+         workpool = lwp_workpool_new (ctx, 0);
+
+      if (!workpool)
+         return 0;
+
+      /* A threaded pump may get here from more than one thread at once
+       */
+      #ifdef _WIN32
+         if (InterlockedCompareExchangePointer
+               ((void **) &ctx->workpool, workpool, 0) != 0)
+      #else
+         if (!__sync_bool_compare_and_swap (&ctx->workpool, 0, workpool))
+      #endif
+      {
+         lwp_workpool_delete (workpool);
+      }
+   }
+
+   return ctx->workpool;
+}
+
+lw_bool lw_pump_post_work (lw_pump ctx, void * work, void * done, void * param)
+{
+   lwp_workpool workpool = get_workpool (ctx);
+
+   if (!workpool)
+      return lw_false;
+
+   lw_pump_add_user (ctx);
+
+   if (!lwp_workpool_post (workpool, work, done, param))
+   {
+      lw_pump_remove_user (ctx);
+      return lw_false;
+   }
+
+   return lw_true;
+}
+
 #ifdef _WIN32
 
    lw_pump_watch lw_pump_add (lw_pump ctx, HANDLE handle,
@@ -30,13 +30,23 @@
 #ifndef _lw_pump_h
 #define _lw_pump_h
 
+#include "workpool.h"
+
 struct _lw_pump
 {
    const lw_pumpdef * def;
 
-   long use_count;
+   volatile long use_count;
    
    void * tag;
+
+   /* Created on the first lw_pump_post_work
+    */
+   lwp_workpool workpool;
+
+   /* For the loop pumps of a threaded pump, which share its workers
+    */
+   lw_pump parent;
 };
 
 void lwp_pump_init (lw_pump ctx, const lw_pumpdef * def);
@@ -0,0 +1,220 @@
+
+
+/* vim: set et ts=3 sw=3 ft=c:
+ *
+ * Copyright (C) 2013 James McLaughlin et al.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+#include "stream.h"
+
+/* A token bucket: tokens accumulate at rate bytes per second up to burst,
+ * and each byte passed on costs one.
+ */
+
+#define lwp_ratelimit_max_delay  100 /* ms */
+
+typedef struct _lwp_ratelimit
+{
+   struct _lw_stream stream;
+
+   size_t rate, burst;
+
+   size_t tokens;
+   lw_i64 last_refill;
+
+   lw_timer timer;
+
+} * lwp_ratelimit;
+
+const static lw_streamdef def_ratelimit;
+
+static void refill (lwp_ratelimit ctx)
+{
+   lw_i64 now = lwp_time_ms ();
+   lw_i64 elapsed = now - ctx->last_refill;
+
+   if (elapsed < 0)
+   {
+      ctx->last_refill = now;
+      return;
+   }
+
+   if (elapsed > 1000 * 60)
+      elapsed = 1000 * 60;
+
+   lw_i64 tokens = (((lw_i64) ctx->rate) * elapsed) / 1000;
+
+   /* Leave last_refill alone until at least one token is due, so that
+    * slow rates still get somewhere.
+    */
+
+   if (tokens == 0)
+      return;
+
+   ctx->last_refill = now;
+
+   if (tokens >= ctx->burst - ctx->tokens)
+      ctx->tokens = ctx->burst;
+   else
+      ctx->tokens += (size_t) tokens;
+}
+
+static void on_tick (lw_timer timer)
+{
+   lwp_ratelimit ctx = (lwp_ratelimit) lw_timer_tag (timer);
+
+   lw_stream_retry ((lw_stream) ctx, lw_stream_retry_now);
+}
+
+static size_t def_sink_data (lw_stream stream, const char * buffer,
+                             size_t size)
+{
+   lwp_ratelimit ctx = (lwp_ratelimit) stream;
+
+   size_t allowed = size;
+
+   if (ctx->rate)
+   {
+      refill (ctx);
+
+      if (allowed > ctx->tokens)
+         allowed = ctx->tokens;
+
+      ctx->tokens -= allowed;
+
+      if (allowed < size && !lw_timer_started (ctx->timer))
+      {
+         /* The rest stays queued.  Come back once there are enough tokens
+          * for it (or for a whole burst, if that's less), but no later than
+          * lwp_ratelimit_max_delay so that slow rates still trickle.
+          */
+
+         size_t wanted = size - allowed;
+
+         if (wanted > ctx->burst)
+            wanted = ctx->burst;
+
+         long delay = (long) ((((lw_i64) wanted) * 1000 + ctx->rate - 1)
+                                 / ctx->rate);
+
+         if (delay > lwp_ratelimit_max_delay)
+            delay = lwp_ratelimit_max_delay;
+
+         lw_timer_start_once (ctx->timer, delay > 0 ? delay : 1);
+      }
+   }
+
+   if (allowed > 0)
+      lw_stream_data (stream, buffer, allowed);
+
+   return allowed;
+}
+
+static void def_cleanup (lw_stream stream)
+{
+   lwp_ratelimit ctx = (lwp_ratelimit) stream;
+
+   lw_timer_delete (ctx->timer);
+}
+
+const static lw_streamdef def_ratelimit =
+{
+   def_sink_data,
+   0, /* sink_stream */
+   0, /* retry */
+   0, /* is_transparent */
+   0, /* close */
+   0, /* bytes_left */
+   0, /* read */
+   def_cleanup
+};
+
+lw_stream lw_ratelimit_new (lw_pump pump, size_t bytes_per_sec, size_t burst)
+{
+   lwp_ratelimit ctx = (lwp_ratelimit) malloc (sizeof (*ctx));
+
+   if (!ctx)
+      return 0;
+
+   if (! (ctx->timer = lw_timer_new (pump)))
+   {
+      free (ctx);
+      return 0;
+   }
+
+   lwp_stream_init (&ctx->stream, &def_ratelimit, pump);
+
+   lw_timer_set_tag (ctx->timer, ctx);
+   lw_timer_on_tick (ctx->timer, on_tick);
+
+   ctx->rate = ctx->tokens = 0;
+   ctx->last_refill = lwp_time_ms ();
+
+   lw_ratelimit_set ((lw_stream) ctx, bytes_per_sec, burst);
+
+   ctx->tokens = ctx->burst;
+
+   return (lw_stream) ctx;
+}
+
+void lw_ratelimit_set (lw_stream stream, size_t bytes_per_sec, size_t burst)
+{
+   assert (lw_stream_get_def (stream) == &def_ratelimit);
+
+   lwp_ratelimit ctx = (lwp_ratelimit) stream;
+
+   if (ctx->rate)
+      refill (ctx);
+
+   /* Timers only fire every millisecond or so, so the bucket has to hold at
+    * least a few milliseconds' worth for the rate to be reachable.
+    */
+
+   if (burst == 0)
+      burst = bytes_per_sec;
+
+   if (burst < bytes_per_sec / 100)
+      burst = bytes_per_sec / 100;
+
+   ctx->rate = bytes_per_sec;
+   ctx->burst = burst;
+
+   if (ctx->tokens > burst)
+      ctx->tokens = burst;
+
+   /* Pause whatever is reading into us once a burst is waiting */
+
+   lw_stream_set_watermarks (stream, bytes_per_sec ? burst : 0, burst / 2);
+
+   /* The rate may have gone up (or away), so whatever is queued may be able
+    * to go now.
+    */
+
+   lw_timer_stop (ctx->timer);
+   lw_stream_retry (stream, lw_stream_retry_now);
+}
+
@@ -0,0 +1,157 @@
+
+/* vim: set et ts=3 sw=3 ft=c:
+ *
+ * Copyright (C) 2013 James McLaughlin et al.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+lwp_refbuffer lwp_refbuffer_new (const char * buffer, size_t length,
+                                 void * free_fn, void * tag)
+{
+   lwp_refbuffer ctx = (lwp_refbuffer) malloc (sizeof (*ctx));
+
+   if (!ctx)
+      return 0;
+
+   ctx->refcount = 1;
+   ctx->buffer = buffer;
+   ctx->length = length;
+   ctx->free_fn = (void (lw_callback *) (void *)) free_fn;
+   ctx->tag = tag;
+   ctx->size_class = -1;
+
+   return ctx;
+}
+
+/* Pooled buffers come in a few sizes, so that a small read doesn't tie up a
+ * whole lwp_default_buffer_size buffer.
+ */
+
+static const size_t size_classes [] =
+{
+   1024 * 4, 1024 * 16, lwp_default_buffer_size
+};
+
+#define lwp_refbuffer_num_classes \
+   ((int) (sizeof (size_classes) / sizeof (*size_classes)))
+
+#define lwp_refbuffer_pool_depth  8
+
+static lwp_thread_local struct
+{
+   int count [lwp_refbuffer_num_classes];
+   lwp_refbuffer buffers [lwp_refbuffer_num_classes] [lwp_refbuffer_pool_depth];
+
+   lw_bool on_exit;
+
+} pool;
+
+static void pool_free (void)
+{
+   for (int i = 0; i < lwp_refbuffer_num_classes; ++ i)
+   {
+      while (pool.count [i] > 0)
+         free (pool.buffers [i] [-- pool.count [i]]);
+   }
+
+   pool.on_exit = lw_false;
+}
+
+lwp_refbuffer lwp_refbuffer_new_pooled (size_t length)
+{
+   int index = 0;
+
+   while (index < lwp_refbuffer_num_classes - 1 && size_classes [index] < length)
+      ++ index;
+
+   lwp_refbuffer ctx;
+
+   if (pool.count [index] > 0)
+   {
+      ctx = pool.buffers [index] [-- pool.count [index]];
+   }
+   else
+   {
+      if (! (ctx = (lwp_refbuffer) malloc (sizeof (*ctx) + size_classes [index])))
+         return 0;
+   }
+
+   ctx->refcount = 1;
+   ctx->buffer = (const char *) (ctx + 1);
+   ctx->length = size_classes [index];
+   ctx->free_fn = 0;
+   ctx->tag = 0;
+   ctx->size_class = index;
+
+   return ctx;
+}
+
+void lwp_refbuffer_retain (lwp_refbuffer ctx)
+{
+   #ifdef _WIN32
+      InterlockedIncrement (&ctx->refcount);
+   #else
+      __sync_add_and_fetch (&ctx->refcount, 1);
+   #endif
+}
+
+void lwp_refbuffer_release (lwp_refbuffer ctx)
+{
+   #ifdef _WIN32
+      if (InterlockedDecrement (&ctx->refcount) > 0)
+         return;
+   #else
+      if (__sync_sub_and_fetch (&ctx->refcount, 1) > 0)
+         return;
+   #endif
+
+   if (ctx->free_fn)
+      ctx->free_fn (ctx->tag);
+
+   if (ctx->size_class != -1
+         && pool.count [ctx->size_class] < lwp_refbuffer_pool_depth)
+   {
+      if (!pool.on_exit)
+      {
+         lwp_thread_on_exit (pool_free);
+         pool.on_exit = lw_true;
+      }
+
+      pool.buffers [ctx->size_class] [pool.count [ctx->size_class] ++] = ctx;
+      return;
+   }
+
+   free (ctx);
+}
+
+lw_bool lwp_refbuffer_contains (lwp_refbuffer ctx, const char * buffer,
+                                size_t length)
+{
+   return buffer >= ctx->buffer
+      && buffer + length <= ctx->buffer + ctx->length;
+}
+
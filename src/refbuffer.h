@@ -0,0 +1,79 @@
+
+/* vim: set et ts=3 sw=3 ft=c:
+ *
+ * Copyright (C) 2013 James McLaughlin et al.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _lw_refbuffer_h
+#define _lw_refbuffer_h
+
+/* A buffer owned by someone else (e.g. the application), or by the refbuffer
+ * itself for pooled buffers, which the stream queues can hold slices of
+ * without copying.  free_fn is called with tag once the last reference is
+ * released.
+ */
+typedef struct _lwp_refbuffer
+{
+   /* Not lwp_refcounted, as a buffer written to many streams can easily have
+    * more references than its short counts.  Atomic, because slices can be
+    * released from other threads (e.g. by the loop threads of a threaded
+    * pump).
+    */
+   volatile long refcount;
+
+   const char * buffer;
+   size_t length;
+
+   void (lw_callback * free_fn) (void * tag);
+   void * tag;
+
+   /* For buffers from lwp_refbuffer_new_pooled, the size class the buffer
+    * goes back to (otherwise -1).  The data follows the struct.
+    */
+   int size_class;
+
+} * lwp_refbuffer;
+
+lwp_refbuffer lwp_refbuffer_new (const char * buffer, size_t length,
+                                 void * free_fn, void * tag);
+
+/* Returns a writable buffer of at least length bytes (up to
+ * lwp_default_buffer_size), owned by the refbuffer itself and recycled through
+ * a per-thread pool when released.  length is set to the actual size.
+ */
+lwp_refbuffer lwp_refbuffer_new_pooled (size_t length);
+
+void lwp_refbuffer_retain (lwp_refbuffer);
+void lwp_refbuffer_release (lwp_refbuffer);
+
+/* Returns true if [buffer, buffer + length) lies within the refbuffer, and so
+ * can be queued as a slice of it.
+ */
+lw_bool lwp_refbuffer_contains (lwp_refbuffer, const char * buffer,
+                                size_t length);
+
+#endif
+
@@ -77,6 +77,31 @@ lw_stream lw_stream_from_tail (void * tail)
    return ((lw_stream) tail) - 1;
 }
 
+/* True if the stream or any stream it's linked to is filtered, in which case
+ * its links can't be cut out of the expanded graph one at a time (see
+ * lwp_streamgraph_remove_link).
+ */
+
+static lw_bool links_filtered (lw_stream ctx)
+{
+   if (lwp_stream_is_filtered (ctx))
+      return lw_true;
+
+   list_each (ctx->prev, link)
+   {
+      if (lwp_stream_is_filtered (link->from))
+         return lw_true;
+   }
+
+   list_each (ctx->next, link)
+   {
+      if (lwp_stream_is_filtered (link->to))
+         return lw_true;
+   }
+
+   return lw_false;
+}
+
 void lw_stream_delete (lw_stream ctx)
 {
    if (!ctx)
@@ -89,7 +114,24 @@ void lw_stream_delete (lw_stream ctx)
 
    list_clear (ctx->data_hooks);
 
-   lwp_streamgraph_clear_expanded (ctx->graph);
+   if (ctx->flags & lwp_stream_flag_full)
+   {
+      ctx->flags &= ~ lwp_stream_flag_full;
+      -- ctx->graph->num_full;
+   }
+
+   /* An unfiltered stream can be cut out of the expanded graph by
+    * lw_stream_close, leaving the rest of the graph as it is.
+    */
+
+   lw_bool incremental = ctx->graph->expanded
+      && (! (ctx->flags & lwp_stream_flag_closing))
+      && !links_filtered (ctx);
+
+   if (incremental)
+      ctx->exp_data_hooks.length = 0;
+   else
+      lwp_streamgraph_clear_expanded (ctx->graph);
 
    lw_stream_close (ctx, lw_true);
 
@@ -103,6 +145,19 @@ void lw_stream_delete (lw_stream ctx)
 
    list_remove (ctx->graph->roots, ctx);
 
+   if (incremental)
+   {
+      ++ ctx->graph->last_expand;
+      list_remove (ctx->graph->roots_expanded, ctx);
+   }
+
+   /* Deleting a filter below can delete the graph if it was the last stream
+    * left in it, so hold on to it until we're done.
+    */
+
+   lwp_streamgraph graph = ctx->graph;
+   lwp_retain (graph, "stream_delete");
+
    /* If this stream is filtering any other streams, remove it from their
     * filter list.
     */
@@ -112,8 +167,7 @@ void lw_stream_delete (lw_stream ctx)
       lwp_stream_filterspec spec = list_front (ctx->filtering);
       list_pop_front (ctx->filtering);
 
-      list_remove (spec->stream->filters_upstream, spec);
-      list_remove (spec->stream->filters_downstream, spec);
+      list_elem_remove (spec->stream_elem);
 
       free (spec);
    }
@@ -127,7 +181,7 @@ void lw_stream_delete (lw_stream ctx)
       lwp_stream_filterspec spec = list_front (ctx->filters_upstream);
       list_pop_front (ctx->filters_upstream);
 
-      list_remove (spec->filter->filtering, spec);
+      list_elem_remove (spec->filter_elem);
 
       if (spec->delete_with_stream)
          lw_stream_delete (spec->filter);
@@ -144,7 +198,7 @@ void lw_stream_delete (lw_stream ctx)
       lwp_stream_filterspec spec = list_front (ctx->filters_downstream);
       list_pop_front (ctx->filters_downstream);
 
-      list_remove (spec->filter->filtering, spec);
+      list_elem_remove (spec->filter_elem);
 
       if (spec->delete_with_stream)
          lw_stream_delete (spec->filter);
@@ -154,10 +208,15 @@ void lw_stream_delete (lw_stream ctx)
 
    /* Is the graph empty now? */
 
-   if (list_length (ctx->graph->roots) == 0)
-      lwp_streamgraph_delete (ctx->graph);
-   else
-      lwp_streamgraph_expand (ctx->graph);
+   if (!graph->dead)
+   {
+      if (list_length (graph->roots) == 0)
+         lwp_streamgraph_delete (graph);
+      else if (!incremental)
+         lwp_streamgraph_expand (graph);
+   }
+
+   lwp_release (graph, "stream_delete");
 
    ctx->graph = 0;
 
@@ -167,14 +226,30 @@ void lw_stream_delete (lw_stream ctx)
    /* Clear queues */
 
    list_each (ctx->front_queue, queued)
+   {
       lwp_heapbuffer_free (&queued.buffer);
 
+      if (queued.ref)
+         lwp_refbuffer_release (queued.ref);
+   }
+
    list_each (ctx->back_queue, queued)
+   {
       lwp_heapbuffer_free (&queued.buffer);
 
+      if (queued.ref)
+         lwp_refbuffer_release (queued.ref);
+   }
+
    list_clear (ctx->front_queue);
    list_clear (ctx->back_queue);
 
+   ctx->queued_bytes = 0;
+
+   lwp_streamgraph_array_free (&ctx->exp_data_hooks);
+   lwp_streamgraph_array_free (&ctx->prev_expanded);
+   lwp_streamgraph_array_free (&ctx->next_expanded);
+
 
    /* This matches the lwp_retain in lw_stream_new, allowing the refcount to
     * become 0 and the stream to be destroyed.
@@ -211,10 +286,73 @@ void lw_stream_writev (lw_stream ctx, const char * format, va_list args)
 }
 
 
+void lw_stream_write_buffer (lw_stream ctx, const char * buffer, size_t size,
+                             void * free_fn, void * tag)
+{
+   if (size == -1)
+      size = strlen (buffer);
+
+   lwp_refbuffer ref = lwp_refbuffer_new (buffer, size, free_fn, tag);
+
+   if (!ref)
+   {
+      /* Fall back to copying anything that can't be written straight away */
+
+      lwp_stream_write (ctx, buffer, size, 0);
+
+      if (free_fn)
+         ((void (lw_callback *) (void *)) free_fn) (tag);
+
+      return;
+   }
+
+   lwp_stream_write_ref (ctx, ref, buffer, size, 0);
+
+   lwp_refbuffer_release (ref);
+}
+
+
 /* Convenience queue functions for lwp_stream_write */
 
-static void queue_back (lw_stream ctx, const char * buffer, size_t size)
+static struct _lwp_stream_queued queued_ref (lwp_refbuffer ref,
+                                             const char * buffer, size_t size)
+{
+   struct _lwp_stream_queued queued = {};
+
+   queued.type = lwp_stream_queued_buffer;
+   queued.ref = ref;
+   queued.ref_data = buffer;
+   queued.ref_length = size;
+
+   lwp_refbuffer_retain (ref);
+
+   return queued;
+}
+
+/* Accounts for size more bytes in the queues, noting when they started
+ * waiting if they were empty.
+ */
+
+static void add_queued (lw_stream ctx, size_t size)
+{
+   if (!ctx->queued_bytes)
+      ctx->queued_since = lwp_time_ms ();
+
+   if ((ctx->queued_bytes += size) > ctx->max_queued_bytes)
+      ctx->max_queued_bytes = ctx->queued_bytes;
+}
+
+static void queue_back (lw_stream ctx, lwp_refbuffer ref,
+                        const char * buffer, size_t size)
 {
+   add_queued (ctx, size);
+
+   if (ref && lwp_refbuffer_contains (ref, buffer, size))
+   {
+      list_push (ctx->back_queue, queued_ref (ref, buffer, size));
+      return;
+   }
+
    if ( (!list_length (ctx->back_queue)) ||
          list_back (ctx->back_queue).type != lwp_stream_queued_data)
    {
@@ -228,8 +366,17 @@ static void queue_back (lw_stream ctx, const char * buffer, size_t size)
    lwp_heapbuffer_add (&list_elem_back (ctx->back_queue)->buffer, buffer, size);
 }
 
-static void queue_front (lw_stream ctx, const char * buffer, size_t size)
+static void queue_front (lw_stream ctx, lwp_refbuffer ref,
+                         const char * buffer, size_t size)
 {
+   add_queued (ctx, size);
+
+   if (ref && lwp_refbuffer_contains (ref, buffer, size))
+   {
+      list_push (ctx->front_queue, queued_ref (ref, buffer, size));
+      return;
+   }
+
    if ( (!list_length (ctx->front_queue)) ||
          list_back (ctx->front_queue).type != lwp_stream_queued_data)
    {
@@ -244,6 +391,33 @@ static void queue_front (lw_stream ctx, const char * buffer, size_t size)
 }
 
 size_t lwp_stream_write (lw_stream ctx, const char * buffer, size_t size, int flags)
+{
+   return lwp_stream_write_ref (ctx, 0, buffer, size, flags);
+}
+
+static size_t write_ref (lw_stream ctx, lwp_refbuffer ref,
+                         const char * buffer, size_t size, int flags);
+
+size_t lwp_stream_write_ref (lw_stream ctx, lwp_refbuffer ref,
+                             const char * buffer, size_t size, int flags)
+{
+   if (!ctx->high_watermark)
+      return write_ref (ctx, ref, buffer, size, flags);
+
+   lwp_retain (ctx, "stream_write");
+
+   size = write_ref (ctx, ref, buffer, size, flags);
+
+   if (lwp_release (ctx, "stream_write") || ctx->flags & lwp_stream_flag_dead)
+      return size;
+
+   lwp_stream_check_watermarks (ctx);
+
+   return size;
+}
+
+static size_t write_ref (lw_stream ctx, lwp_refbuffer ref,
+                         const char * buffer, size_t size, int flags)
 {
    if (size == -1)
       size = strlen (buffer);
@@ -265,11 +439,11 @@ size_t lwp_stream_write (lw_stream ctx, const char * buffer, size_t size, int fl
 
       if (flags & lwp_stream_write_partial)
       {
-         return lwp_stream_write (ctx->head_upstream, buffer, size,
-                                  lwp_stream_write_partial);
+         return lwp_stream_write_ref (ctx->head_upstream, ref, buffer, size,
+                                      lwp_stream_write_partial);
       }
 
-      lwp_stream_write (ctx->head_upstream, buffer, size, 0);
+      lwp_stream_write_ref (ctx->head_upstream, ref, buffer, size, 0);
 
       return size;
    }
@@ -287,7 +461,7 @@ size_t lwp_stream_write (lw_stream ctx, const char * buffer, size_t size, int fl
           * Queue the data to write when we're not busy.
           */
 
-         queue_back (ctx, buffer, size);
+         queue_back (ctx, ref, buffer, size);
 
          return size;
       }
@@ -304,7 +478,7 @@ size_t lwp_stream_write (lw_stream ctx, const char * buffer, size_t size, int fl
          if (flags & lwp_stream_write_partial)
             return 0;
 
-         queue_front (ctx, buffer, size);
+         queue_front (ctx, ref, buffer, size);
 
          if (ctx->retry == lw_stream_retry_more_data)
             lw_stream_retry (ctx, lw_stream_retry_now);
@@ -314,13 +488,15 @@ size_t lwp_stream_write (lw_stream ctx, const char * buffer, size_t size, int fl
 
       if (ctx->def->is_transparent && ctx->def->is_transparent (ctx))
       {
-         lw_stream_data (ctx, buffer, size);
+         lwp_stream_data_ref (ctx, ref, buffer, size);
          return size;
       }
 
       size_t written = ctx->def->sink_data ?
          ctx->def->sink_data (ctx, buffer, size) : size;
 
+      ctx->bytes_sent += written;
+
       lwp_trace ("%p : Stream sank " lwp_fmt_size " of " lwp_fmt_size,
                      ctx, written, size);
 
@@ -328,7 +504,7 @@ size_t lwp_stream_write (lw_stream ctx, const char * buffer, size_t size, int fl
          return written;
 
       if (written < size)
-         queue_front (ctx, buffer + written, size - written);
+         queue_front (ctx, ref, buffer + written, size - written);
 
       return size;
    }
@@ -344,7 +520,7 @@ size_t lwp_stream_write (lw_stream ctx, const char * buffer, size_t size, int fl
       if (flags & lwp_stream_write_partial)
          return 0;
 
-      queue_back (ctx, buffer, size);
+      queue_back (ctx, ref, buffer, size);
 
       if (ctx->retry == lw_stream_retry_more_data)
          lw_stream_retry (ctx, lw_stream_retry_now);
@@ -358,13 +534,15 @@ size_t lwp_stream_write (lw_stream ctx, const char * buffer, size_t size, int fl
 
    if (ctx->def->is_transparent && ctx->def->is_transparent (ctx))
    {
-      lw_stream_data (ctx, buffer, size);
+      lwp_stream_data_ref (ctx, ref, buffer, size);
       return size;
    }
 
    size_t written = ctx->def->sink_data ?
        ctx->def->sink_data (ctx, buffer, size) : size;
 
+   ctx->bytes_sent += written;
+
    if (flags & lwp_stream_write_partial)
       return written;
 
@@ -372,7 +550,16 @@ size_t lwp_stream_write (lw_stream ctx, const char * buffer, size_t size, int fl
    {
       if (flags & lwp_stream_write_ignore_queue)
       {
-         if (lwp_heapbuffer_length (&list_front (ctx->back_queue).buffer) == 0)
+         add_queued (ctx, size - written);
+
+         if (ref && lwp_refbuffer_contains (ref, buffer + written, size - written))
+         {
+            list_push_front (ctx->back_queue,
+                  queued_ref (ref, buffer + written, size - written));
+         }
+         else if (list_length (ctx->back_queue) > 0
+               && list_front (ctx->back_queue).type == lwp_stream_queued_data
+               && lwp_heapbuffer_length (&list_front (ctx->back_queue).buffer) == 0)
          {
             lwp_heapbuffer_add (&list_elem_front (ctx->back_queue)->buffer,
                                 buffer + written, size - written);
@@ -392,13 +579,82 @@ size_t lwp_stream_write (lw_stream ctx, const char * buffer, size_t size, int fl
       }
       else
       {
-         queue_back (ctx, buffer + written, size - written);
+         queue_back (ctx, ref, buffer + written, size - written);
       }
    }
 
    return size;
 }
 
+/* True if data written to the stream now could go straight to sink_data_vec,
+ * not counting the queues.
+ */
+
+static lw_bool can_sink_vec (lw_stream ctx)
+{
+   return ctx->def->sink_data_vec && !ctx->head_upstream
+      && ! (ctx->def->is_transparent && ctx->def->is_transparent (ctx));
+}
+
+/* The same for data already in the queues, which has been through any
+ * upstream filters
+ */
+
+static lw_bool can_sink_queue_vec (lw_stream ctx)
+{
+   return ctx->def->sink_data_vec
+      && ! (ctx->def->is_transparent && ctx->def->is_transparent (ctx));
+}
+
+void lw_stream_write_vec (lw_stream ctx, const lw_iovec * vec, int count)
+{
+   if ( (!can_sink_vec (ctx)) || list_length (ctx->prev) > 0
+         || (ctx->flags & lwp_stream_flag_queueing)
+         || list_length (ctx->back_queue) > 0)
+   {
+      for (int i = 0; i < count; ++ i)
+         lwp_stream_write (ctx, vec [i].buffer, vec [i].length, 0);
+
+      return;
+   }
+
+   while (count > 0)
+   {
+      int num = count > lwp_stream_max_vec ? lwp_stream_max_vec : count;
+      size_t size = 0;
+
+      for (int i = 0; i < num; ++ i)
+         size += vec [i].length;
+
+      size_t written = ctx->def->sink_data_vec (ctx, vec, num);
+
+      ctx->bytes_sent += written;
+
+      if (written < size)
+      {
+         /* Queue whatever is left, including any buffers we haven't got to */
+
+         for (; count > 0; ++ vec, -- count)
+         {
+            if (written >= vec->length)
+            {
+               written -= vec->length;
+               continue;
+            }
+
+            queue_back (ctx, 0, vec->buffer + written, vec->length - written);
+            written = 0;
+         }
+
+         lwp_stream_check_watermarks (ctx);
+         return;
+      }
+
+      vec += num;
+      count -= num;
+   }
+}
+
 void lw_stream_write_stream (lw_stream ctx, lw_stream source,
                              size_t size, lw_bool delete_when_finished)
 {
@@ -465,13 +721,16 @@ void lwp_stream_write_stream (lw_stream ctx, lw_stream source,
    link->delete_stream = (flags & lwp_stream_write_delete_stream);
 
    list_push (source->next, link);
+   link->from_elem = list_elem_back (source->next);
+
    list_push (ctx->prev, link);
+   link->to_elem = list_elem_back (ctx->prev);
 
    /* This stream is now linked to, so doesn't need to be a root */
 
    list_remove (ctx->graph->roots, ctx);
 
-   lwp_streamgraph_expand (ctx->graph);
+   lwp_streamgraph_insert_link (ctx->graph, link);
    lwp_streamgraph_read (ctx->graph);
 }
 
@@ -508,7 +767,10 @@ void lw_stream_add_filter_upstream (lw_stream ctx, lw_stream filter,
    /* Upstream data passes through the most recently added filter first */
 
    list_push (ctx->filters_upstream, spec);
+   spec->stream_elem = list_elem_back (ctx->filters_upstream);
+
    list_push (filter->filtering, spec);
+   spec->filter_elem = list_elem_back (filter->filtering);
 
    if (filter->graph != ctx->graph)
       lwp_streamgraph_swallow (ctx->graph, filter->graph);
@@ -535,7 +797,10 @@ void lw_stream_add_filter_downstream (lw_stream ctx, lw_stream filter,
    /* Downstream data passes through the most recently added filter last */
 
    list_push (ctx->filters_downstream, spec);
+   spec->stream_elem = list_elem_back (ctx->filters_downstream);
+
    list_push (filter->filtering, spec);
+   spec->filter_elem = list_elem_back (filter->filtering);
 
    if (filter->graph != ctx->graph)
       lwp_streamgraph_swallow (ctx->graph, filter->graph);
@@ -559,24 +824,35 @@ void lw_stream_read (lw_stream ctx, size_t bytes)
 
 void lw_stream_data (lw_stream ctx, const char * buffer, size_t size)
 {
-   int num_data_hooks = list_length (ctx->exp_data_hooks);
+   lwp_stream_data_ref (ctx, 0, buffer, size);
+}
+
+void lwp_stream_data_ref (lw_stream ctx, lwp_refbuffer ref,
+                          const char * buffer, size_t size)
+{
+   int num_data_hooks = ctx->exp_data_hooks.length;
+
+   ctx->bytes_received += size;
 
    lwp_retain (ctx, "lw_stream_data");
 
-   /* TODO: The data hook list would be faster to make a copy of if it was     
-    * a real array.
+   /* Hooks may be removed (and freed) by the hooks we call, so work from a
+    * copy.  The usual case of a single hook doesn't need the alloca.
     */
 
-   lwp_stream_data_hook data_hooks = (lwp_stream_data_hook) alloca
-       (sizeof (struct _lwp_stream_data_hook) * num_data_hooks);
+   struct _lwp_stream_data_hook single_hook;
+
+   lwp_stream_data_hook data_hooks = num_data_hooks == 1 ? &single_hook :
+      (lwp_stream_data_hook) alloca
+         (sizeof (struct _lwp_stream_data_hook) * num_data_hooks);
 
-   int i = 0;
+   int i;
 
-   list_each (ctx->exp_data_hooks, hook)
+   for (i = 0; i < num_data_hooks; ++ i)
    {
-      data_hooks [i ++] = *hook;
+      data_hooks [i] = * (lwp_stream_data_hook) ctx->exp_data_hooks.items [i];
 
-      lwp_retain (hook->stream, "stream_data hook");
+      lwp_retain (data_hooks [i].stream, "stream_data hook");
    }
 
    for (i = 0; i < num_data_hooks; ++ i)
@@ -584,8 +860,15 @@ void lw_stream_data (lw_stream ctx, const char * buffer, size_t size)
       lwp_stream_data_hook hook = &data_hooks [i];
 
       if (! (hook->stream->flags & lwp_stream_flag_dead))
+      {
+         lwp_refbuffer prev_ref = hook->stream->data_ref;
+         hook->stream->data_ref = ref;
+
          hook->proc (hook->stream, hook->tag, buffer, size);
 
+         hook->stream->data_ref = prev_ref;
+      }
+
       lwp_release (hook->stream, "stream_data hook");
    }
 
@@ -595,38 +878,56 @@ void lw_stream_data (lw_stream ctx, const char * buffer, size_t size)
 
    if (! (ctx->flags & lwp_stream_flag_dead))
    {
-      lwp_stream_push (ctx, buffer, size);
+      lwp_stream_push_ref (ctx, ref, buffer, size);
    }
 
    lwp_release (ctx, "lw_stream_data");
 }
 
+void * lw_stream_retain_data (lw_stream ctx)
+{
+   if (!ctx->data_ref)
+      return 0;
+
+   lwp_refbuffer_retain (ctx->data_ref);
+
+   return ctx->data_ref;
+}
+
+void lw_stream_release_data (void * data)
+{
+   if (data)
+      lwp_refbuffer_release ((lwp_refbuffer) data);
+}
+
 void lwp_stream_push (lw_stream ctx, const char * buffer, size_t size)
 {
-   int num_links = list_length (ctx->next_expanded);
+   lwp_stream_push_ref (ctx, 0, buffer, size);
+}
+
+void lwp_stream_push_ref (lw_stream ctx, lwp_refbuffer ref,
+                          const char * buffer, size_t size)
+{
+   int num_links = ctx->next_expanded.length;
 
    if (!num_links)
       return;  /* nothing to do */
 
    lwp_retain (ctx, "stream_push");
 
-   lwp_streamgraph_link * links = (lwp_streamgraph_link *) alloca
-       (sizeof (lwp_streamgraph_link) * num_links);
-
-   /* Copy the link dest pointers into our local array.
-    *
-    * TODO: This would be faster if the links were a real array in the first
-    * place.
+   /* Links may disappear if the graph re-expands while we're pushing, so work
+    * from a copy.  The usual case of a single link doesn't need the alloca.
     */
 
-   int i = 0;
+   lwp_streamgraph_link single_link;
 
-   lwp_streamgraph_link link;
+   lwp_streamgraph_link * links = num_links == 1 ? &single_link :
+      (lwp_streamgraph_link *) alloca (sizeof (lwp_streamgraph_link) * num_links);
 
-   list_each (ctx->next_expanded, link)
-   {
-      links [i ++] = link;
-   }
+   memcpy (links, ctx->next_expanded.items,
+           sizeof (lwp_streamgraph_link) * num_links);
+
+   lwp_streamgraph_link link;
 
    int last_expand = ctx->graph->last_expand;
 
@@ -653,7 +954,7 @@ void lwp_stream_push (lw_stream ctx, const char * buffer, size_t size)
 
          if (buffer)
          {
-            lwp_stream_write (link->to_exp, buffer, to_write,
+            lwp_stream_write_ref (link->to_exp, ref, buffer, to_write,
                   lwp_stream_write_ignore_filters |
                   lwp_stream_write_ignore_busy);
          }
@@ -664,7 +965,7 @@ void lwp_stream_push (lw_stream ctx, const char * buffer, size_t size)
 
          /* Target stream is transparent - have it push the data forward */
 
-         lwp_stream_push (link->to_exp, buffer, to_write);
+         lwp_stream_push_ref (link->to_exp, ref, buffer, to_write);
       }
 
       /* Pushing data may have caused this stream to be deleted */
@@ -683,7 +984,7 @@ void lwp_stream_push (lw_stream ctx, const char * buffer, size_t size)
 
          for (int x = i; x < num_links; ++ x)
          {
-            if (!list_find (ctx->next_expanded, links [x]))
+            if (!lwp_streamgraph_array_contains (&ctx->next_expanded, links [x]))
             {
                if (link == links [x])
                   link = 0;
@@ -716,10 +1017,8 @@ void lwp_stream_push (lw_stream ctx, const char * buffer, size_t size)
       }
       else
       {
-         lwp_streamgraph_clear_expanded (ctx->graph);
-
-         list_remove (ctx->next, link);
-         list_remove (link->to->prev, link);
+         list_elem_remove (link->from_elem);
+         list_elem_remove (link->to_elem);
 
          /* Since the target and anything after it are still part
           * of this graph, make it a root before deleting the link.
@@ -727,7 +1026,7 @@ void lwp_stream_push (lw_stream ctx, const char * buffer, size_t size)
 
          list_push (ctx->graph->roots, link->to);
 
-         lwp_streamgraph_expand (ctx->graph);
+         lwp_streamgraph_remove_link (ctx->graph, link);
 
          free (link);
 
@@ -748,7 +1047,7 @@ void lwp_stream_push (lw_stream ctx, const char * buffer, size_t size)
        */
 
       for (int x = i; x < num_links; ++ x)
-         if (!list_find (ctx->next_expanded, links [x]))
+         if (!lwp_streamgraph_array_contains (&ctx->next_expanded, links [x]))
             links [x] = 0;
    }
 
@@ -762,6 +1061,85 @@ void lwp_stream_push (lw_stream ctx, const char * buffer, size_t size)
    }
 }
 
+static const char * queued_data (lwp_stream_queued queued, size_t * length)
+{
+   if (queued->type == lwp_stream_queued_data)
+   {
+      *length = lwp_heapbuffer_length (&queued->buffer);
+      return lwp_heapbuffer_buffer (&queued->buffer);
+   }
+
+   if (queued->type == lwp_stream_queued_buffer)
+   {
+      *length = queued->ref_length;
+      return queued->ref_data;
+   }
+
+   return 0;
+}
+
+/* Writes the run of data/buffer items at the front of the queue with a single
+ * sink_data_vec.  Returns false if not everything could be written.
+ */
+
+static lw_bool write_queue_vec (lw_stream ctx,
+                                list (struct _lwp_stream_queued, queue))
+{
+   lw_iovec vec [lwp_stream_max_vec];
+   int count = 0;
+
+   list_each_elem (queue, queued)
+   {
+      if (count == lwp_stream_max_vec)
+         break;
+
+      if (! (vec [count].buffer = queued_data (queued, &vec [count].length)))
+         break;
+
+      ++ count;
+   }
+
+   size_t written = ctx->def->sink_data_vec (ctx, vec, count);
+
+   ctx->bytes_sent += written;
+   ctx->queued_bytes -= written;
+
+   for (int i = 0; i < count; ++ i)
+   {
+      lwp_stream_queued queued = list_elem_front (queue);
+
+      if (written < vec [i].length)
+      {
+         if (queued->type == lwp_stream_queued_data)
+         {
+            lwp_heapbuffer_trim_left (&queued->buffer, written);
+         }
+         else
+         {
+            queued->ref_data += written;
+            queued->ref_length -= written;
+         }
+
+         return lw_false;
+      }
+
+      written -= vec [i].length;
+
+      if (queued->type == lwp_stream_queued_data)
+         lwp_heapbuffer_free (&queued->buffer);
+      else
+         lwp_refbuffer_release (queued->ref);
+
+      list_elem_remove (queued);
+   }
+
+   return lw_true;
+}
+
+/* Anything in the queues has already been through the upstream filters, so
+ * it's written with lwp_stream_write_ignore_filters.
+ */
+
 list_type (struct _lwp_stream_queued) lwp_stream_write_queue
     (lw_stream ctx, list (struct _lwp_stream_queued, queue))
 {
@@ -770,6 +1148,21 @@ list_type (struct _lwp_stream_queued) lwp_stream_write_queue
    while (list_length (queue) > 0)
    {
       lwp_stream_queued queued = list_elem_front (queue);
+      size_t length;
+
+      /* If there's more than one buffer waiting and the stream can take them
+       * all at once, gather them into one write.
+       */
+
+      if (list_length (queue) > 1 && can_sink_queue_vec (ctx)
+            && queued_data (queued, &length)
+            && queued_data (list_elem_next (queued), &length))
+      {
+         if (!write_queue_vec (ctx, queue))
+            break; /* couldn't write everything */
+
+         continue;
+      }
 
       if (queued->type == lwp_stream_queued_begin_marker)
       {
@@ -791,9 +1184,11 @@ list_type (struct _lwp_stream_queued) lwp_stream_write_queue
                  lwp_heapbuffer_length (&queued->buffer),
                  lwp_stream_write_ignore_queue | lwp_stream_write_partial
                       | lwp_stream_write_ignore_busy
+                      | lwp_stream_write_ignore_filters
                );
 
             lwp_heapbuffer_trim_left (&queued->buffer, written);
+            ctx->queued_bytes -= written;
 
             if (lwp_heapbuffer_length (&queued->buffer) > 0)
                break; /* couldn't write everything */
@@ -805,6 +1200,30 @@ list_type (struct _lwp_stream_queued) lwp_stream_write_queue
          continue;
       }
 
+      if (queued->type == lwp_stream_queued_buffer)
+      {
+         size_t written = lwp_stream_write_ref
+            ( ctx,
+              queued->ref,
+              queued->ref_data,
+              queued->ref_length,
+              lwp_stream_write_ignore_queue | lwp_stream_write_partial
+                   | lwp_stream_write_ignore_busy
+                   | lwp_stream_write_ignore_filters
+            );
+
+         queued->ref_data += written;
+         ctx->queued_bytes -= written;
+
+         if ((queued->ref_length -= written) > 0)
+            break; /* couldn't write everything */
+
+         lwp_refbuffer_release (queued->ref);
+
+         list_elem_remove (queued);
+         continue;
+      }
+
       if (queued->type == lwp_stream_queued_stream)
       {
          lw_stream stream = queued->stream;
@@ -868,6 +1287,9 @@ void lwp_stream_write_queued (lw_stream ctx)
    }
 
    ctx->flags &= ~ lwp_stream_flag_draining_queues;
+
+   if (ctx->flags & lwp_stream_flag_full)
+      lwp_stream_check_watermarks (ctx);
 }
 
 void lw_stream_retry (lw_stream ctx, int when)
@@ -901,6 +1323,9 @@ lw_bool lwp_stream_write_direct (lw_stream ctx)
 
    if (written != -1)
    {
+      ctx->bytes_sent += written;
+      ctx->prev_direct->bytes_received += written;
+
       /* Pushing with a buffer of 0 pushes without any data (so the stream
        * logic can operate even though the data was already transmitted).
        */
@@ -918,7 +1343,8 @@ lw_bool lwp_stream_write_direct (lw_stream ctx)
 
 lw_bool lwp_stream_may_close (lw_stream ctx)
 {
-   return list_length (ctx->prev) == 0 &&
+   return (! (ctx->flags & lwp_stream_flag_writing)) &&
+          list_length (ctx->prev) == 0 &&
           list_length (ctx->back_queue) == 0 &&
           list_length (ctx->front_queue) == 0;
 }
@@ -954,9 +1380,15 @@ lw_bool lw_stream_close (lw_stream ctx, lw_bool immediate)
     * later (meaning we don't have to bother)
     */
 
-   lw_bool already_cleared = list_length (ctx->graph->roots_expanded) == 0;
+   lw_bool already_cleared = !ctx->graph->expanded;
 
-   if (!already_cleared)
+   /* Without any filters involved, the links can just be cut out of the
+    * expanded graph instead of expanding it again.
+    */
+
+   lw_bool incremental = (!already_cleared) && !links_filtered (ctx);
+
+   if ((!already_cleared) && !incremental)
       lwp_streamgraph_clear_expanded (ctx->graph);
 
 
@@ -964,7 +1396,10 @@ lw_bool lw_stream_close (lw_stream ctx, lw_bool immediate)
 
    list_each (ctx->prev, link)
    {
-      list_remove (link->from->next, link);
+      list_elem_remove (link->from_elem);
+
+      if (incremental)
+         lwp_streamgraph_remove_link (ctx->graph, link);
 
       free (link);
    }
@@ -977,7 +1412,10 @@ lw_bool lw_stream_close (lw_stream ctx, lw_bool immediate)
    list_each (ctx->next, link)
    {
       list_push (ctx->graph->roots, link->to);
-      list_remove (link->to->prev, link);
+      list_elem_remove (link->to_elem);
+
+      if (incremental)
+         lwp_streamgraph_remove_link (ctx->graph, link);
 
       free (link);
    }
@@ -1042,8 +1480,11 @@ lw_bool lw_stream_close (lw_stream ctx, lw_bool immediate)
       if (!list_find (ctx->graph->roots, ctx))
          list_push (ctx->graph->roots, ctx);
 
-      lwp_streamgraph_expand (ctx->graph);
-      lwp_streamgraph_read (ctx->graph);
+      if (!incremental)
+         lwp_streamgraph_expand (ctx->graph);
+
+      if (! (ctx->flags & lwp_stream_flag_dead))
+         lwp_streamgraph_read (ctx->graph);
    }
 
    list_each (ctx->close_hooks, hook)
@@ -1086,16 +1527,14 @@ void lw_stream_begin_queue (lw_stream stream)
 
 size_t lw_stream_queued (lw_stream stream)
 {
-   size_t size = 0, bytes_left;
+   /* Data in either queue is already counted by queued_bytes, which leaves
+    * only the queued streams.
+    */
+
+   size_t size = stream->queued_bytes, bytes_left;
 
    list_each (stream->back_queue, queued)
    {
-      if (queued.type == lwp_stream_queued_data)
-      {
-         size += lwp_heapbuffer_length (&queued.buffer);
-         continue;
-      }
-
       if (queued.type == lwp_stream_queued_stream)
       {
          if (!queued.stream)
@@ -1119,9 +1558,57 @@ size_t lw_stream_queued (lw_stream stream)
    return size;
 }
 
+void lw_stream_get_stats (lw_stream ctx, lw_stream_stats * stats)
+{
+   memset (stats, 0, sizeof (*stats));
+
+   stats->bytes_sent = ctx->bytes_sent;
+   stats->bytes_received = ctx->bytes_received;
+
+   stats->queued_bytes = ctx->queued_bytes;
+   stats->max_queued_bytes = ctx->max_queued_bytes;
+
+   stats->front_queue = list_length (ctx->front_queue);
+   stats->back_queue = list_length (ctx->back_queue);
+
+   if (ctx->queued_bytes)
+      stats->queued_ms = lwp_time_ms () - ctx->queued_since;
+}
+
+void lw_stream_reset_stats (lw_stream ctx)
+{
+   ctx->bytes_sent = ctx->bytes_received = 0;
+   ctx->max_queued_bytes = ctx->queued_bytes;
+}
+
 void lw_stream_end_queue_hb (lw_stream ctx, int num_head_buffers,
                              const char ** buffers, size_t * lengths)
 {
+   if (can_sink_vec (ctx) && list_length (ctx->prev) == 0
+         && list_length (ctx->front_queue) == 0
+         && ! (ctx->flags & lwp_stream_flag_draining_queues))
+   {
+      /* Put the head buffers at the front of the queue instead, so they go
+       * out in the same write as the queued data.
+       */
+
+      struct _lwp_stream_queued queued = {};
+
+      queued.type = lwp_stream_queued_data;
+
+      for (int i = 0; i < num_head_buffers; ++ i)
+         lwp_heapbuffer_add (&queued.buffer, buffers [i], lengths [i]);
+
+      if (lwp_heapbuffer_length (&queued.buffer) > 0)
+      {
+         add_queued (ctx, lwp_heapbuffer_length (&queued.buffer));
+         list_push_front (ctx->back_queue, queued);
+      }
+
+      lw_stream_end_queue (ctx);
+      return;
+   }
+
    for (int i = 0; i < num_head_buffers; ++ i)
    {
       lwp_stream_write (ctx, buffers [i], lengths [i],
@@ -1144,11 +1631,43 @@ void lw_stream_end_queue (lw_stream ctx)
    lwp_stream_write_queued (ctx);
 }
 
+lw_stream lwp_stream_direct_target (lw_stream source)
+{
+   for (int i = 0; i < source->next_expanded.length; ++ i)
+   {
+      lwp_streamgraph_link link =
+         (lwp_streamgraph_link) source->next_expanded.items [i];
+
+      if (link->to_exp && link->to_exp->prev_direct == source)
+         return link->to_exp;
+   }
+
+   return 0;
+}
+
+lw_bool lwp_stream_is_filtered (lw_stream ctx)
+{
+   return list_length (ctx->filters_upstream) > 0
+       || list_length (ctx->filters_downstream) > 0
+       || list_length (ctx->filtering) > 0;
+}
+
+lw_bool lwp_stream_queues_stream (lw_stream ctx)
+{
+   list_each (ctx->back_queue, queued)
+   {
+      if (queued.type == lwp_stream_queued_stream && queued.stream)
+         return lw_true;
+   }
+
+   return lw_false;
+}
+
 lw_bool lwp_stream_is_transparent (lw_stream ctx)
 {
    assert (! (ctx->flags & lwp_stream_flag_dead));
 
-   if (list_length (ctx->exp_data_hooks) > 0)
+   if (ctx->exp_data_hooks.length > 0)
       return lw_false;
 
    if (list_length (ctx->back_queue) > 0
@@ -1177,8 +1696,7 @@ void lw_stream_add_hook_data (lw_stream stream,
 
    list_push (stream->data_hooks, hook);
 
-   lwp_streamgraph_clear_expanded (stream->graph);
-   lwp_streamgraph_expand (stream->graph);
+   lwp_streamgraph_insert_hook (stream->graph, stream, hook);
 
    /* TODO: Do we need to call lwp_streamgraph_read here? */
 } 
@@ -1191,13 +1709,15 @@ void lw_stream_remove_hook_data (lw_stream stream,
    {
       if ((*hook)->proc == proc && (*hook)->tag == tag)
       {
+         /* Out of data_hooks first, in case the graph is expanded in full */
+
+         lwp_stream_data_hook removed = *hook;
          list_elem_remove (hook);
+
+         lwp_streamgraph_remove_hook (stream->graph, stream, removed);
          break;
       }
    }
-
-   lwp_streamgraph_clear_expanded (stream->graph);
-   lwp_streamgraph_expand (stream->graph);
 }
 
 void lw_stream_add_hook_close (lw_stream stream,
@@ -1206,9 +1726,6 @@ void lw_stream_add_hook_close (lw_stream stream,
 {   
    struct _lwp_stream_close_hook hook = { proc, tag };
    list_push (stream->close_hooks, hook);
-
-   lwp_streamgraph_clear_expanded (stream->graph);
-   lwp_streamgraph_expand (stream->graph);
 } 
 
 void lw_stream_remove_hook_close (lw_stream stream,
@@ -1224,11 +1741,144 @@ void lw_stream_remove_hook_close (lw_stream stream,
          break;
       }
    }
+}
+
+
+void lw_stream_set_watermarks (lw_stream ctx, size_t high, size_t low)
+{
+   if (low > high)
+      low = high;
+
+   ctx->high_watermark = high;
+   ctx->low_watermark = low;
+
+   lwp_stream_check_watermarks (ctx);
+}
+
+void lw_stream_on_queue_full (lw_stream ctx, lw_stream_hook_queue hook)
+{
+   ctx->on_queue_full = hook;
+}
+
+void lw_stream_on_queue_drained (lw_stream ctx, lw_stream_hook_queue hook)
+{
+   ctx->on_queue_drained = hook;
+}
+
+static lw_bool downstream_full (lw_stream ctx, int depth)
+{
+   if (depth > lwp_stream_max_graph_depth)
+      return lw_false;
+
+   for (int i = 0; i < ctx->next_expanded.length; ++ i)
+   {
+      lw_stream next =
+         ((lwp_streamgraph_link) ctx->next_expanded.items [i])->to_exp;
+
+      if (!next)
+         continue;
+
+      if ((next->flags & lwp_stream_flag_full)
+            || downstream_full (next, depth + 1))
+      {
+         return lw_true;
+      }
+   }
 
-   lwp_streamgraph_clear_expanded (stream->graph);
-   lwp_streamgraph_expand (stream->graph);
+   return lw_false;
 }
 
+lw_bool lw_stream_is_paused (lw_stream ctx)
+{
+   if ( (!ctx->graph) || !ctx->graph->num_full)
+      return lw_false;
+
+   return downstream_full (ctx, 0);
+}
+
+static void find_readers (lw_stream ctx, lwp_streamgraph_array * readers,
+                          int depth)
+{
+   if (depth > lwp_stream_max_graph_depth)
+      return;
+
+   for (int i = 0; i < ctx->prev_expanded.length; ++ i)
+   {
+      lw_stream prev =
+         ((lwp_streamgraph_link) ctx->prev_expanded.items [i])->from_exp;
+
+      if (!prev)
+         continue;
+
+      if (prev->def->resume_read
+            && !lwp_streamgraph_array_contains (readers, prev)
+            && lwp_streamgraph_array_push (readers, prev))
+      {
+         lwp_retain (prev, "resume_read");
+      }
+
+      find_readers (prev, readers, depth + 1);
+   }
+}
+
+/* Resumes anything that was reading into this stream, once nothing else
+ * downstream of it is still full.  Resuming may run user code and change the
+ * graph, so the streams are collected first.
+ */
+
+static void resume_readers (lw_stream ctx)
+{
+   lwp_streamgraph_array readers = {};
+
+   find_readers (ctx, &readers, 0);
+
+   for (int i = 0; i < readers.length; ++ i)
+   {
+      lw_stream reader = (lw_stream) readers.items [i];
+
+      if (! (reader->flags & lwp_stream_flag_dead)
+            && !lw_stream_is_paused (reader))
+      {
+         reader->def->resume_read (reader);
+      }
+
+      lwp_release (reader, "resume_read");
+   }
+
+   lwp_streamgraph_array_free (&readers);
+}
+
+void lwp_stream_check_watermarks (lw_stream ctx)
+{
+   if (! (ctx->flags & lwp_stream_flag_full))
+   {
+      if ( (!ctx->high_watermark) || ctx->queued_bytes <= ctx->high_watermark)
+         return;
+
+      ctx->flags |= lwp_stream_flag_full;
+      ++ ctx->graph->num_full;
+
+      if (ctx->on_queue_full)
+         ctx->on_queue_full (ctx);
+
+      return;
+   }
+
+   if (ctx->high_watermark && ctx->queued_bytes > ctx->low_watermark)
+      return;
+
+   ctx->flags &= ~ lwp_stream_flag_full;
+   -- ctx->graph->num_full;
+
+   lwp_retain (ctx, "check_watermarks");
+
+   resume_readers (ctx);
+
+   if (ctx->on_queue_drained && ! (ctx->flags & lwp_stream_flag_dead))
+      ctx->on_queue_drained (ctx);
+
+   lwp_release (ctx, "check_watermarks");
+}
 
 void lw_stream_set_tag (lw_stream ctx, void * tag)
 {
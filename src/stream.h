@@ -52,6 +52,16 @@
  */
  #define lwp_stream_flag_draining_queues 16
 
+/* More than high_watermark bytes are queued, and haven't yet dropped back to
+ * low_watermark.
+ */
+ #define lwp_stream_flag_full 32
+
+/* The implementation has accepted data it's still writing (e.g. on a worker
+ * thread), so a non-immediate close has to wait for it.
+ */
+ #define lwp_stream_flag_writing 64
+
 typedef struct _lwp_stream_data_hook
 {
    lw_stream_hook_data proc;
@@ -69,9 +79,21 @@ typedef struct _lwp_stream_close_hook
 
 } * lwp_stream_close_hook;
 
+/* Most buffers gathered into a single sink_data_vec call */
+
+#define lwp_stream_max_vec  64
+
+/* How far lw_stream_is_paused and the watermark code will follow the expanded
+ * graph.  The graph isn't guaranteed to be acyclic (a socket can be written to
+ * itself, for example).
+ */
+
+#define lwp_stream_max_graph_depth  32
+
 #define lwp_stream_queued_data           1
 #define lwp_stream_queued_stream         2
 #define lwp_stream_queued_begin_marker   3
+#define lwp_stream_queued_buffer         4
 
 typedef struct _lwp_stream_queued
 {
@@ -83,6 +105,12 @@ typedef struct _lwp_stream_queued
    size_t stream_bytes_left;
    lw_bool delete_stream;
 
+   /* For queued_buffer: the part of ref still to be written */
+
+   lwp_refbuffer ref;
+   const char * ref_data;
+   size_t ref_length;
+
 } * lwp_stream_queued;
 
 typedef struct _lwp_stream_filterspec
@@ -99,6 +127,11 @@ typedef struct _lwp_stream_filterspec
 
    struct _lwp_streamgraph_link link;
 
+   /* Where this spec is in stream's filters_upstream or filters_downstream,
+    * and in filter's filtering
+    */
+   struct _lwp_stream_filterspec ** stream_elem, ** filter_elem;
+
 } * lwp_stream_filterspec;
 
 struct _lw_stream
@@ -137,7 +170,7 @@ struct _lw_stream
 
     lw_stream head_upstream;
 
-    list (lwp_stream_data_hook, exp_data_hooks);
+    lwp_streamgraph_array exp_data_hooks;  /* of lwp_stream_data_hook */
 
 
     /* The front queue is to be written before any more data from the current
@@ -156,18 +189,72 @@ struct _lw_stream
     list (lwp_streamgraph_link, prev);
     list (lwp_streamgraph_link, next);
 
-    list (lwp_streamgraph_link, prev_expanded);
-    list (lwp_streamgraph_link, next_expanded);
+    /* of lwp_streamgraph_link */
+
+    lwp_streamgraph_array prev_expanded;
+    lwp_streamgraph_array next_expanded;
 
     int last_expand;
 
     lw_stream prev_direct;
     size_t direct_bytes_left;
+
+
+    /* Bytes of data waiting in the front and back queues (queued streams
+     * aren't counted), for the watermarks.
+     */
+
+    size_t queued_bytes;
+    size_t high_watermark, low_watermark;
+
+
+    /* For lw_stream_get_stats.  queued_since is when queued_bytes last went
+     * from 0.
+     */
+
+    lw_ui64 bytes_sent, bytes_received;
+
+    size_t max_queued_bytes;
+    lw_i64 queued_since;
+
+    lw_stream_hook_queue on_queue_full;
+    lw_stream_hook_queue on_queue_drained;
+
+
+    /* While a data hook registered on this stream is being called, the
+     * refbuffer (if any) holding the data, for lw_stream_retain_data.
+     */
+
+    lwp_refbuffer data_ref;
 };
 
 void lwp_stream_init (lw_stream, const lw_streamdef *, lw_pump);
 
 
+/* Sets or clears lwp_stream_flag_full according to queued_bytes, calling
+ * the hooks and resuming any paused readers as needed.
+ */
+
+ void lwp_stream_check_watermarks (lw_stream);
+
+
+/* Returns the stream source is currently being written directly to (see
+ * lwp_stream_write_direct), or 0 if there isn't one.
+ */
+
+ lw_stream lwp_stream_direct_target (lw_stream source);
+
+
+/* Returns true if this stream has any filters, or is a filter itself */
+
+ lw_bool lwp_stream_is_filtered (lw_stream);
+
+
+/* Returns true if another stream (such as a file) is in the back queue */
+
+ lw_bool lwp_stream_queues_stream (lw_stream);
+
+
 /* Returns true if this stream should be considered transparent, based on
  * whether the public IsTransparent returns true, no data hooks are
  * registered, and the queue is empty.
@@ -183,6 +270,18 @@ void lwp_stream_init (lw_stream, const lw_streamdef *, lw_pump);
  void lwp_stream_push (lw_stream, const char * buffer, size_t size);
 
 
+/* The _ref versions of push, write and lw_stream_data take the refbuffer (if
+ * any) that buffer belongs to.  Any of it that has to be queued is then held
+ * by reference instead of being copied.
+ */
+
+ void lwp_stream_push_ref
+   (lw_stream, lwp_refbuffer, const char * buffer, size_t size);
+
+ void lwp_stream_data_ref
+   (lw_stream, lwp_refbuffer, const char * buffer, size_t size);
+
+
 /* Extended (internal) versions of lw_stream_write* */
 
 #define lwp_stream_write_ignore_filters  1
@@ -197,6 +296,9 @@ void lwp_stream_init (lw_stream, const lw_streamdef *, lw_pump);
  size_t lwp_stream_write
    (lw_stream, const char * buffer, size_t size, int flags);
 
+ size_t lwp_stream_write_ref
+   (lw_stream, lwp_refbuffer, const char * buffer, size_t size, int flags);
+
 
 /* Attempts to write data from PrevDirect, returning false on failure. If
  * successful, DirectBytesLeft will be adjusted.
@@ -31,6 +31,59 @@
 #include "streamgraph.h"
 #include "stream.h"
 
+lw_bool lwp_streamgraph_array_push (lwp_streamgraph_array * array, void * item)
+{
+   if (array->length == array->allocated)
+   {
+      int allocated = array->allocated ? array->allocated * 2 : 4;
+
+      void ** items = (void **) realloc
+         (array->items, sizeof (void *) * allocated);
+
+      if (!items)
+         return lw_false;
+
+      array->items = items;
+      array->allocated = allocated;
+   }
+
+   array->items [array->length ++] = item;
+
+   return lw_true;
+}
+
+lw_bool lwp_streamgraph_array_contains (lwp_streamgraph_array * array,
+                                        void * item)
+{
+   for (int i = 0; i < array->length; ++ i)
+      if (array->items [i] == item)
+         return lw_true;
+
+   return lw_false;
+}
+
+void lwp_streamgraph_array_remove (lwp_streamgraph_array * array, void * item)
+{
+   for (int i = 0; i < array->length; ++ i)
+   {
+      if (array->items [i] == item)
+      {
+         memmove (array->items + i, array->items + i + 1,
+                  sizeof (void *) * (array->length - i - 1));
+
+         -- array->length;
+
+         return;
+      }
+   }
+}
+
+void lwp_streamgraph_array_free (lwp_streamgraph_array * array)
+{
+   free (array->items);
+   memset (array, 0, sizeof (*array));
+}
+
 static void graph_dealloc (lwp_streamgraph graph)
 {
    lwp_streamgraph_clear_expanded (graph);
@@ -64,6 +117,25 @@ void lwp_streamgraph_delete (lwp_streamgraph graph)
    lwp_release (graph, "streamgraph_new");
 }
 
+static void expand (lwp_streamgraph, lw_stream last,
+                    lwp_streamgraph_link last_link,
+                    lwp_streamgraph_link, lw_stream);
+
+static void prune_roots (lwp_streamgraph graph)
+{
+   list_each_elem (graph->roots_expanded, elem)
+   {
+      lw_stream stream = *elem;
+
+      /* A root only needs to remain a root if it doesn't appear
+       * elsewhere in the graph.
+       */
+
+      if (stream->prev_expanded.length > 0)
+         list_elem_remove (elem);
+   }
+}
+
 static void swallow (lwp_streamgraph graph, lw_stream stream)
 {
    assert (graph);
@@ -102,12 +174,33 @@ void lwp_streamgraph_swallow (lwp_streamgraph graph, lwp_streamgraph old_graph)
 
    lwp_streamgraph_clear_expanded (old_graph);
 
+   graph->num_full += old_graph->num_full;
+   old_graph->num_full = 0;
+
    list_each (old_graph->roots, root)
    {
       list_push (graph->roots, root);
       swallow (graph, root);
    }
 
+   /* If this graph is already expanded, just expand the new roots into it */
+
+   if (graph->expanded)
+   {
+      ++ graph->last_expand;
+
+      list_each (old_graph->roots, root)
+      {
+         if (root->last_expand == graph->last_expand
+               || list_length (root->filtering) > 0)
+            continue;
+
+         expand (graph, 0, 0, 0, root);
+      }
+
+      prune_roots (graph);
+   }
+
    lwp_streamgraph_delete (old_graph);
 }
 
@@ -135,8 +228,8 @@ static void expand_stream (lwp_streamgraph graph, lw_stream stream,
          spec->link.from_exp = *last;
          spec->link.to_exp = expanded;
 
-         list_push ((*last)->next_expanded, &spec->link);
-         list_push (expanded->prev_expanded, &spec->link);
+         lwp_streamgraph_array_push (&(*last)->next_expanded, &spec->link);
+         lwp_streamgraph_array_push (&expanded->prev_expanded, &spec->link);
       }
 
       *last = next;
@@ -158,8 +251,8 @@ static void expand_stream (lwp_streamgraph graph, lw_stream stream,
       link->to_exp = stream;
       link->bytes_left = -1;
 
-      list_push ((*last)->next_expanded, link);
-      list_push (stream->prev_expanded, link);
+      lwp_streamgraph_array_push (&(*last)->next_expanded, link);
+      lwp_streamgraph_array_push (&stream->prev_expanded, link);
 
       *last = stream;
    }
@@ -184,8 +277,8 @@ static void expand_stream (lwp_streamgraph graph, lw_stream stream,
          spec->link.from_exp = *last;
          spec->link.to_exp = expanded;
 
-         list_push ((*last)->next_expanded, &spec->link);
-         list_push (expanded->prev_expanded, &spec->link);
+         lwp_streamgraph_array_push (&(*last)->next_expanded, &spec->link);
+         lwp_streamgraph_array_push (&expanded->prev_expanded, &spec->link);
       }
 
       *last = next;
@@ -196,7 +289,7 @@ static void expand_stream (lwp_streamgraph graph, lw_stream stream,
 
    list_each (stream->data_hooks, hook)
    {
-      list_push ((*last)->exp_data_hooks, hook);
+      lwp_streamgraph_array_push (&(*last)->exp_data_hooks, hook);
    }
 }
 
@@ -212,13 +305,13 @@ static void expand (lwp_streamgraph graph, lw_stream last,
    {
       link->to_exp = expanded_first;
 
-      list_push (expanded_first->prev_expanded, link);
+      lwp_streamgraph_array_push (&expanded_first->prev_expanded, link);
 
       link->from_exp = last;
 
-      assert (!list_find (last->next_expanded, link));
+      assert (!lwp_streamgraph_array_contains (&last->next_expanded, link));
 
-      list_push (last->next_expanded, link);
+      lwp_streamgraph_array_push (&last->next_expanded, link);
    }
    else
    {
@@ -240,34 +333,140 @@ void lwp_streamgraph_expand (lwp_streamgraph graph)
 
    list_each (graph->roots, stream)
    {
-      if (stream->last_expand == graph->last_expand)
+      /* A filter left as a root is expanded along with the stream it's
+       * filtering, which may come later in the list.
+       */
+      if (stream->last_expand == graph->last_expand
+            || list_length (stream->filtering) > 0)
          continue;
 
       expand (graph, 0, 0, 0, stream);
    }
 
-   list_each_elem (graph->roots_expanded, elem)
-   {
-      lw_stream stream = *elem;
+   prune_roots (graph);
 
-      /* A root only needs to remain a root if it doesn't appear
-       * elsewhere in the graph.
-       */
-
-      if (list_length (stream->prev_expanded) > 0)
-         list_elem_remove (elem);
-   }
+   graph->expanded = lw_true;
 
    #ifdef _lacewing_debug
       lwp_streamgraph_print (graph);
    #endif
 }
 
+/* The first and last streams a public stream expands to, including its
+ * filters.
+ */
+
+static lw_stream expanded_first (lw_stream stream)
+{
+   return stream->head_upstream ? stream->head_upstream : stream;
+}
+
+static lw_stream expanded_last (lw_stream stream)
+{
+   if (list_length (stream->filters_downstream) > 0)
+      return expanded_last (list_back (stream->filters_downstream)->filter);
+
+   return stream;
+}
+
+/* A filter (or a stream being filtered) at either end changes which streams
+ * the link joins in the expanded graph, so those links are always expanded in
+ * full.
+ */
+
+static lw_bool link_is_filtered (lwp_streamgraph_link link)
+{
+   return lwp_stream_is_filtered (link->from)
+       || lwp_stream_is_filtered (link->to);
+}
+
+void lwp_streamgraph_insert_link (lwp_streamgraph graph,
+                                  lwp_streamgraph_link link)
+{
+   if ((!graph->expanded) || link_is_filtered (link))
+   {
+      lwp_streamgraph_expand (graph);
+      return;
+   }
+
+   ++ graph->last_expand;
+
+   link->from_exp = expanded_last (link->from);
+   link->to_exp = expanded_first (link->to);
+
+   /* Whatever the link points to is already expanded, but may have been a
+    * root until now.
+    */
+
+   if (link->to_exp->prev_expanded.length == 0)
+      list_remove (graph->roots_expanded, link->to_exp);
+
+   lwp_streamgraph_array_push (&link->from_exp->next_expanded, link);
+   lwp_streamgraph_array_push (&link->to_exp->prev_expanded, link);
+}
+
+void lwp_streamgraph_remove_link (lwp_streamgraph graph,
+                                  lwp_streamgraph_link link)
+{
+   if ((!graph->expanded) || link_is_filtered (link))
+   {
+      lwp_streamgraph_expand (graph);
+      return;
+   }
+
+   ++ graph->last_expand;
+
+   if (!link->to_exp)
+      return;
+
+   lwp_streamgraph_array_remove (&link->from_exp->next_expanded, link);
+   lwp_streamgraph_array_remove (&link->to_exp->prev_expanded, link);
+
+   if (link->to_exp->prev_direct == link->from_exp)
+      link->to_exp->prev_direct = 0;
+
+   if (link->to_exp->prev_expanded.length == 0)
+      list_push (graph->roots_expanded, link->to_exp);
+
+   link->to_exp = link->from_exp = 0;
+}
+
+void lwp_streamgraph_insert_hook (lwp_streamgraph graph, lw_stream stream,
+                                  void * hook)
+{
+   if ((!graph->expanded) || lwp_stream_is_filtered (stream))
+   {
+      lwp_streamgraph_expand (graph);
+      return;
+   }
+
+   ++ graph->last_expand;
+
+   lwp_streamgraph_array_push (&expanded_last (stream)->exp_data_hooks, hook);
+}
+
+void lwp_streamgraph_remove_hook (lwp_streamgraph graph, lw_stream stream,
+                                  void * hook)
+{
+   if ((!graph->expanded) || lwp_stream_is_filtered (stream))
+   {
+      lwp_streamgraph_expand (graph);
+      return;
+   }
+
+   ++ graph->last_expand;
+
+   lwp_streamgraph_array_remove (&expanded_last (stream)->exp_data_hooks, hook);
+}
+
 static lw_bool find_next_direct (lw_stream stream, lw_stream * next_direct,
                                  size_t * bytes)
 {
-   list_each (stream->next_expanded, link)
+   for (int i = 0; i < stream->next_expanded.length; ++ i)
    {
+      lwp_streamgraph_link link =
+         (lwp_streamgraph_link) stream->next_expanded.items [i];
+
       if (link->bytes_left != -1 && link->bytes_left < *bytes)
          *bytes = link->bytes_left;
 
@@ -296,7 +495,7 @@ static void graph_read (lwp_streamgraph graph, int this_expand,
 {
    /* TODO : Currently, the presence of a filter forces a read */
 
-   if (!list_length (stream->next_expanded))
+   if (!stream->next_expanded.length)
       return;
 
    if (bytes == -1)
@@ -322,7 +521,7 @@ static void graph_read (lwp_streamgraph graph, int this_expand,
 
    do
    {
-      if (list_length (stream->exp_data_hooks) > 0)
+      if (stream->exp_data_hooks.length > 0)
          break;
 
       lw_stream next = 0;
@@ -338,9 +537,21 @@ static void graph_read (lwp_streamgraph graph, int this_expand,
 
       lwp_trace ("Next direct from %p -> %p", stream, next);
 
-      if ( (!next) || next->prev_direct)
+      if (!next)
          break;
 
+      if (next->prev_direct)
+      {
+         /* Already being written direct from this stream - reading as well
+          * would let the two race each other.
+          */
+
+         if (next->prev_direct == stream)
+            wrote_direct = lw_true;
+
+         break;
+      }
+
       /* Only one non-transparent stream follows.  It may be possible to
        * shift the data directly (without having to read it first).
        *
@@ -385,8 +596,11 @@ static void graph_read (lwp_streamgraph graph, int this_expand,
       return;
    }
 
-   list_each (stream->next_expanded, link)
+   for (int i = 0; i < stream->next_expanded.length; ++ i)
    {
+      lwp_streamgraph_link link =
+         (lwp_streamgraph_link) stream->next_expanded.items [i];
+
       graph_read (graph, this_expand, link->to_exp, link->bytes_left);
 
       if (this_expand != graph->last_expand || graph->dead)
@@ -418,8 +632,11 @@ void lwp_streamgraph_read (lwp_streamgraph graph)
 
 static void clear_expanded (lw_stream stream)
 {
-   list_each (stream->next_expanded, link)
+   for (int i = 0; i < stream->next_expanded.length; ++ i)
    {
+      lwp_streamgraph_link link =
+         (lwp_streamgraph_link) stream->next_expanded.items [i];
+
       assert (link->from_exp == stream);
 
       if (link->to_exp)
@@ -428,18 +645,20 @@ static void clear_expanded (lw_stream stream)
       link->to_exp = link->from_exp = 0;
    }
 
-   list_clear (stream->prev_expanded);
-   list_clear (stream->next_expanded);
+   stream->prev_expanded.length = 0;
+   stream->next_expanded.length = 0;
 
    stream->prev_direct = 0;
 
-   list_clear (stream->exp_data_hooks);
+   stream->exp_data_hooks.length = 0;
 }
 
 void lwp_streamgraph_clear_expanded (lwp_streamgraph graph)
 {
    ++ graph->last_expand;
 
+   graph->expanded = lw_false;
+
    list_each (graph->roots_expanded, root)
    {
       clear_expanded (root);
@@ -480,10 +699,13 @@ static void print_expanded (lwp_streamgraph graph, lw_stream stream, int depth)
 
    fprintf (stderr, "stream @ %p (" lwp_fmt_size " bytes, %d hooks)\n",
          stream, lw_stream_bytes_left (stream),
-         (int) list_length (stream->exp_data_hooks));
+         (int) stream->exp_data_hooks.length);
 
-   list_each (stream->next_expanded, link)
+   for (int i = 0; i < stream->next_expanded.length; ++ i)
    {
+      lwp_streamgraph_link link =
+         (lwp_streamgraph_link) stream->next_expanded.items [i];
+
       for (int i = 0; i < depth; ++ i)
          fprintf (stderr, "  ");
 
@@ -39,8 +39,30 @@ typedef struct _lwp_streamgraph_link
 
    lw_bool delete_stream;
 
+   /* Where this link is in from->next and to->prev, so that it can be taken
+    * out of both without searching them
+    */
+   struct _lwp_streamgraph_link ** from_elem, ** to_elem;
+
 } * lwp_streamgraph_link;
 
+/* The expanded graph is stored in plain arrays rather than lists, so that
+ * lw_stream_data and lwp_stream_push can walk (and copy) it cheaply.  The
+ * memory is kept when the graph is cleared, so re-expanding doesn't allocate.
+ */
+
+typedef struct _lwp_streamgraph_array
+{
+   void ** items;
+   int length, allocated;
+
+} lwp_streamgraph_array;
+
+lw_bool lwp_streamgraph_array_push (lwp_streamgraph_array *, void * item);
+lw_bool lwp_streamgraph_array_contains (lwp_streamgraph_array *, void * item);
+void lwp_streamgraph_array_remove (lwp_streamgraph_array *, void * item);
+void lwp_streamgraph_array_free (lwp_streamgraph_array *);
+
 typedef struct _lwp_streamgraph
 {
    lwp_refcounted;
@@ -53,6 +75,16 @@ typedef struct _lwp_streamgraph
    list (lw_stream, roots);
    list (lw_stream, roots_expanded);
 
+   /* Set between expand and clear_expanded.  While the graph is expanded,
+    * single links and hooks can be added and removed incrementally.
+    */
+   lw_bool expanded;
+
+   /* Number of streams in the graph with lwp_stream_flag_full set, so that
+    * lw_stream_is_paused can usually return without walking the graph.
+    */
+   int num_full;
+
    int last_expand;
 
 } * lwp_streamgraph;
@@ -79,6 +111,19 @@ void lwp_streamgraph_delete (lwp_streamgraph);
  void lwp_streamgraph_expand (lwp_streamgraph);
 
 
+/* Incremental versions of expand, for when a single link or data hook has
+ * just been added to or removed from the non-expanded graph.  Only the
+ * streams either side of the change are touched, but last_expand is still
+ * incremented.  If the graph isn't currently expanded, or a filtered stream
+ * (or filter) is involved, these expand it in full instead.
+ */
+ void lwp_streamgraph_insert_link (lwp_streamgraph, lwp_streamgraph_link);
+ void lwp_streamgraph_remove_link (lwp_streamgraph, lwp_streamgraph_link);
+
+ void lwp_streamgraph_insert_hook (lwp_streamgraph, lw_stream, void * hook);
+ void lwp_streamgraph_remove_hook (lwp_streamgraph, lw_stream, void * hook);
+
+
 /* Scan through the graph and issue a read wherever a link needs one.
  * Depending on how the graph was modified, this may or may not be necessary
  * after expansion.
@@ -0,0 +1,322 @@
+
+/* vim: set et ts=3 sw=3 ft=c:
+ *
+ * Copyright (C) 2013 James McLaughlin et al.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+#include "timerwheel.h"
+
+#define slot_mask  (lwp_timerwheel_slots - 1)
+
+static void list_init (lwp_timerwheel_entry head)
+{
+   head->next = head->prev = head;
+}
+
+static lw_bool list_empty (lwp_timerwheel_entry head)
+{
+   return head->next == head;
+}
+
+static void link_entry (lwp_timerwheel_entry head, lwp_timerwheel_entry entry)
+{
+   entry->prev = head->prev;
+   entry->next = head;
+
+   head->prev->next = entry;
+   head->prev = entry;
+}
+
+static void unlink_entry (lwp_timerwheel_entry entry)
+{
+   entry->prev->next = entry->next;
+   entry->next->prev = entry->prev;
+
+   entry->next = entry->prev = 0;
+}
+
+static lw_ui64 rotate (lw_ui64 bits, int by)
+{
+   return by ? (bits >> by) | (bits << (64 - by)) : bits;
+}
+
+void lwp_timerwheel_init (lwp_timerwheel ctx, lw_i64 now)
+{
+   memset (ctx, 0, sizeof (*ctx));
+
+   ctx->now = now;
+
+   for (int level = 0; level < lwp_timerwheel_levels; ++ level)
+      for (int slot = 0; slot < lwp_timerwheel_slots; ++ slot)
+         list_init (&ctx->slots [level][slot]);
+
+   list_init (&ctx->overflow);
+   list_init (&ctx->expired);
+   list_init (&ctx->late);
+}
+
+static void place (lwp_timerwheel ctx, lwp_timerwheel_entry entry)
+{
+   lw_i64 expires = entry->expires;
+
+   /* Already due (a delay of 0, say), but the tick it was due on has been
+    * processed.  Rather than wait for the next tick, it goes out with the
+    * next advance.
+    */
+   if (expires < ctx->now)
+   {
+      link_entry (&ctx->late, entry);
+      entry->slot = -1;
+
+      return;
+   }
+
+   lw_i64 delta = expires - ctx->now;
+
+   for (int level = 0; level < lwp_timerwheel_levels; ++ level)
+   {
+      int shift = lwp_timerwheel_bits * level;
+
+      if (delta >= ((lw_i64) lwp_timerwheel_slots << shift))
+         continue;
+
+      int slot = (expires >> shift) & slot_mask;
+
+      link_entry (&ctx->slots [level][slot], entry);
+
+      entry->slot = level * lwp_timerwheel_slots + slot;
+      ctx->occupied [level] |= ((lw_ui64) 1) << slot;
+
+      return;
+   }
+
+   link_entry (&ctx->overflow, entry);
+   entry->slot = -1;
+}
+
+void lwp_timerwheel_add (lwp_timerwheel ctx, lwp_timerwheel_entry entry,
+                         lw_i64 expires)
+{
+   if (entry->next)
+      lwp_timerwheel_remove (ctx, entry);
+
+   entry->expires = expires;
+
+   place (ctx, entry);
+}
+
+void lwp_timerwheel_remove (lwp_timerwheel ctx, lwp_timerwheel_entry entry)
+{
+   if (!entry->next)
+      return;
+
+   unlink_entry (entry);
+
+   if (entry->slot != -1)
+   {
+      int level = entry->slot / lwp_timerwheel_slots,
+          slot = entry->slot % lwp_timerwheel_slots;
+
+      if (list_empty (&ctx->slots [level][slot]))
+         ctx->occupied [level] &= ~ (((lw_ui64) 1) << slot);
+   }
+}
+
+lw_bool lwp_timerwheel_scheduled (lwp_timerwheel_entry entry)
+{
+   return entry->next != 0;
+}
+
+/* Re-places everything in a list relative to the current time.  The list is
+ * detached first, as anything still far enough away goes straight back onto
+ * the overflow list.
+ */
+static void redistribute (lwp_timerwheel ctx, lwp_timerwheel_entry head)
+{
+   if (list_empty (head))
+      return;
+
+   struct _lwp_timerwheel_entry pending;
+
+   pending.next = head->next;
+   pending.prev = head->prev;
+
+   pending.next->prev = pending.prev->next = &pending;
+
+   list_init (head);
+
+   while (!list_empty (&pending))
+   {
+      lwp_timerwheel_entry entry = pending.next;
+
+      unlink_entry (entry);
+      place (ctx, entry);
+   }
+}
+
+static void cascade (lwp_timerwheel ctx)
+{
+   for (int level = 1; level < lwp_timerwheel_levels; ++ level)
+   {
+      int slot = (ctx->now >> (lwp_timerwheel_bits * level)) & slot_mask;
+
+      ctx->occupied [level] &= ~ (((lw_ui64) 1) << slot);
+      redistribute (ctx, &ctx->slots [level][slot]);
+
+      if (slot != 0)
+         return;
+   }
+
+   redistribute (ctx, &ctx->overflow);
+}
+
+void lwp_timerwheel_advance (lwp_timerwheel ctx, lw_i64 now)
+{
+   while (!list_empty (&ctx->late))
+   {
+      lwp_timerwheel_entry entry = ctx->late.next;
+
+      unlink_entry (entry);
+      link_entry (&ctx->expired, entry);
+   }
+
+   while (ctx->now <= now)
+   {
+      int slot = ctx->now & slot_mask;
+
+      if (slot == 0)
+         cascade (ctx);
+
+      lwp_timerwheel_entry head = &ctx->slots [0][slot];
+
+      while (!list_empty (head))
+      {
+         lwp_timerwheel_entry entry = head->next;
+
+         unlink_entry (entry);
+         link_entry (&ctx->expired, entry);
+
+         entry->slot = -1;
+      }
+
+      ctx->occupied [0] &= ~ (((lw_ui64) 1) << slot);
+
+      ++ ctx->now;
+
+      /* Nothing can be added to the first level until the next cascade, so
+       * if it's empty, skip straight there.
+       */
+      if ((!ctx->occupied [0]) && (ctx->now & slot_mask))
+      {
+         lw_i64 next_cascade = (ctx->now | slot_mask) + 1;
+
+         ctx->now = next_cascade <= now ? next_cascade : now + 1;
+      }
+   }
+}
+
+lwp_timerwheel_entry lwp_timerwheel_pop_expired (lwp_timerwheel ctx)
+{
+   if (list_empty (&ctx->expired))
+      return 0;
+
+   lwp_timerwheel_entry entry = ctx->expired.next;
+
+   unlink_entry (entry);
+
+   entry->due = entry->expires;
+
+   if (entry->interval > 0)
+   {
+      lw_i64 expires = entry->expires + entry->interval;
+
+      /* If we've fallen more than an interval behind, skip the ticks that
+       * were missed rather than firing them all at once.
+       */
+      if (expires < ctx->now)
+      {
+         expires += ((ctx->now - expires + entry->interval - 1)
+                        / entry->interval) * entry->interval;
+      }
+
+      lwp_timerwheel_add (ctx, entry, expires);
+   }
+
+   return entry;
+}
+
+long lwp_timerwheel_timeout (lwp_timerwheel ctx, lw_i64 now)
+{
+   if ((!list_empty (&ctx->expired)) || !list_empty (&ctx->late))
+      return 0;
+
+   lw_i64 next = -1;
+
+   if (ctx->occupied [0])
+   {
+      int current = ctx->now & slot_mask;
+
+      next = ctx->now + __builtin_ctzll (rotate (ctx->occupied [0], current));
+   }
+
+   for (int level = 1; level < lwp_timerwheel_levels; ++ level)
+   {
+      lw_ui64 occupied = ctx->occupied [level];
+
+      /* The overflow list is looked at when the last level's first slot is
+       */
+      if (level == lwp_timerwheel_levels - 1 && !list_empty (&ctx->overflow))
+         occupied |= 1;
+
+      if (!occupied)
+         continue;
+
+      int shift = lwp_timerwheel_bits * level;
+      int current = (ctx->now >> shift) & slot_mask;
+
+      /* Unless we're sitting right on its boundary, the current slot has
+       * already been cascaded, so it won't come round for another full turn.
+       */
+      lw_bool pending = (ctx->now & ((((lw_i64) 1) << shift) - 1)) == 0;
+
+      int from = pending ? current : ((current + 1) & slot_mask);
+
+      int blocks = (pending ? 0 : 1)
+                     + __builtin_ctzll (rotate (occupied, from));
+
+      lw_i64 cascade_at = ((ctx->now >> shift) + blocks) << shift;
+
+      if (next == -1 || cascade_at < next)
+         next = cascade_at;
+   }
+
+   if (next == -1)
+      return -1;
+
+   return next > now ? (long) (next - now) : 0;
+}
+
@@ -0,0 +1,109 @@
+
+/* vim: set et ts=3 sw=3 ft=c:
+ *
+ * Copyright (C) 2013 James McLaughlin et al.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _lw_timerwheel_h
+#define _lw_timerwheel_h
+
+/* A hierarchical timing wheel with a resolution of one millisecond: four
+ * levels of 64 slots, plus an overflow list for anything more than 2^24 ms
+ * (about 4.6 hours) away.  Starting and stopping a timer is O(1).
+ */
+
+#define lwp_timerwheel_levels  4
+#define lwp_timerwheel_bits    6
+#define lwp_timerwheel_slots   (1 << lwp_timerwheel_bits)
+
+typedef struct _lwp_timerwheel_entry * lwp_timerwheel_entry;
+
+struct _lwp_timerwheel_entry
+{
+   lwp_timerwheel_entry next, prev;
+
+   lw_i64 expires;
+
+   /* The deadline this entry last expired for, set by pop_expired
+    */
+   lw_i64 due;
+
+   /* If non-zero, the entry is added again this many ms after it expires
+    */
+   long interval;
+
+   void (* on_expire) (void * tag);
+   void * tag;
+
+   /* level * lwp_timerwheel_slots + slot, or -1 if on the overflow, late
+    * or expired list
+    */
+   int slot;
+};
+
+typedef struct _lwp_timerwheel
+{
+   /* The next tick to be processed.  Everything before it has expired.
+    */
+   lw_i64 now;
+
+   lw_ui64 occupied [lwp_timerwheel_levels];
+
+   struct _lwp_timerwheel_entry
+      slots [lwp_timerwheel_levels] [lwp_timerwheel_slots];
+
+   struct _lwp_timerwheel_entry overflow, expired;
+
+   /* Entries added after the tick they were due on, which the next advance
+    * moves straight to the expired list
+    */
+   struct _lwp_timerwheel_entry late;
+
+} * lwp_timerwheel;
+
+void lwp_timerwheel_init (lwp_timerwheel, lw_i64 now);
+
+void lwp_timerwheel_add (lwp_timerwheel, lwp_timerwheel_entry, lw_i64 expires);
+void lwp_timerwheel_remove (lwp_timerwheel, lwp_timerwheel_entry);
+
+lw_bool lwp_timerwheel_scheduled (lwp_timerwheel_entry);
+
+/* Moves everything due by now to the expired list
+ */
+void lwp_timerwheel_advance (lwp_timerwheel, lw_i64 now);
+
+/* Removes the next expired entry (re-adding it if it has an interval), or
+ * returns 0 if there are none.  Call on_expire for it afterwards.
+ */
+lwp_timerwheel_entry lwp_timerwheel_pop_expired (lwp_timerwheel);
+
+/* Milliseconds until lwp_timerwheel_advance next has work to do, or -1 if
+ * the wheel is empty.
+ */
+long lwp_timerwheel_timeout (lwp_timerwheel, lw_i64 now);
+
+#endif
+
@@ -30,11 +30,14 @@
 #include <sys/types.h> 
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 #include <sys/poll.h>
 #include <sys/utsname.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <pthread.h>
+#include <signal.h>
 #include <errno.h>
 #include <unistd.h>
 #include <arpa/inet.h>
@@ -54,6 +57,10 @@
    #endif
 #endif
 
+#ifdef HAVE_SYS_EVENTFD_H
+   #include <sys/eventfd.h>
+#endif
+
 #ifdef HAVE_SYS_SENDFILE_H
    #include <sys/sendfile.h>
 #endif
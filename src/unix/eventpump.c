@@ -32,198 +32,1101 @@
 
 enum
 {
-   sig_exit_eventloop,
-   sig_remove,
-   sig_post
+   post_func,
+   post_remove
 };
 
+/* The pump whose events are being processed by this thread, if any.  Posts
+ * made from inside the pump's own callbacks don't need a wakeup, because the
+ * pump drains the post queue at the end of every batch of events anyway.
+ */
+static __thread lw_eventpump current_pump;
+
 #ifdef ENABLE_THREADS
    static void watcher (lw_eventpump ctx);
+   static void loop_thread (lw_eventpump ctx);
 #endif
 
-lw_eventpump lw_eventpump_new ()
+static void wakeup (lw_eventpump ctx);
+
+static lw_i64 time_now ()
+{
+   struct timespec now;
+   clock_gettime (CLOCK_MONOTONIC, &now);
+
+   return ((lw_i64) now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+static lw_i64 time_now_us ()
+{
+   struct timespec now;
+   clock_gettime (CLOCK_MONOTONIC, &now);
+
+   return ((lw_i64) now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+static lw_pump_watch watch_alloc (lw_eventpump ctx)
+{
+   while (__sync_lock_test_and_set (&ctx->slab_lock, 1))
+      sched_yield ();
+
+   if (!ctx->free_watches)
+   {
+      struct _lwp_eventpump_slab * slab = calloc (sizeof (*slab), 1);
+
+      if (!slab)
+      {
+         __sync_lock_release (&ctx->slab_lock);
+         return NULL;
+      }
+
+      slab->next = ctx->slabs;
+      ctx->slabs = slab;
+
+      for (int i = lwp_eventpump_slab_size - 1; i >= 0; -- i)
+      {
+         slab->watches [i].next_free = ctx->free_watches;
+         ctx->free_watches = &slab->watches [i];
+      }
+   }
+
+   lw_pump_watch watch = ctx->free_watches;
+   ctx->free_watches = watch->next_free;
+
+   __sync_lock_release (&ctx->slab_lock);
+
+   unsigned long gen = watch->gen;
+
+   memset (watch, 0, sizeof (*watch));
+   watch->gen = gen;
+
+   return watch;
+}
+
+static void watch_free (lw_eventpump ctx, lw_pump_watch watch)
+{
+   while (__sync_lock_test_and_set (&ctx->slab_lock, 1))
+      sched_yield ();
+
+   ++ watch->gen;
+
+   watch->next_free = ctx->free_watches;
+   ctx->free_watches = watch;
+
+   __sync_lock_release (&ctx->slab_lock);
+}
+
+#ifdef ENABLE_THREADS
+
+static void watch_retire (lw_eventpump ctx, lw_pump_watch watch)
+{
+   while (__sync_lock_test_and_set (&ctx->slab_lock, 1))
+      sched_yield ();
+
+   watch->next_free = ctx->watcher.retired;
+   ctx->watcher.retired = watch;
+
+   __sync_lock_release (&ctx->slab_lock);
+}
+
+/* Only called while the watcher thread is waiting to be resumed
+ */
+static void free_retired (lw_eventpump ctx)
+{
+   while (__sync_lock_test_and_set (&ctx->slab_lock, 1))
+      sched_yield ();
+
+   lw_pump_watch watch = ctx->watcher.retired;
+   ctx->watcher.retired = NULL;
+
+   __sync_lock_release (&ctx->slab_lock);
+
+   while (watch)
+   {
+      lw_pump_watch next = watch->next_free;
+
+      watch_free (ctx, watch);
+      lw_pump_remove_user ((lw_pump) ctx);
+
+      watch = next;
+   }
+}
+
+#endif
+
+static unsigned long event_gen (lwp_eventqueue_event event)
+{
+   lw_pump_watch watch = lwp_eventqueue_event_tag (event);
+
+   return watch ? watch->gen : 0;
+}
+
+static lw_eventpump eventpump_new (int num_threads, lw_bool use_uring)
+{
+   lw_eventpump ctx = calloc (sizeof (*ctx), 1);
+
+   if (!ctx)
+      return NULL;
+
+   #ifdef ENABLE_THREADS
+      ctx->watcher.thread = lw_thread_new ("watcher", (void *) watcher);
+      ctx->watcher.resume_event = lw_event_new ();
+
+      /* The calling thread runs this pump, and each of the others runs a
+       * pump of its own.
+       */
+      if (num_threads > 1
+            && (ctx->loops = calloc (sizeof (*ctx->loops), num_threads - 1)))
+      {
+         for (int i = 0; i < num_threads - 1; ++ i)
+         {
+            if (! (ctx->loops [i].pump = eventpump_new (1, use_uring)))
+               break;
+
+            ctx->loops [i].pump->pump.parent = (lw_pump) ctx;
+
+            ctx->loops [i].thread = lw_thread_new
+               ("eventloop", (void *) loop_thread);
+
+            ++ ctx->num_loops;
+         }
+      }
+   #endif
+
+   lwp_pump_init (&ctx->pump, &def_eventpump);
+
+   ctx->sync_signals = lw_sync_new ();
+   ctx->sync_timers = lw_sync_new ();
+   ctx->sync_stats = lw_sync_new ();
+
+   lwp_timerwheel_init (&ctx->timers, time_now ());
+
+   for (int i = 0; i < lwp_eventpump_post_ring_size; ++ i)
+      ctx->post_ring [i].seq = i;
+
+   #ifdef HAVE_SYS_EVENTFD_H
+
+      ctx->wakeup_read = ctx->wakeup_write =
+         eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+   #else
+
+      int wakeup_pipe [2];
+      pipe (wakeup_pipe);
+
+      ctx->wakeup_read   = wakeup_pipe [0];
+      ctx->wakeup_write  = wakeup_pipe [1];
+
+      fcntl (ctx->wakeup_read, F_SETFL,
+            fcntl (ctx->wakeup_read, F_GETFL, 0) | O_NONBLOCK);
+
+      fcntl (ctx->wakeup_write, F_SETFL,
+            fcntl (ctx->wakeup_write, F_GETFL, 0) | O_NONBLOCK);
+
+   #endif
+
+   #ifdef lwp_eventqueue_has_uring
+      if (use_uring)
+         ctx->queue = lwp_eventqueue_new_uring ();
+   #endif
+
+   if (!ctx->queue)
+      ctx->queue = lwp_eventqueue_new ();
+
+   lwp_eventqueue_add (ctx->queue, ctx->wakeup_read,
+                       lw_true, lw_false, lw_true,
+                       NULL);
+
+   return ctx;
+}
+
+lw_eventpump lw_eventpump_new ()
+{
+   return eventpump_new (1, lw_false);
+}
+
+/* Each of the num_threads threads runs a pump (and eventqueue) of its own,
+ * and servers spread their clients over them.  Anything to do with one
+ * client - its hooks, timers and posts - stays on that client's thread, but
+ * hooks for different clients may run at the same time.
+ *
+ * Only lw_eventpump_start_eventloop runs the other threads.
+ */
+lw_eventpump lw_eventpump_new_threaded (int num_threads)
+{
+   return eventpump_new (num_threads, lw_false);
+}
+
+lw_eventpump lw_eventpump_new_uring ()
+{
+   return eventpump_new (1, lw_true);
+}
+
+static void def_cleanup (lw_pump pump)
+{
+   lw_eventpump ctx = (lw_eventpump) pump;
+
+   #ifdef ENABLE_THREADS
+
+      /* The watcher may be waiting on the eventqueue rather than for a tick,
+       * so it has to be woken up both ways.
+       */
+      if (lw_thread_started (ctx->watcher.thread))
+      {
+         __atomic_store_n (&ctx->watcher.exiting, lw_true, __ATOMIC_RELAXED);
+
+         wakeup (ctx);
+         lw_event_signal (ctx->watcher.resume_event);
+
+         lw_thread_join (ctx->watcher.thread);
+      }
+
+   #endif
+
+   lwp_eventqueue_delete (ctx->queue);
+
+   close (ctx->wakeup_read);
+
+   if (ctx->wakeup_write != ctx->wakeup_read)
+      close (ctx->wakeup_write);
+
+   list_each (ctx->overflow, post)
+      free (post);
+
+   list_clear (ctx->overflow);
+
+   lw_sync_delete (ctx->sync_signals);
+   lw_sync_delete (ctx->sync_timers);
+   lw_sync_delete (ctx->sync_stats);
+
+   while (ctx->slabs)
+   {
+      struct _lwp_eventpump_slab * next = ctx->slabs->next;
+
+      free (ctx->slabs);
+      ctx->slabs = next;
+   }
+   
+   #ifdef ENABLE_THREADS
+
+      lw_event_delete (ctx->watcher.resume_event);
+
+      for (int i = 0; i < ctx->num_loops; ++ i)
+      {
+         lw_thread_delete (ctx->loops [i].thread);
+         lw_pump_delete ((lw_pump) ctx->loops [i].pump);
+      }
+
+      free (ctx->loops);
+
+   #endif
+
+   /* TODO */
+}
+
+static void histogram_add (lw_pump_histogram * histogram, lw_ui64 value)
+{
+   int bucket = value ? 64 - __builtin_clzll (value) : 0;
+
+   if (bucket >= lw_pump_histogram_buckets)
+      bucket = lw_pump_histogram_buckets - 1;
+
+   ++ histogram->buckets [bucket];
+   ++ histogram->count;
+
+   histogram->total += value;
+
+   if (value > histogram->max)
+      histogram->max = value;
+}
+
+static void histogram_merge (lw_pump_histogram * histogram,
+                             lw_pump_histogram * from)
+{
+   for (int i = 0; i < lw_pump_histogram_buckets; ++ i)
+      histogram->buckets [i] += from->buckets [i];
+
+   histogram->count += from->count;
+   histogram->total += from->total;
+
+   if (from->max > histogram->max)
+      histogram->max = from->max;
+}
+
+lw_bool lw_eventpump_enable_stats (lw_eventpump ctx, lw_bool enabled)
+{
+   ctx->stats_enabled = enabled;
+
+   #ifdef ENABLE_THREADS
+      for (int i = 0; i < ctx->num_loops; ++ i)
+         lw_eventpump_enable_stats (ctx->loops [i].pump, enabled);
+   #endif
+
+   return lw_true;
+}
+
+lw_bool lw_eventpump_get_stats (lw_eventpump ctx, lw_pump_stats * stats)
+{
+   lw_sync_lock (ctx->sync_stats);
+   *stats = ctx->stats;
+   lw_sync_release (ctx->sync_stats);
+
+   #ifdef ENABLE_THREADS
+
+      /* A threaded pump's stats cover all of its loop threads
+       */
+      for (int i = 0; i < ctx->num_loops; ++ i)
+      {
+         lw_pump_stats loop;
+         lw_eventpump_get_stats (ctx->loops [i].pump, &loop);
+
+         histogram_merge (&stats->tick_us, &loop.tick_us);
+         histogram_merge (&stats->callback_us, &loop.callback_us);
+         histogram_merge (&stats->batch_size, &loop.batch_size);
+         histogram_merge (&stats->post_depth, &loop.post_depth);
+         histogram_merge (&stats->timer_lag_us, &loop.timer_lag_us);
+
+         stats->wakeups += loop.wakeups;
+         stats->events += loop.events;
+         stats->posts += loop.posts;
+         stats->timers += loop.timers;
+
+         if (loop.slowest_us > stats->slowest_us)
+         {
+            stats->slowest_us = loop.slowest_us;
+            stats->slowest_tag = loop.slowest_tag;
+         }
+      }
+
+   #endif
+
+   return ctx->stats_enabled;
+}
+
+void lw_eventpump_reset_stats (lw_eventpump ctx)
+{
+   lw_sync_lock (ctx->sync_stats);
+   memset (&ctx->stats, 0, sizeof (ctx->stats));
+   lw_sync_release (ctx->sync_stats);
+
+   #ifdef ENABLE_THREADS
+      for (int i = 0; i < ctx->num_loops; ++ i)
+         lw_eventpump_reset_stats (ctx->loops [i].pump);
+   #endif
+}
+
+static void stats_wakeup (lw_eventpump ctx, int count)
+{
+   lw_sync_lock (ctx->sync_stats);
+
+   ++ ctx->stats.wakeups;
+   ctx->stats.events += count;
+
+   histogram_add (&ctx->stats.batch_size, count);
+
+   lw_sync_release (ctx->sync_stats);
+}
+
+static void stats_tick (lw_eventpump ctx, lw_i64 started)
+{
+   lw_sync_lock (ctx->sync_stats);
+   histogram_add (&ctx->stats.tick_us, time_now_us () - started);
+   lw_sync_release (ctx->sync_stats);
+}
+
+lw_pump lwp_eventpump_next (lw_pump pump)
+{
+   if (pump->def != &def_eventpump)
+      return pump;
+
+   #ifdef ENABLE_THREADS
+
+      lw_eventpump ctx = (lw_eventpump) pump;
+
+      if (ctx->num_loops > 0)
+      {
+         long index = __sync_fetch_and_add (&ctx->next_loop, 1)
+                           % (ctx->num_loops + 1);
+
+         if (index > 0)
+            return (lw_pump) ctx->loops [index - 1].pump;
+      }
+
+   #endif
+
+   return pump;
+}
+
+static void wakeup (lw_eventpump ctx)
+{
+   if (__sync_val_compare_and_swap (&ctx->wakeup_pending, 0, 1) != 0)
+      return;  /* already pending - whoever clears it will drain our post */
+
+   #ifdef HAVE_SYS_EVENTFD_H
+      eventfd_write (ctx->wakeup_write, 1);
+   #else
+      char b = 0;
+      write (ctx->wakeup_write, &b, sizeof (b));
+   #endif
+}
+
+static void consume_wakeup (lw_eventpump ctx)
+{
+   /* Cleared before the fd is read and the queue drained, so a post that
+    * sees it clear is guaranteed to either be drained or wake us again.
+    */
+   __sync_fetch_and_and (&ctx->wakeup_pending, 0);
+
+   #ifdef HAVE_SYS_EVENTFD_H
+      eventfd_t value;
+      eventfd_read (ctx->wakeup_read, &value);
+   #else
+      char buf [64];
+      while (read (ctx->wakeup_read, buf, sizeof (buf)) == sizeof (buf));
+   #endif
+}
+
+static lw_bool ring_push (lw_eventpump ctx, int type, void * func, void * param)
+{
+   unsigned long pos = __atomic_load_n (&ctx->post_head, __ATOMIC_RELAXED);
+
+   for (;;)
+   {
+      struct _lwp_eventpump_post * slot =
+         &ctx->post_ring [pos & (lwp_eventpump_post_ring_size - 1)];
+
+      long diff = (long) (__atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+      if (diff < 0)
+         return lw_false;  /* full */
+
+      if (diff == 0
+            && __sync_bool_compare_and_swap (&ctx->post_head, pos, pos + 1))
+      {
+         slot->type = type;
+         slot->func = func;
+         slot->param = param;
+
+         __atomic_store_n (&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+         return lw_true;
+      }
+
+      pos = __atomic_load_n (&ctx->post_head, __ATOMIC_RELAXED);
+   }
+}
+
+/* Only called with post_drain_lock held, so there's only ever one consumer.
+ */
+static lw_bool ring_pop (lw_eventpump ctx, struct _lwp_eventpump_post * post)
+{
+   unsigned long pos = ctx->post_tail;
+
+   struct _lwp_eventpump_post * slot =
+      &ctx->post_ring [pos & (lwp_eventpump_post_ring_size - 1)];
+
+   if (__atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+      return lw_false;
+
+   post->type = slot->type;
+   post->func = slot->func;
+   post->param = slot->param;
+
+   __atomic_store_n (&slot->seq, pos + lwp_eventpump_post_ring_size,
+                     __ATOMIC_RELEASE);
+   ctx->post_tail = pos + 1;
+
+   return lw_true;
+}
+
+static void queue_post (lw_eventpump ctx, int type, void * func, void * param)
+{
+   /* Once anything has gone to the overflow list, everything else has to
+    * follow it until it's drained, or posts would run out of order.
+    */
+   if (__atomic_load_n (&ctx->num_overflow, __ATOMIC_RELAXED) > 0
+         || !ring_push (ctx, type, func, param))
+   {
+      struct _lwp_eventpump_post * post = malloc (sizeof (*post));
+
+      post->type = type;
+      post->func = func;
+      post->param = param;
+
+      lw_sync_lock (ctx->sync_signals);
+
+         list_push (ctx->overflow, post);
+         __sync_add_and_fetch (&ctx->num_overflow, 1);
+
+      lw_sync_release (ctx->sync_signals);
+   }
+
+   if (current_pump != ctx)
+      wakeup (ctx);
+}
+
+static lw_bool posts_waiting (lw_eventpump ctx)
+{
+   unsigned long pos = ctx->post_tail;
+
+   struct _lwp_eventpump_post * slot =
+      &ctx->post_ring [pos & (lwp_eventpump_post_ring_size - 1)];
+
+   if (__atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) == pos + 1)
+      return lw_true;
+
+   return __atomic_load_n (&ctx->post_head, __ATOMIC_RELAXED) == pos
+            && __atomic_load_n (&ctx->num_overflow, __ATOMIC_RELAXED) > 0;
+}
+
+/* If until is non-zero, stops once that time (from time_now_us) is reached
+ * even if there are still posts waiting.
+ */
+static void drain_posts (lw_eventpump ctx, lw_i64 until)
+{
+   struct _lwp_eventpump_post post;
+
+   lw_ui64 depth = (__atomic_load_n (&ctx->post_head, __ATOMIC_RELAXED)
+                        - ctx->post_tail)
+                 + __atomic_load_n (&ctx->num_overflow, __ATOMIC_RELAXED),
+           num_drained = 0;
+
+   for (;;)
+   {
+      /* If another thread is already draining, it will check again for
+       * anything we would have picked up after it lets go of the lock.
+       */
+      if (__sync_lock_test_and_set (&ctx->post_drain_lock, 1))
+         break;
+
+      lw_bool have_post = ring_pop (ctx, &post);
+
+      /* The overflow list is only touched once the ring is completely empty,
+       * so that anything that went into the ring before it runs first.
+       */
+      if ((!have_post)
+            && __atomic_load_n (&ctx->post_head, __ATOMIC_RELAXED)
+                  == ctx->post_tail
+            && __atomic_load_n (&ctx->num_overflow, __ATOMIC_RELAXED) > 0)
+      {
+         lw_sync_lock (ctx->sync_signals);
+
+            struct _lwp_eventpump_post * front = list_front (ctx->overflow);
+            list_pop_front (ctx->overflow);
+
+            __sync_sub_and_fetch (&ctx->num_overflow, 1);
+
+         lw_sync_release (ctx->sync_signals);
+
+         post = *front;
+         free (front);
+
+         have_post = lw_true;
+      }
+
+      __sync_lock_release (&ctx->post_drain_lock);
+
+      if (!have_post)
+      {
+         if (posts_waiting (ctx))
+            continue;
+
+         break;
+      }
+
+      ++ num_drained;
+
+      switch (post.type)
+      {
+         case post_func:
+
+            ((void * (*) (void *)) post.func) (post.param);
+            break;
+
+         case post_remove:
+
+            watch_free (ctx, post.param);
+            lw_pump_remove_user ((lw_pump) ctx);
+
+            break;
+      };
+
+      if (until && time_now_us () >= until)
+         break;
+   }
+
+   if (ctx->stats_enabled)
+   {
+      lw_sync_lock (ctx->sync_stats);
+
+      histogram_add (&ctx->stats.post_depth, depth);
+      ctx->stats.posts += num_drained;
+
+      lw_sync_release (ctx->sync_stats);
+   }
+}
+
+static lw_bool consume_exit (lw_eventpump ctx)
+{
+   for (;;)
+   {
+      long exit_pending = __atomic_load_n (&ctx->exit_pending, __ATOMIC_RELAXED);
+
+      if (exit_pending <= 0)
+         return lw_false;
+
+      if (__sync_bool_compare_and_swap
+            (&ctx->exit_pending, exit_pending, exit_pending - 1))
+      {
+         return lw_true;
+      }
+   }
+}
+
+void lwp_eventpump_add_timer (lw_eventpump ctx, lwp_timerwheel_entry entry,
+                              long delay)
+{
+   lw_sync_lock (ctx->sync_timers);
+
+      lwp_timerwheel_add (&ctx->timers, entry, time_now () + delay);
+
+   lw_sync_release (ctx->sync_timers);
+
+   /* If the pump is already waiting, it may be with a longer timeout than
+    * this timer needs.  From the pump's own thread, the timeout will be
+    * worked out again before it next waits.
+    */
+   if (current_pump != ctx)
+      wakeup (ctx);
+}
+
+void lwp_eventpump_remove_timer (lw_eventpump ctx, lwp_timerwheel_entry entry)
+{
+   lw_sync_lock (ctx->sync_timers);
+
+   lwp_timerwheel_remove (&ctx->timers, entry);
+
+   /* On the pump's own thread, any on_expire for it is further up the
+    * stack, so there's nothing to wait for.
+    */
+   while (ctx->firing == entry && current_pump != ctx)
+   {
+      lw_sync_release (ctx->sync_timers);
+      sched_yield ();
+      lw_sync_lock (ctx->sync_timers);
+   }
+
+   lw_sync_release (ctx->sync_timers);
+}
+
+static void run_timers (lw_eventpump ctx)
 {
-   lw_eventpump ctx = calloc (sizeof (*ctx), 1);
+   lw_sync_lock (ctx->sync_timers);
 
-   if (!ctx)
-      return NULL;
+   lwp_timerwheel_advance (&ctx->timers, time_now ());
 
-   #ifdef ENABLE_THREADS
-      ctx->watcher.thread = lw_thread_new ("watcher", (void *) watcher);
-      ctx->watcher.resume_event = lw_event_new ();
-   #endif
+   for (;;)
+   {
+      lwp_timerwheel_entry entry = lwp_timerwheel_pop_expired (&ctx->timers);
 
-   lwp_pump_init (&ctx->pump, &def_eventpump);
+      if (!entry)
+         break;
 
-   ctx->sync_signals = lw_sync_new ();
+      void (* on_expire) (void *) = entry->on_expire;
+      void * tag = entry->tag;
+
+      if (ctx->stats_enabled)
+      {
+         lw_sync_lock (ctx->sync_stats);
 
-   int signalpipe [2];
-   pipe (signalpipe);
+         ++ ctx->stats.timers;
 
-   ctx->signalpipe_read   = signalpipe [0];
-   ctx->signalpipe_write  = signalpipe [1];
+         histogram_add (&ctx->stats.timer_lag_us,
+                        time_now_us () - entry->due * 1000);
 
-   fcntl (ctx->signalpipe_read, F_SETFL,
-         fcntl (ctx->signalpipe_read, F_GETFL, 0) | O_NONBLOCK);
+         lw_sync_release (ctx->sync_stats);
+      }
 
-   ctx->queue = lwp_eventqueue_new ();
+      /* Not held while calling, as the callback is free to start, stop or
+       * delete any timer (including this one).  Another thread doing the
+       * same waits for it to return (see lwp_eventpump_remove_timer).
+       */
+      ctx->firing = entry;
 
-   lwp_eventqueue_add (ctx->queue, ctx->signalpipe_read,
-                       lw_true, lw_false, lw_true,
-                       NULL);
+      lw_sync_release (ctx->sync_timers);
 
-   return ctx;
+      on_expire (tag);
+
+      lw_sync_lock (ctx->sync_timers);
+
+      ctx->firing = 0;
+   }
+
+   lw_sync_release (ctx->sync_timers);
 }
 
-static void def_cleanup (lw_pump pump)
+static long timer_timeout (lw_eventpump ctx)
 {
-   lw_eventpump ctx = (lw_eventpump) pump;
+   lw_sync_lock (ctx->sync_timers);
 
-   lwp_eventqueue_delete (ctx->queue);
-   
-   #ifdef ENABLE_THREADS
+      long timeout = lwp_timerwheel_timeout (&ctx->timers, time_now ());
 
-      if (lw_thread_started (ctx->watcher.thread))
-      {
-         lw_event_signal (ctx->watcher.resume_event);
-         lw_thread_join (ctx->watcher.thread);
-      }
+   lw_sync_release (ctx->sync_timers);
 
-      lw_event_delete (ctx->watcher.resume_event);
+   return timeout;
+}
+
+lw_bool lw_eventpump_set_busy_poll (lw_eventpump ctx, long microseconds)
+{
+   ctx->busy_poll_us = microseconds > 0 ? microseconds : 0;
+   ctx->spin_us = ctx->busy_poll_us;
 
+   #ifdef ENABLE_THREADS
+      for (int i = 0; i < ctx->num_loops; ++ i)
+         lw_eventpump_set_busy_poll (ctx->loops [i].pump, microseconds);
    #endif
 
-   /* TODO */
+   return lw_true;
 }
 
-lw_bool process_event (lw_eventpump ctx, lwp_eventqueue_event event)
+void lwp_eventpump_busy_poll_socket (lw_pump pump, int fd)
 {
-   lw_bool read_ready = lwp_eventqueue_event_read_ready (event),
-           write_ready = lwp_eventqueue_event_write_ready (event);
+   if (pump->def != &def_eventpump)
+      return;
 
-   lw_pump_watch watch = lwp_eventqueue_event_tag (event);
+   #ifdef SO_BUSY_POLL
 
-   /* fudge: nothing kqueue specific belongs in this file, but since the
-    * kqueue code doesn't actually look at the events it's the only place
-    * we can put it.
-    */
-   #ifdef USE_KQUEUE
+      int busy_poll_us = ((lw_eventpump) pump)->busy_poll_us;
 
-      if (event.filter == EVFILT_TIMER)
+      /* Raising it past net.core.busy_read needs CAP_NET_ADMIN, so this is
+       * allowed to fail.
+       */
+      if (busy_poll_us > 0)
       {
-         lw_timer_force_tick ((lw_timer) event.udata);
-         return lw_true;
+         setsockopt (fd, SOL_SOCKET, SO_BUSY_POLL,
+                     (char *) &busy_poll_us, sizeof (busy_poll_us));
       }
 
    #endif
+}
 
-   if (watch)
+/* Drains the eventqueue, first spinning without blocking for up to spin_us
+ * if busy polling is enabled.
+ */
+static int busy_poll_drain (lw_eventpump ctx, lwp_eventqueue_event * events)
+{
+   long spin_us = ctx->spin_us;
+
+   if (spin_us > 0)
    {
-      if (read_ready && watch->on_read_ready)
-         watch->on_read_ready (watch->tag);
+      lw_i64 until = time_now_us () + spin_us;
 
-      if (write_ready && watch->on_write_ready)
-         watch->on_write_ready (watch->tag);
+      do
+      {
+         int count = lwp_eventqueue_drain (ctx->queue, 0, max_events, events);
 
-      return lw_true;
-   }
+         if (count != 0)
+            return count;
 
-   /* A null tag means it must be the signal pipe */
+         if (timer_timeout (ctx) == 0)
+            return 0;
 
-   lw_sync_lock (ctx->sync_signals);
+      } while (time_now_us () < until);
+   }
 
-   char signal;
+   lw_i64 blocked = time_now_us ();
 
-   if (read (ctx->signalpipe_read, &signal, sizeof (signal)) == -1)
-   {
-      lw_sync_release (ctx->sync_signals);
-      return lw_true;
-   }
+   int count = lwp_eventqueue_drain (ctx->queue, timer_timeout (ctx),
+                                     max_events, events);
 
-   switch (signal)
+   if (count > 0)
    {
-      case sig_exit_eventloop:
+      if (time_now_us () - blocked < ctx->busy_poll_us)
       {
-         lw_sync_release (ctx->sync_signals);
-         return lw_false;
-      }
+         /* A longer spin would have caught it
+          */
+         spin_us = spin_us > 0 ? spin_us * 2 : 1;
 
-      case sig_remove:
+         if (spin_us > ctx->busy_poll_us)
+            spin_us = ctx->busy_poll_us;
+      }
+      else
       {
-         lw_pump_watch to_remove = list_front (ctx->signalparams);
-         list_pop_front (ctx->signalparams);
+         spin_us /= 2;
+      }
+
+      ctx->spin_us = spin_us;
+   }
 
-         free (to_remove);
+   return count;
+}
+
+static void process_event (lw_eventpump ctx, lwp_eventqueue_event event,
+                           unsigned long gen)
+{
+   lw_bool read_ready = lwp_eventqueue_event_read_ready (event),
+           write_ready = lwp_eventqueue_event_write_ready (event);
 
-         lw_pump_remove_user ((lw_pump) ctx);
+   lw_pump_watch watch = lwp_eventqueue_event_tag (event);
 
-         break;
-      }
+   if (watch)
+   {
+      if (watch->gen != gen)
+         return;  /* removed since the event was drained */
+
+      lw_i64 started = ctx->stats_enabled ? time_now_us () : 0;
+
+      if (read_ready && watch->on_read_ready)
+         watch->on_read_ready (watch->tag);
+
+      /* on_read_ready may have removed the watch, and something else may
+       * already have been given it.
+       */
+      if (write_ready && watch->gen == gen && watch->on_write_ready)
+         watch->on_write_ready (watch->tag);
 
-      case sig_post:
+      if (started)
       {
-         void * func = list_front (ctx->signalparams);
-         list_pop_front (ctx->signalparams);
+         lw_ui64 elapsed = time_now_us () - started;
 
-         void * param = list_front (ctx->signalparams);
-         list_pop_front (ctx->signalparams);
+         lw_sync_lock (ctx->sync_stats);
 
-         ((void * (*) (void *)) func) (param);
+         histogram_add (&ctx->stats.callback_us, elapsed);
 
-         break;
+         if (elapsed >= ctx->stats.slowest_us)
+         {
+            ctx->stats.slowest_us = elapsed;
+            ctx->stats.slowest_tag = watch->tag;
+         }
+
+         lw_sync_release (ctx->sync_stats);
       }
-   };
 
-   lw_sync_release (ctx->sync_signals);
+      return;
+   }
+
+   /* A null tag means it must be the wakeup fd.  The posts themselves are
+    * drained at the end of the batch.
+    */
+   consume_wakeup (ctx);
+}
+
+#ifdef ENABLE_THREADS
+
+/* sleepy ticking: the watcher thread may already have grabbed some events we
+ * need to process.  Returns true if the watcher needs resuming afterwards.
+ */
+static lw_bool process_watcher_events (lw_eventpump ctx)
+{
+   if (!__atomic_load_n (&ctx->watcher.tick_needed, __ATOMIC_ACQUIRE))
+      return lw_false;
+
+   for (int i = 0; i < ctx->watcher.num_events; ++ i)
+      process_event (ctx, ctx->watcher.events [i], ctx->watcher.gens [i]);
+
+   ctx->watcher.num_events = 0;
+   __atomic_store_n (&ctx->watcher.tick_needed, lw_false, __ATOMIC_RELAXED);
 
    return lw_true;
 }
 
+#endif
+
+/* Processes whatever events are ready without waiting, up to max_events
+ */
+static int process_ready (lw_eventpump ctx)
+{
+   lwp_eventqueue_event events [max_events];
+   unsigned long gens [max_events];
+
+   int count = lwp_eventqueue_drain (ctx->queue, 0, max_events, events);
+
+   if (ctx->stats_enabled && count >= 0)
+      stats_wakeup (ctx, count);
+
+   for (int i = 0; i < count; ++ i)
+      gens [i] = event_gen (events [i]);
+
+   for (int i = 0; i < count; ++ i)
+      process_event (ctx, events [i], gens [i]);
+
+   return count;
+}
+
 lw_error lw_eventpump_tick (lw_eventpump ctx)
 {
    lw_bool need_watcher_resume = lw_false;
 
+   lw_eventpump prev_pump = current_pump;
+   current_pump = ctx;
+
+   lw_i64 started = ctx->stats_enabled ? time_now_us () : 0;
+
+   run_timers (ctx);
+
    #ifdef ENABLE_THREADS
+      need_watcher_resume = process_watcher_events (ctx);
+   #endif
 
-      if (ctx->watcher.num_events > 0)
-      {
-         /* sleepy ticking: the watcher thread already grabbed some events we
-          * need to process.
-          */
-         for (int i = 0; i < ctx->watcher.num_events; ++ i)
-            process_event (ctx, ctx->watcher.events [i]);
+   process_ready (ctx);
+
+   drain_posts (ctx, 0);
+
+   if (started)
+      stats_tick (ctx, started);
+
+   current_pump = prev_pump;
    
-         ctx->watcher.num_events = 0;
-       
-         need_watcher_resume = lw_true;
+   #ifdef ENABLE_THREADS
+      if (need_watcher_resume)
+      {
+         free_retired (ctx);
+         lw_event_signal (ctx->watcher.resume_event);
       }
+   #endif
+
+   return 0;
+}
+
+/* Like tick, but keeps going until there's nothing ready or budget_us has
+ * passed.  Returns 0 if everything ready was processed, or otherwise the
+ * number of posts left plus one if the eventqueue may have more events.
+ */
+long lw_eventpump_tick_for (lw_eventpump ctx, long budget_us)
+{
+   lw_bool need_watcher_resume = lw_false;
+
+   lw_eventpump prev_pump = current_pump;
+   current_pump = ctx;
 
+   lw_i64 started = time_now_us (), until = started + budget_us;
+
+   #ifdef ENABLE_THREADS
+      need_watcher_resume = process_watcher_events (ctx);
    #endif
 
-   lwp_eventqueue_event events [max_events];
+   int count;
+
+   for (;;)
+   {
+      run_timers (ctx);
 
-   int count = lwp_eventqueue_drain (ctx->queue, lw_false, max_events, events);
+      count = process_ready (ctx);
+
+      drain_posts (ctx, until);
+
+      if (time_now_us () >= until)
+         break;
+
+      /* A short batch means the eventqueue had nothing else ready
+       */
+      if (count < max_events && !posts_waiting (ctx))
+         break;
+   }
+
+   if (ctx->stats_enabled)
+      stats_tick (ctx, started);
+
+   current_pump = prev_pump;
 
-   for (int i = 0; i < count; ++ i)
-      process_event (ctx, events [i]);
-   
    #ifdef ENABLE_THREADS
       if (need_watcher_resume)
+      {
+         free_retired (ctx);
          lw_event_signal (ctx->watcher.resume_event);
+      }
    #endif
 
+   long remaining = (__atomic_load_n (&ctx->post_head, __ATOMIC_RELAXED)
+                        - ctx->post_tail)
+                  + __atomic_load_n (&ctx->num_overflow, __ATOMIC_RELAXED);
+
+   if (count == max_events)
+      ++ remaining;
+
+   return remaining;
+}
+
+int lw_eventpump_fd (lw_eventpump ctx)
+{
+   return lwp_eventqueue_fd (ctx->queue);
+}
+
+long lw_eventpump_timeout (lw_eventpump ctx)
+{
+   return timer_timeout (ctx);
+}
+
+/* Unlike tick, keeps going until the eventqueue is empty, as the fd may be
+ * being polled edge triggered.
+ */
+lw_error lw_eventpump_dispatch (lw_eventpump ctx)
+{
+   lw_eventpump prev_pump = current_pump;
+   current_pump = ctx;
+
+   lw_i64 started = ctx->stats_enabled ? time_now_us () : 0;
+
+   run_timers (ctx);
+
+   for (;;)
+   {
+      int count = process_ready (ctx);
+
+      drain_posts (ctx, 0);
+
+      if (count < max_events)
+         break;
+   }
+
+   if (started)
+      stats_tick (ctx, started);
+
+   current_pump = prev_pump;
+
    return 0;
 }
 
-lw_error lw_eventpump_start_eventloop (lw_eventpump ctx)
+static void eventloop (lw_eventpump ctx)
 {
-   int do_loop = 1;
+   lw_eventpump prev_pump = current_pump;
+   current_pump = ctx;
 
-   while (do_loop)
+   /* When the current batch of events was drained, if collecting stats
+    */
+   lw_i64 woken = 0;
+
+   for (;;)
    {
+      run_timers (ctx);
+
+      /* Anything posted from the last batch of events (or before the loop
+       * was started) runs before going back to the eventqueue.
+       */
+      drain_posts (ctx, 0);
+
+      if (woken)
+      {
+         stats_tick (ctx, woken);
+         woken = 0;
+      }
+
+      if (consume_exit (ctx))
+         break;
+
       lwp_eventqueue_event events [max_events];
 
-      int count = lwp_eventqueue_drain (ctx->queue, lw_true, max_events, events);
+      int count;
+
+      if (ctx->busy_poll_us > 0)
+      {
+         count = busy_poll_drain (ctx, events);
+      }
+      else
+      {
+         count = lwp_eventqueue_drain (ctx->queue, timer_timeout (ctx),
+                                       max_events, events);
+      }
 
       if (count == -1)
       {
@@ -234,27 +1137,64 @@ lw_error lw_eventpump_start_eventloop (lw_eventpump ctx)
          break;
       }
 
-      for (int i = 0; i < count; ++ i)
+      if (ctx->stats_enabled)
       {
-         if (!process_event (ctx, events [i]))
-         {
-            do_loop = 0;
-            break;
-         }
+         woken = time_now_us ();
+         stats_wakeup (ctx, count);
       }
+
+      unsigned long gens [max_events];
+
+      for (int i = 0; i < count; ++ i)
+         gens [i] = event_gen (events [i]);
+
+      for (int i = 0; i < count; ++ i)
+         process_event (ctx, events [i], gens [i]);
    }
 
+   current_pump = prev_pump;
+}
+
+#ifdef ENABLE_THREADS
+
+static void loop_thread (lw_eventpump ctx)
+{
+   eventloop (ctx);
+}
+
+#endif
+
+lw_error lw_eventpump_start_eventloop (lw_eventpump ctx)
+{
+   #ifdef ENABLE_THREADS
+
+      for (int i = 0; i < ctx->num_loops; ++ i)
+         lw_thread_start (ctx->loops [i].thread, ctx->loops [i].pump);
+
+      eventloop (ctx);
+
+      /* Exiting this pump's loop takes the other loop threads with it
+       */
+      for (int i = 0; i < ctx->num_loops; ++ i)
+      {
+         lw_eventpump_post_eventloop_exit (ctx->loops [i].pump);
+         lw_thread_join (ctx->loops [i].thread);
+      }
+
+   #else
+
+      eventloop (ctx);
+
+   #endif
+
    return 0;
 }
 
 void lw_eventpump_post_eventloop_exit (lw_eventpump ctx)
 {
-   lw_sync_lock (ctx->sync_signals);
-
-      char signal = sig_exit_eventloop;
-      write (ctx->signalpipe_write, &signal, sizeof (signal));
+   __sync_add_and_fetch (&ctx->exit_pending, 1);
 
-   lw_sync_release (ctx->sync_signals);
+   wakeup (ctx);
 }
 
 lw_error lw_eventpump_start_sleepy_ticking
@@ -279,7 +1219,7 @@ static void watcher (lw_eventpump ctx)
       assert (ctx->watcher.num_events == 0);
 
       int count = lwp_eventqueue_drain (ctx->queue,
-                                        lw_true,
+                                        timer_timeout (ctx),
                                         max_events,
                                         ctx->watcher.events);
 
@@ -291,11 +1231,17 @@ static void watcher (lw_eventpump ctx)
          lwp_trace ("drain error: %d", errno);
          break;
       }
-         
-      if (count == 0)
-         continue;
 
+      if (__atomic_load_n (&ctx->watcher.exiting, __ATOMIC_RELAXED))
+         break;
+
+      for (int i = 0; i < count; ++ i)
+         ctx->watcher.gens [i] = event_gen (ctx->watcher.events [i]);
+
+      /* No events means the timeout expired, so a timer is due.
+       */
       ctx->watcher.num_events = count;
+      __atomic_store_n (&ctx->watcher.tick_needed, lw_true, __ATOMIC_RELEASE);
 
       /* We have some events.  Notify the application from this thread, then
        * wait for tick() to be called from the application main thread.
@@ -304,6 +1250,9 @@ static void watcher (lw_eventpump ctx)
 
       lw_event_wait (ctx->watcher.resume_event, -1);
       lw_event_unsignal (ctx->watcher.resume_event);
+
+      if (__atomic_load_n (&ctx->watcher.exiting, __ATOMIC_RELAXED))
+         break;
    }
 }
 
@@ -319,7 +1268,7 @@ static lw_pump_watch def_add (lw_pump pump, int fd, void * tag,
    if ((!on_read_ready) && (!on_write_ready))
       return 0;
 
-   lw_pump_watch watch = calloc (sizeof (*watch), 1);
+   lw_pump_watch watch = watch_alloc (ctx);
 
    if (!watch)
       return 0;
@@ -373,34 +1322,55 @@ static void def_remove (lw_pump pump, lw_pump_watch watch)
 {
    lw_eventpump ctx = (lw_eventpump) pump;
 
-   /* TODO : Should this remove the FD from the eventqueue immediately? */
+   /* Taken out of the eventqueue straight away, as an io_uring poll would
+    * otherwise keep the file open after the caller closes the fd.
+    */
+   if (watch->on_read_ready || watch->on_write_ready)
+   {
+      lwp_eventqueue_update (ctx->queue, watch->fd,
+                             watch->on_read_ready != NULL, lw_false,
+                             watch->on_write_ready != NULL, lw_false,
+                             watch->edge_triggered, watch->edge_triggered,
+                             watch->tag, watch->tag);
+   }
 
    watch->on_read_ready = NULL;
    watch->on_write_ready = NULL;
 
-   lw_sync_lock (ctx->sync_signals);
+   /* While sleepy ticking, the watcher thread drains events independently
+    * of the application's ticks, so the watch can't be reused until the
+    * watcher is next waiting to be resumed.
+    */
+   #ifdef ENABLE_THREADS
+      if (lw_thread_started (ctx->watcher.thread))
+      {
+         watch_retire (ctx, watch);
+         return;
+      }
+   #endif
 
-      list_push (ctx->signalparams, watch);
+   /* From the pump's own thread, the watch can go straight back to the slab
+    * (the generation check takes care of any events already drained for
+    * it).  Another thread could be racing with the pump between draining
+    * events and reading their generations, so it has to go through the
+    * post queue instead.
+    */
+   if (current_pump == ctx)
+   {
+      watch_free (ctx, watch);
+      lw_pump_remove_user ((lw_pump) ctx);
 
-      char signal = sig_remove;
-      write (ctx->signalpipe_write, &signal, sizeof (signal));
+      return;
+   }
 
-   lw_sync_release (ctx->sync_signals);
+   queue_post (ctx, post_remove, NULL, watch);
 }
 
 static void def_post (lw_pump pump, void * func, void * param)
 {
    lw_eventpump ctx = (lw_eventpump) pump;
 
-   lw_sync_lock (ctx->sync_signals);
-
-      list_push (ctx->signalparams, func);
-      list_push (ctx->signalparams, param);
-
-      char signal = sig_post;
-      write (ctx->signalpipe_write, &signal, sizeof (signal));
-
-   lw_sync_release (ctx->sync_signals);
+   queue_post (ctx, post_func, func, param);
 }
 
 const lw_pumpdef def_eventpump =
@@ -28,10 +28,33 @@
  */
 
 #include "../pump.h"
+#include "../timerwheel.h"
 #include "eventqueue/eventqueue.h"
 
 #define max_events  16
 
+/* Watches are allocated this many at a time
+ */
+#define lwp_eventpump_slab_size  64
+
+/* Must be a power of two
+ */
+#define lwp_eventpump_post_ring_size  1024
+
+/* A post record in the eventpump's ring.  seq is the ring position the slot
+ * is next ready to be written (seq == pos) or read (seq == pos + 1) at, as
+ * in Dmitry Vyukov's bounded MPMC queue.
+ */
+struct _lwp_eventpump_post
+{
+   volatile unsigned long seq;
+
+   int type;
+
+   void * func;
+   void * param;
+};
+
 struct _lw_pump_watch
 {
    lw_pump_callback on_read_ready, on_write_ready;
@@ -39,6 +62,22 @@ struct _lw_pump_watch
 
    int fd;
    void * tag;
+
+   /* Bumped every time the watch goes back to the slab.  Events carry the
+    * generation their watch had when they were drained, so an event for a
+    * watch removed earlier in the same batch is dropped rather than being
+    * delivered to whatever reused it.
+    */
+   unsigned long gen;
+
+   lw_pump_watch next_free;
+};
+
+struct _lwp_eventpump_slab
+{
+   struct _lwp_eventpump_slab * next;
+
+   struct _lw_pump_watch watches [lwp_eventpump_slab_size];
 };
 
 struct _lw_eventpump
@@ -47,10 +86,59 @@ struct _lw_eventpump
 
    lwp_eventqueue queue;
 
+   /* Slabs are only freed with the pump, so a removed watch's gen can
+    * always be read.
+    */
+   volatile int slab_lock;
+   struct _lwp_eventpump_slab * slabs;
+   lw_pump_watch free_watches;
+
+   /* Posts go into a fixed size lock-free ring.  Only when that fills up
+    * do they fall back to the overflow list, which is protected by
+    * sync_signals.
+    */
+   struct _lwp_eventpump_post post_ring [lwp_eventpump_post_ring_size];
+
+   volatile unsigned long post_head, post_tail;
+   volatile int post_drain_lock;
+
    lw_sync sync_signals;
 
-   int signalpipe_read, signalpipe_write;
-   list (void *, signalparams);
+   volatile long num_overflow;
+   list (struct _lwp_eventpump_post *, overflow);
+
+   /* An eventfd where available, otherwise a pipe.  wakeup_pending is set by
+    * whoever writes to it, so that a burst of posts only costs one write.
+    */
+   int wakeup_read, wakeup_write;
+   volatile int wakeup_pending;
+
+   volatile long exit_pending;
+
+   /* If busy_poll_us is set, the loop spins for up to spin_us before it
+    * blocks.  spin_us grows while spinning would have caught events, and
+    * shrinks while it wouldn't.
+    */
+   long busy_poll_us;
+   volatile long spin_us;
+
+   /* lw_timers on this pump.  The time until the next one is due is used
+    * as the timeout when waiting on the eventqueue.
+    */
+   lw_sync sync_timers;
+   struct _lwp_timerwheel timers;
+
+   /* The timer whose on_expire is running, if any.  Set and cleared with
+    * sync_timers held, which is released for the call itself.
+    */
+   lwp_timerwheel_entry firing;
+
+   /* Only collected while stats_enabled is set, so a pump without stats
+    * just pays for the check.
+    */
+   volatile lw_bool stats_enabled;
+   lw_sync sync_stats;
+   lw_pump_stats stats;
 
    #ifndef _lacewing_no_threads
 
@@ -62,17 +150,60 @@ struct _lw_eventpump
    
          int num_events;
          lwp_eventqueue_event events [max_events];
+         unsigned long gens [max_events];
+
+         lw_bool tick_needed;
    
          lw_event resume_event;
+
+         volatile lw_bool exiting;
+
+         /* Watches removed while the watcher thread is running.  It may be
+          * reading their generations, so they only go back to the slab
+          * while it's waiting to be resumed (protected by slab_lock).
+          */
+         lw_pump_watch retired;
    
       } watcher;
 
       void (lw_callback * on_tick_needed) (lw_eventpump);
 
+      /* for lw_eventpump_new_threaded: the pumps run by the other loop
+       * threads.  Each has an eventqueue of its own, so a watch is only ever
+       * dispatched by the thread whose pump it was added to.
+       */
+      int num_loops;
+
+      struct
+      {
+         lw_eventpump pump;
+         lw_thread thread;
+
+      } * loops;
+
+      volatile long next_loop;
+
    #endif
 };
 
-const lw_pumpdef def_eventpump;
+extern const lw_pumpdef def_eventpump;
+
+/* Timers are started delay ms from now, and may be called from any thread.
+ * Removing a timer from another thread while it's firing waits for its
+ * on_expire to return, so the entry can be freed straight after.
+ */
+void lwp_eventpump_add_timer (lw_eventpump, lwp_timerwheel_entry, long delay);
+void lwp_eventpump_remove_timer (lw_eventpump, lwp_timerwheel_entry);
+
+/* For spreading connections over the loop threads of a threaded pump: returns
+ * each of its pumps in turn (including pump itself), or pump itself for any
+ * other kind of pump.
+ */
+lw_pump lwp_eventpump_next (lw_pump pump);
+
+/* Applies the pump's busy poll setting (if any) to a new socket
+ */
+void lwp_eventpump_busy_poll_socket (lw_pump, int fd);
 
 /* epoll/kqueue/select specific
  */
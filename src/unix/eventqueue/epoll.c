@@ -30,14 +30,80 @@
 #include "../../common.h"
 #include "eventqueue.h"
 
-int lwp_eventqueue_new ()
+#ifdef lwp_eventqueue_has_uring
+   #include "uring.h"
+#endif
+
+struct _lwp_eventqueue
+{
+   int epoll_fd;
+
+   #ifdef lwp_eventqueue_has_uring
+      lwp_uring uring;
+   #endif
+};
+
+lwp_eventqueue lwp_eventqueue_new ()
 {
-   return epoll_create (32);
+   lwp_eventqueue queue = calloc (sizeof (*queue), 1);
+
+   if (!queue)
+      return 0;
+
+   queue->epoll_fd = epoll_create (32);
+
+   return queue;
 }
 
+#ifdef lwp_eventqueue_has_uring
+
+lwp_eventqueue lwp_eventqueue_new_uring ()
+{
+   lwp_uring uring = lwp_uring_new ();
+
+   if (!uring)
+      return lwp_eventqueue_new ();
+
+   lwp_eventqueue queue = calloc (sizeof (*queue), 1);
+
+   if (!queue)
+   {
+      lwp_uring_delete (uring);
+      return 0;
+   }
+
+   queue->epoll_fd = -1;
+   queue->uring = uring;
+
+   return queue;
+}
+
+#endif
+
 void lwp_eventqueue_delete (lwp_eventqueue queue)
 {
-   close (queue);
+   #ifdef lwp_eventqueue_has_uring
+      if (queue->uring)
+         lwp_uring_delete (queue->uring);
+   #endif
+
+   if (queue->epoll_fd != -1)
+      close (queue->epoll_fd);
+
+   free (queue);
+}
+
+int lwp_eventqueue_fd (lwp_eventqueue queue)
+{
+   #ifdef lwp_eventqueue_has_uring
+      if (queue->uring)
+      {
+         lwp_uring_set_embedded (queue->uring);
+         return lwp_uring_fd (queue->uring);
+      }
+   #endif
+
+   return queue->epoll_fd;
 }
 
 void lwp_eventqueue_add (lwp_eventqueue queue,
@@ -47,6 +113,14 @@ void lwp_eventqueue_add (lwp_eventqueue queue,
                          lw_bool edge_triggered,
                          void * tag)
 {
+   #ifdef lwp_eventqueue_has_uring
+      if (queue->uring)
+      {
+         lwp_uring_add (queue->uring, fd, read, write, edge_triggered, tag);
+         return;
+      }
+   #endif
+
    struct epoll_event event = {};
 
    event.data.ptr = tag;
@@ -55,7 +129,7 @@ void lwp_eventqueue_add (lwp_eventqueue queue,
                   (write ? EPOLLOUT : 0) |
                   (edge_triggered ? EPOLLET : 0);
 
-   epoll_ctl (queue, EPOLL_CTL_ADD, fd, &event);
+   epoll_ctl (queue->epoll_fd, EPOLL_CTL_ADD, fd, &event);
 }
 
 void lwp_eventqueue_update (lwp_eventqueue queue,
@@ -65,6 +139,18 @@ void lwp_eventqueue_update (lwp_eventqueue queue,
                             lw_bool was_edge_triggered, lw_bool edge_triggered,
                             void * old_tag, void * tag)
 {
+   #ifdef lwp_eventqueue_has_uring
+      if (queue->uring)
+      {
+         lwp_uring_remove (queue->uring, fd);
+
+         if (read || write)
+            lwp_uring_add (queue->uring, fd, read, write, edge_triggered, tag);
+
+         return;
+      }
+   #endif
+
    struct epoll_event event = {};
 
    event.data.ptr = tag;
@@ -75,20 +161,25 @@ void lwp_eventqueue_update (lwp_eventqueue queue,
                      (write ? EPOLLOUT : 0) |
                      (edge_triggered ? EPOLLET : 0);
 
-      epoll_ctl (queue, EPOLL_CTL_MOD, fd, &event);
+      epoll_ctl (queue->epoll_fd, EPOLL_CTL_MOD, fd, &event);
    }
    else
    {
-      epoll_ctl (queue, EPOLL_CTL_DEL, fd, &event);
+      epoll_ctl (queue->epoll_fd, EPOLL_CTL_DEL, fd, &event);
    }
 }
 
 int lwp_eventqueue_drain (lwp_eventqueue queue,
-                          lw_bool block,
+                          long timeout,
                           int max_events,
                           lwp_eventqueue_event * events)
 {
-   return epoll_wait (queue, events, max_events, block ? -1 : 0);
+   #ifdef lwp_eventqueue_has_uring
+      if (queue->uring)
+         return lwp_uring_drain (queue->uring, timeout, max_events, events);
+   #endif
+
+   return epoll_wait (queue->epoll_fd, events, max_events, timeout);
 }
 
 lw_bool lwp_eventqueue_event_read_ready (lwp_eventqueue_event event)
@@ -35,11 +35,16 @@
       #define EPOLLRDHUP 0x2000
    #endif
 
-   /* epoll: lwp_eventqueue is an epoll fd, _event is an epoll_event
+   /* epoll: lwp_eventqueue wraps an epoll fd (or an io_uring, see uring.h),
+    * _event is an epoll_event
     */
-   typedef int lwp_eventqueue;
+   typedef struct _lwp_eventqueue * lwp_eventqueue;
    typedef struct epoll_event lwp_eventqueue_event;
 
+   #ifdef HAVE_LINUX_IO_URING_H
+      #define lwp_eventqueue_has_uring
+   #endif
+
 #elif defined(USE_KQUEUE)
 
    #include <sys/event.h>
@@ -67,6 +72,20 @@
 lwp_eventqueue lwp_eventqueue_new ();
 void lwp_eventqueue_delete (lwp_eventqueue);
 
+/* fd: a file descriptor that becomes readable when the queue has events to
+ * drain, for polling from another event loop (-1 if there isn't one)
+ */
+int lwp_eventqueue_fd (lwp_eventqueue);
+
+#ifdef lwp_eventqueue_has_uring
+
+   /* new_uring: as new, but using io_uring for notifications if the kernel
+    * supports it (otherwise the same as lwp_eventqueue_new)
+    */
+   lwp_eventqueue lwp_eventqueue_new_uring ();
+
+#endif
+
 
 /* add: add a file descriptor to the eventqueue
  */
@@ -87,10 +106,11 @@ void lwp_eventqueue_update (lwp_eventqueue,
                             lw_bool was_edge_triggered, lw_bool edge_triggered,
                             void * old_tag, void * new_tag);
 
-/* drain: drain pending events from the queue
+/* drain: drain pending events from the queue, waiting up to timeout ms for
+ * some to arrive (-1 to wait indefinitely, 0 not to wait at all)
  */
 int lwp_eventqueue_drain (lwp_eventqueue,
-                          lw_bool block,
+                          long timeout,
                           int max_events,
                           lwp_eventqueue_event * events);
 
@@ -40,6 +40,11 @@ void lwp_eventqueue_delete (lwp_eventqueue queue)
    close (queue);
 }
 
+int lwp_eventqueue_fd (lwp_eventqueue queue)
+{
+   return queue;
+}
+
 void lwp_eventqueue_add (lwp_eventqueue queue,
                          int fd,
                          lw_bool read,
@@ -108,17 +113,17 @@ void lwp_eventqueue_update (lwp_eventqueue queue,
 }
 
 int lwp_eventqueue_drain (lwp_eventqueue queue,
-                          lw_bool block,
+                          long timeout,
                           int max_events,
                           lwp_eventqueue_event * events)
 {
-   struct timespec zero = {};
-   struct timespec * timeout = NULL;
+   struct timespec spec = {};
 
-   if (!block)
-      timeout = &zero;
+   spec.tv_sec = timeout / 1000;
+   spec.tv_nsec = (timeout % 1000) * 1000000;
 
-   return kevent (queue, 0, 0, events, max_events, timeout);
+   return kevent (queue, 0, 0, events, max_events,
+                  timeout == -1 ? NULL : &spec);
 }
 
 lw_bool lwp_eventqueue_event_read_ready (lwp_eventqueue_event event)
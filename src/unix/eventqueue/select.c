@@ -71,6 +71,11 @@ void lwp_eventqueue_delete (lwp_eventqueue queue)
    free (queue);
 }
 
+int lwp_eventqueue_fd (lwp_eventqueue queue)
+{
+   return -1;
+}
+
 void lwp_eventqueue_add (lwp_eventqueue queue,
                          int fd,
                          lw_bool read,
@@ -140,7 +145,7 @@ void lwp_eventqueue_update (lwp_eventqueue queue,
 }
 
 int lwp_eventqueue_drain (lwp_eventqueue queue,
-                          lw_bool block,
+                          long timeout,
                           int max_events,
                           lwp_eventqueue_event * events)
 {
@@ -164,14 +169,14 @@ int lwp_eventqueue_drain (lwp_eventqueue queue,
    fd_set read_set = fdset_remove (queue->read_set, queue->read_ready_set);
    fd_set write_set = fdset_remove (queue->write_set, queue->write_ready_set);
 
-   struct timeval * timeout = NULL;
+   struct timeval tv = {};
 
-   if (!block)
-      timeout = &zero_timeout;
+   tv.tv_sec = timeout / 1000;
+   tv.tv_usec = (timeout % 1000) * 1000;
 
    result = select (queue->max_fd,
                     &read_set, &write_set, NULL,
-                    timeout);
+                    timeout == -1 ? NULL : &tv);
 
    if (result == -1)
    {
@@ -0,0 +1,485 @@
+
+/* vim: set et ts=3 sw=3 sts=3 ft=c:
+ *
+ * Copyright (C) 2013 James McLaughlin.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "../../common.h"
+#include "eventqueue.h"
+
+#ifdef lwp_eventqueue_has_uring
+
+#include "uring.h"
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+
+#define ring_entries  256
+
+/* One per registered fd.  The poll's user_data points here rather than at
+ * the tag, so that completions still sitting in the CQ after the fd has been
+ * removed (or re-added with another tag) can be recognised and dropped.
+ */
+typedef struct _lwp_uring_poll
+{
+   int fd;
+   unsigned int events;
+   lw_bool multishot;
+
+   void * tag;
+
+   lw_bool armed, removed;
+
+} * lwp_uring_poll;
+
+struct _lwp_uring
+{
+   int fd;
+
+   void * sq_ptr, * cq_ptr;
+   size_t sq_size, cq_size;
+
+   struct io_uring_sqe * sqes;
+   size_t sqes_size;
+
+   volatile unsigned int * sq_head, * sq_tail, * sq_array;
+   unsigned int sq_mask;
+
+   volatile unsigned int * cq_head, * cq_tail;
+   struct io_uring_cqe * cqes;
+   unsigned int cq_mask;
+
+   /* SQEs may be queued by a thread other than the one draining (sleepy
+    * ticking), in which case they're submitted straight away if the drain
+    * is already waiting in the kernel.
+    */
+   lw_sync sync_sq;
+   volatile lw_bool waiting, embedded;
+
+   lwp_uring_poll * polls;
+   int num_polls;
+};
+
+static int uring_setup (unsigned int entries, struct io_uring_params * params)
+{
+   return (int) syscall (__NR_io_uring_setup, entries, params);
+}
+
+/* timeout is in milliseconds, and only used if wait is true (-1 for none)
+ */
+static int uring_enter (lwp_uring ctx, unsigned int to_submit,
+                        lw_bool wait, long timeout)
+{
+   if (wait && timeout >= 0)
+   {
+      struct __kernel_timespec ts = {};
+      struct io_uring_getevents_arg arg = {};
+
+      ts.tv_sec = timeout / 1000;
+      ts.tv_nsec = (timeout % 1000) * 1000000;
+
+      arg.ts = (unsigned long) &ts;
+
+      return (int) syscall (__NR_io_uring_enter, ctx->fd, to_submit, 1,
+                            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                            &arg, sizeof (arg));
+   }
+
+   return (int) syscall (__NR_io_uring_enter, ctx->fd, to_submit, wait ? 1 : 0,
+                         wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+lwp_uring lwp_uring_new ()
+{
+   struct io_uring_params params = {};
+
+   int fd = uring_setup (ring_entries, &params);
+
+   if (fd == -1)
+   {
+      lwp_trace ("io_uring_setup failed: %d, falling back to epoll", errno);
+      return 0;
+   }
+
+   /* Multishot poll arrived in 5.13, as did IORING_FEAT_RSRC_TAGS (which
+    * also implies IORING_FEAT_EXT_ARG, used for timeouts)
+    */
+   if (! (params.features & IORING_FEAT_RSRC_TAGS)
+         || ! (params.features & IORING_FEAT_SINGLE_MMAP))
+   {
+      close (fd);
+      return 0;
+   }
+
+   lwp_uring ctx = calloc (sizeof (*ctx), 1);
+
+   if (!ctx)
+   {
+      close (fd);
+      return 0;
+   }
+
+   ctx->fd = fd;
+
+   ctx->sq_size = params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+   ctx->cq_size = params.cq_off.cqes
+                     + params.cq_entries * sizeof (struct io_uring_cqe);
+
+   if (ctx->cq_size > ctx->sq_size)
+      ctx->sq_size = ctx->cq_size;
+
+   ctx->sq_ptr = mmap (0, ctx->sq_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+   ctx->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+
+   ctx->sqes = mmap (0, ctx->sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+   if (ctx->sq_ptr == MAP_FAILED || ctx->sqes == MAP_FAILED)
+   {
+      if (ctx->sq_ptr != MAP_FAILED)
+         munmap (ctx->sq_ptr, ctx->sq_size);
+
+      if (ctx->sqes != MAP_FAILED)
+         munmap (ctx->sqes, ctx->sqes_size);
+
+      close (fd);
+      free (ctx);
+
+      return 0;
+   }
+
+   /* IORING_FEAT_SINGLE_MMAP: both rings share the one mapping */
+   ctx->cq_ptr = ctx->sq_ptr;
+
+   char * sq = ctx->sq_ptr, * cq = ctx->cq_ptr;
+
+   ctx->sq_head = (unsigned int *) (sq + params.sq_off.head);
+   ctx->sq_tail = (unsigned int *) (sq + params.sq_off.tail);
+   ctx->sq_array = (unsigned int *) (sq + params.sq_off.array);
+   ctx->sq_mask = *(unsigned int *) (sq + params.sq_off.ring_mask);
+
+   ctx->cq_head = (unsigned int *) (cq + params.cq_off.head);
+   ctx->cq_tail = (unsigned int *) (cq + params.cq_off.tail);
+   ctx->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+   ctx->cq_mask = *(unsigned int *) (cq + params.cq_off.ring_mask);
+
+   ctx->sync_sq = lw_sync_new ();
+
+   return ctx;
+}
+
+void lwp_uring_delete (lwp_uring ctx)
+{
+   munmap (ctx->sqes, ctx->sqes_size);
+   munmap (ctx->sq_ptr, ctx->sq_size);
+
+   close (ctx->fd);
+
+   for (int i = 0; i < ctx->num_polls; ++ i)
+      free (ctx->polls [i]);
+
+   free (ctx->polls);
+
+   lw_sync_delete (ctx->sync_sq);
+
+   free (ctx);
+}
+
+int lwp_uring_fd (lwp_uring ctx)
+{
+   return ctx->fd;
+}
+
+static unsigned int sq_pending (lwp_uring ctx)
+{
+   return *ctx->sq_tail - __atomic_load_n (ctx->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/* Must be called with sync_sq held */
+static struct io_uring_sqe * get_sqe (lwp_uring ctx)
+{
+   if (sq_pending (ctx) > ctx->sq_mask)
+   {
+      /* Full: submit what's there to make room, but don't wait for anything.
+       */
+      while (uring_enter (ctx, sq_pending (ctx), lw_false, 0) == -1
+                && errno == EINTR);
+   }
+
+   unsigned int tail = *ctx->sq_tail;
+   unsigned int index = tail & ctx->sq_mask;
+
+   struct io_uring_sqe * sqe = &ctx->sqes [index];
+   memset (sqe, 0, sizeof (*sqe));
+
+   ctx->sq_array [index] = index;
+
+   return sqe;
+}
+
+/* Must be called with sync_sq held */
+static void commit_sqe (lwp_uring ctx)
+{
+   __atomic_store_n (ctx->sq_tail, *ctx->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static void queue_poll_add (lwp_uring ctx, lwp_uring_poll poll)
+{
+   lw_sync_lock (ctx->sync_sq);
+
+      struct io_uring_sqe * sqe = get_sqe (ctx);
+
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = poll->fd;
+      sqe->poll32_events = poll->events;
+      sqe->len = poll->multishot ? IORING_POLL_ADD_MULTI : 0;
+      sqe->user_data = (unsigned long) poll;
+
+      commit_sqe (ctx);
+
+      poll->armed = lw_true;
+
+   lw_sync_release (ctx->sync_sq);
+}
+
+static void queue_poll_remove (lwp_uring ctx, lwp_uring_poll poll)
+{
+   lw_sync_lock (ctx->sync_sq);
+
+      struct io_uring_sqe * sqe = get_sqe (ctx);
+
+      sqe->opcode = IORING_OP_POLL_REMOVE;
+      sqe->fd = -1;
+      sqe->addr = (unsigned long) poll;
+      sqe->user_data = 0;
+
+      commit_sqe (ctx);
+
+   lw_sync_release (ctx->sync_sq);
+}
+
+void lwp_uring_set_embedded (lwp_uring ctx)
+{
+   ctx->embedded = lw_true;
+}
+
+static void flush_if_waiting (lwp_uring ctx)
+{
+   if (ctx->waiting || ctx->embedded)
+      uring_enter (ctx, sq_pending (ctx), lw_false, 0);
+}
+
+void lwp_uring_add (lwp_uring ctx, int fd, lw_bool read, lw_bool write,
+                    lw_bool edge_triggered, void * tag)
+{
+   lwp_uring_poll poll = calloc (sizeof (*poll), 1);
+
+   if (!poll)
+      return;
+
+   poll->fd = fd;
+   poll->tag = tag;
+
+   poll->events = (read ? (EPOLLIN | EPOLLRDHUP) : 0) | (write ? EPOLLOUT : 0);
+
+   /* A multishot poll fires on every wakeup, which is close enough to
+    * EPOLLET.  Level triggered watches get a single shot poll that's re-added
+    * each time it completes.
+    */
+   poll->multishot = edge_triggered;
+
+   /* Watches can be added and removed from any thread, so polls is only
+    * touched with sync_sq held.
+    */
+   lw_sync_lock (ctx->sync_sq);
+
+   if (fd >= ctx->num_polls)
+   {
+      int num_polls = ctx->num_polls ? ctx->num_polls : 64;
+
+      while (num_polls <= fd)
+         num_polls *= 2;
+
+      lwp_uring_poll * polls = realloc (ctx->polls, sizeof (*polls) * num_polls);
+
+      if (!polls)
+      {
+         lw_sync_release (ctx->sync_sq);
+
+         free (poll);
+         return;
+      }
+
+      memset (polls + ctx->num_polls, 0,
+              sizeof (*polls) * (num_polls - ctx->num_polls));
+
+      ctx->polls = polls;
+      ctx->num_polls = num_polls;
+   }
+
+   ctx->polls [fd] = poll;
+
+   lw_sync_release (ctx->sync_sq);
+
+   queue_poll_add (ctx, poll);
+   flush_if_waiting (ctx);
+}
+
+void lwp_uring_remove (lwp_uring ctx, int fd)
+{
+   lw_sync_lock (ctx->sync_sq);
+
+   if (fd < 0 || fd >= ctx->num_polls || !ctx->polls [fd])
+   {
+      lw_sync_release (ctx->sync_sq);
+      return;
+   }
+
+   lwp_uring_poll poll = ctx->polls [fd];
+   ctx->polls [fd] = 0;
+
+   poll->removed = lw_true;
+   lw_bool armed = poll->armed;
+
+   lw_sync_release (ctx->sync_sq);
+
+   /* The poll holds its own reference to the file, so unlike epoll it has to
+    * be cancelled explicitly - closing the fd isn't enough.  It's freed once
+    * its final completion comes back.
+    */
+   if (armed)
+   {
+      queue_poll_remove (ctx, poll);
+      flush_if_waiting (ctx);
+   }
+   else
+   {
+      free (poll);
+   }
+}
+
+int lwp_uring_drain (lwp_uring ctx, long timeout, int max_events,
+                     struct epoll_event * events)
+{
+   int count = 0;
+
+   for (;;)
+   {
+      unsigned int head = *ctx->cq_head;
+      unsigned int tail = __atomic_load_n (ctx->cq_tail, __ATOMIC_ACQUIRE);
+
+      lw_bool wait = timeout != 0 && head == tail;
+
+      lw_sync_lock (ctx->sync_sq);
+      unsigned int to_submit = sq_pending (ctx);
+      lw_sync_release (ctx->sync_sq);
+
+      if (to_submit > 0 || wait)
+      {
+         ctx->waiting = wait;
+
+         int result = uring_enter (ctx, to_submit, wait, timeout);
+
+         ctx->waiting = lw_false;
+
+         if (result == -1 && errno != EBUSY && errno != ETIME)
+            return -1;
+
+         tail = __atomic_load_n (ctx->cq_tail, __ATOMIC_ACQUIRE);
+      }
+
+      while (head != tail && count < max_events)
+      {
+         struct io_uring_cqe * cqe = &ctx->cqes [head & ctx->cq_mask];
+         lwp_uring_poll poll = (lwp_uring_poll) (unsigned long) cqe->user_data;
+
+         ++ head;
+
+         if (!poll)
+            continue;  /* result of a POLL_REMOVE */
+
+         lw_bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+         if (!more)
+         {
+            lw_sync_lock (ctx->sync_sq);
+
+               poll->armed = lw_false;
+
+               if (poll->removed)
+               {
+                  lw_sync_release (ctx->sync_sq);
+
+                  free (poll);
+                  continue;
+               }
+
+            lw_sync_release (ctx->sync_sq);
+         }
+
+         if (poll->removed)
+            continue;
+
+         if (!more && cqe->res != -EBADF)
+         {
+            /* Single shot, or a multishot poll the kernel gave up on (e.g. if
+             * the CQ overflowed).  Either way, it needs adding again.
+             */
+            queue_poll_add (ctx, poll);
+         }
+
+         if (cqe->res == 0 || cqe->res == -ECANCELED)
+            continue;  /* nothing to report, and re-added above */
+
+         /* A failed poll is reported as an error and hangup on whatever was
+          * being watched, as epoll would, so the owner of the watch finds the
+          * error when it next reads or writes.
+          */
+         events [count].events = cqe->res > 0 ? cqe->res :
+               (poll->events | EPOLLERR | EPOLLHUP);
+         events [count].data.ptr = poll->tag;
+
+         ++ count;
+      }
+
+      __atomic_store_n (ctx->cq_head, head, __ATOMIC_RELEASE);
+
+      if (count > 0 || timeout != -1)
+      {
+         /* Single shot polls re-added above */
+         if (ctx->embedded)
+            flush_if_waiting (ctx);
+
+         return count;
+      }
+   }
+}
+
+#endif
+
@@ -0,0 +1,55 @@
+
+/* vim: set et ts=3 sw=3 sts=3 ft=c:
+ *
+ * Copyright (C) 2013 James McLaughlin.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* io_uring based readiness notification, used by epoll.c in place of the
+ * epoll fd when lwp_eventqueue_new_uring succeeds.  Registrations are queued
+ * in the submission ring and only submitted when the queue is next drained,
+ * so a batch of add/update calls costs a single io_uring_enter.
+ */
+
+typedef struct _lwp_uring * lwp_uring;
+
+lwp_uring lwp_uring_new ();
+void lwp_uring_delete (lwp_uring);
+
+int lwp_uring_fd (lwp_uring);
+
+/* Once the ring fd is being polled by someone else, nothing can be left
+ * waiting in the submission ring for the next drain.
+ */
+void lwp_uring_set_embedded (lwp_uring);
+
+void lwp_uring_add (lwp_uring, int fd, lw_bool read, lw_bool write,
+                    lw_bool edge_triggered, void * tag);
+
+void lwp_uring_remove (lwp_uring, int fd);
+
+int lwp_uring_drain (lwp_uring, long timeout, int max_events,
+                     struct epoll_event * events);
+
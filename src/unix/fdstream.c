@@ -29,6 +29,7 @@
 
 #include "../common.h"
 #include "fdstream.h"
+#include "eventpump.h"
 
 const static lw_streamdef def_fdstream;
 
@@ -88,6 +89,288 @@ static void write_ready (void * tag)
    lw_stream_retry ((lw_stream) tag, lw_stream_retry_now);
 }
 
+/* Touching a page of a mapping past the end of the file raises SIGBUS, so
+ * the file is checked before each slice.  This can't catch a truncation
+ * after the check (or one affecting slices already passed on), which is why
+ * files should be replaced by renaming a new one over them instead.
+ */
+
+static lw_bool map_truncated (lw_fdstream ctx, size_t size)
+{
+   struct stat st;
+
+   if (ctx->map_fd == -1 || fstat (ctx->map_fd, &st) == -1)
+      return lw_false;
+
+   return (size_t) st.st_size < ctx->map_offset + size;
+}
+
+/* Reading from a mapping pushes slices of it, which anything downstream can
+ * queue without copying.
+ */
+
+static void map_read (lw_fdstream ctx)
+{
+   ctx->flags |= lwp_fdstream_flag_reading;
+
+   lwp_retain (ctx, "fdstream map_read");
+
+   while (ctx->map && (ctx->reading_size == -1 || ctx->reading_size > 0))
+   {
+      if (lw_stream_is_paused ((lw_stream) ctx))
+         break;
+
+      size_t to_read = ctx->map->length - ctx->map_offset;
+
+      if (to_read > lwp_fdstream_map_chunk)
+         to_read = lwp_fdstream_map_chunk;
+
+      if (ctx->reading_size != -1 && to_read > ctx->reading_size)
+         to_read = ctx->reading_size;
+
+      if (to_read == 0)
+         break;
+
+      if (map_truncated (ctx, to_read))
+      {
+         lwp_trace ("fdstream %p: mapped file truncated at " lwp_fmt_size,
+                        ctx, ctx->map_offset);
+
+         lw_stream_close ((lw_stream) ctx, lw_true);
+         break;
+      }
+
+      const char * buffer = ctx->map->buffer + ctx->map_offset;
+
+      ctx->map_offset += to_read;
+
+      if (ctx->reading_size != -1)
+         ctx->reading_size -= to_read;
+
+      lwp_stream_data_ref ((lw_stream) ctx, ctx->map, buffer, to_read);
+
+      if (! (ctx->flags & lwp_fdstream_flag_reading))
+         break;
+   }
+
+   ctx->flags &= ~ lwp_fdstream_flag_reading;
+
+   lwp_release (ctx, "fdstream map_read");
+}
+
+/* Regular files are always read and write ready, so for an lw_file the reads
+ * and writes themselves run on the pump's worker pool, one at a time, and a
+ * slow disk only holds up that file rather than the whole pump.
+ */
+
+typedef struct _lwp_fdstream_op
+{
+   lw_fdstream ctx;
+
+   int fd;
+
+   lw_bool write;
+   lw_bool close_fd;  /* the stream was closed while this was running */
+
+   lwp_refbuffer ref;
+   size_t size;
+   off_t offset;
+
+   ssize_t result;
+   int error;
+
+} * lwp_fdstream_op;
+
+static void read_ready (void * tag);
+
+static void lw_callback op_run (void * param)
+{
+   lwp_fdstream_op op = param;
+   char * buffer = (char *) op->ref->buffer;
+
+   if (!op->write)
+   {
+      op->result = pread (op->fd, buffer, op->size, op->offset);
+      op->error = errno;
+
+      return;
+   }
+
+   /* The stream has already been told this was written, so all of it has to
+    * be.
+    */
+
+   size_t written = 0;
+
+   while (written < op->size)
+   {
+      ssize_t bytes = write (op->fd, buffer + written, op->size - written);
+
+      if (bytes == -1)
+      {
+         if (errno == EINTR)
+            continue;
+
+         op->result = -1;
+         op->error = errno;
+
+         return;
+      }
+
+      written += bytes;
+   }
+
+   op->result = written;
+}
+
+static void lw_callback op_done (void * param)
+{
+   lwp_fdstream_op op = param;
+   lw_fdstream ctx = op->ctx;
+
+   ctx->op = 0;
+
+   if (op->close_fd)
+      close (op->fd);
+
+   if (op->write)
+      ctx->stream.flags &= ~ lwp_stream_flag_writing;
+
+   if ((ctx->stream.flags & lwp_stream_flag_dead) || ctx->fd != op->fd)
+   {
+      /* Closed (or given another FD) while we were busy */
+   }
+   else if (op->write)
+   {
+      if (op->result == -1)
+      {
+         lwp_trace ("fdstream async write failed: %s", strerror (op->error));
+         lw_stream_close ((lw_stream) ctx, lw_true);
+      }
+      else
+      {
+         /* Anything that was queued meanwhile, and a close that was waiting
+          * for the write
+          */
+         lw_stream_retry ((lw_stream) ctx, lw_stream_retry_now);
+      }
+   }
+   else if (op->result <= 0)
+   {
+      lw_stream_close ((lw_stream) ctx, lw_true);
+   }
+   else
+   {
+      lseek (ctx->fd, op->result, SEEK_CUR);
+
+      if (ctx->reading_size != -1)
+      {
+         if (op->result > ctx->reading_size)
+            ctx->reading_size = 0;
+         else
+            ctx->reading_size -= op->result;
+      }
+
+      lwp_stream_data_ref ((lw_stream) ctx, op->ref,
+                           op->ref->buffer, op->result);
+   }
+
+   if ((! (ctx->stream.flags & lwp_stream_flag_dead))
+         && ctx->reading_size != 0)
+   {
+      read_ready (ctx);
+   }
+
+   lwp_refbuffer_release (op->ref);
+   free (op);
+
+   lwp_release (ctx, "fdstream op");
+}
+
+/* Returns the op running, or 0 if it couldn't be started (in which case the
+ * caller should fall back to doing it here).
+ */
+
+static lwp_fdstream_op op_start (lw_fdstream ctx, lw_bool write,
+                                 const lw_iovec * vec, int count)
+{
+   lwp_fdstream_op op = calloc (sizeof (*op), 1);
+
+   if (!op)
+      return 0;
+
+   size_t size = lwp_default_buffer_size;
+
+   if (write)
+   {
+      size_t total = 0;
+
+      for (int i = 0; i < count; ++ i)
+         total += vec [i].length;
+
+      if (total < size)
+         size = total;
+   }
+   else if (ctx->reading_size != -1 && size > ctx->reading_size)
+      size = ctx->reading_size;
+
+   if (! (op->ref = lwp_refbuffer_new_pooled (size)))
+   {
+      free (op);
+      return 0;
+   }
+
+   if (size > op->ref->length)
+      size = op->ref->length;
+
+   op->ctx = ctx;
+   op->fd = ctx->fd;
+   op->write = write;
+   op->size = size;
+
+   if (write)
+   {
+      char * dest = (char *) op->ref->buffer;
+
+      for (int i = 0; i < count && size > 0; ++ i)
+      {
+         size_t length = vec [i].length;
+
+         if (length > size)
+            length = size;
+
+         memcpy (dest, vec [i].buffer, length);
+
+         dest += length;
+         size -= length;
+      }
+   }
+   else
+      op->offset = lseek (ctx->fd, 0, SEEK_CUR);
+
+   ctx->op = op;
+
+   lwp_retain (ctx, "fdstream op");
+
+   if (!lw_pump_post_work (lw_stream_pump ((lw_stream) ctx),
+                           op_run, op_done, op))
+   {
+      ctx->op = 0;
+
+      lwp_release (ctx, "fdstream op");
+
+      lwp_refbuffer_release (op->ref);
+      free (op);
+
+      return 0;
+   }
+
+   if (write)
+      ctx->stream.flags |= lwp_stream_flag_writing;
+
+   return op;
+}
+
 static void read_ready (void * tag)
 {
    lw_fdstream ctx = tag;
@@ -95,6 +378,46 @@ static void read_ready (void * tag)
    if (ctx->flags & lwp_fdstream_flag_reading)
       return;
 
+   if (ctx->map)
+   {
+      map_read (ctx);
+      return;
+   }
+
+   if (ctx->flags & lwp_fdstream_flag_async)
+   {
+      if (ctx->op)
+         return; /* op_done will carry on */
+
+      if (ctx->fd == -1 || ctx->reading_size == 0
+            || lw_stream_is_paused ((lw_stream) ctx))
+      {
+         return;
+      }
+
+      if (op_start (ctx, lw_false, 0, 0))
+         return;
+   }
+
+   #ifdef HAVE_SPLICE
+
+      /* If we're being spliced into another stream, nothing is going to read
+       * from us - new data just means the splice can carry on.
+       */
+
+      if (ctx->reading_size == 0)
+      {
+         lw_stream target = lwp_stream_direct_target ((lw_stream) ctx);
+
+         if (target)
+         {
+            lw_stream_retry (target, lw_stream_retry_now);
+            return;
+         }
+      }
+
+   #endif
+
    ctx->flags |= lwp_fdstream_flag_reading;
 
    lwp_retain (ctx, "fdstream read_ready");
@@ -110,12 +433,47 @@ static void read_ready (void * tag)
       if (ctx->fd == -1)
          break;
 
+      /* Leave the data in the FD until whatever we're writing to has room
+       * (def_resume_read will be called)
+       */
+      if (lw_stream_is_paused ((lw_stream) ctx))
+         break;
+
       size_t to_read = sizeof (buffer);
 
       if (ctx->reading_size != -1 && to_read > ctx->reading_size)
          to_read = ctx->reading_size;
 
-      int bytes = read (ctx->fd, buffer, to_read);
+      char * dest = buffer;
+      lwp_refbuffer ref = 0;
+
+      if (ctx->flags & lwp_fdstream_flag_pooled_read)
+      {
+         /* Size the buffer by how much is waiting, so that small reads
+          * don't each hold on to a big buffer.
+          */
+
+         int waiting;
+
+         if (ioctl (ctx->fd, FIONREAD, &waiting) == 0
+               && waiting > 0 && waiting < to_read)
+         {
+            to_read = waiting;
+         }
+
+         if ((ref = lwp_refbuffer_new_pooled (to_read)))
+         {
+            dest = (char *) ref->buffer;
+
+            if (ref->length < to_read)
+               to_read = ref->length;
+         }
+      }
+
+      int bytes = read (ctx->fd, dest, to_read);
+
+      if (bytes <= 0 && ref)
+         lwp_refbuffer_release (ref);
 
       if (bytes == 0)
       {
@@ -140,7 +498,10 @@ static void read_ready (void * tag)
             ctx->reading_size -= bytes;
       }
 
-      lw_stream_data ((lw_stream) ctx, buffer, bytes);
+      lwp_stream_data_ref ((lw_stream) ctx, ref, dest, bytes);
+
+      if (ref)
+         lwp_refbuffer_release (ref);
 
       /* Calling Data or Close may result in destruction of the Stream -
        * see FDStream destructor.
@@ -171,7 +532,16 @@ void lw_fdstream_set_fd (lw_fdstream ctx, lw_fd fd, lw_pump_watch watch,
    if ( (ctx->flags & lwp_fdstream_flag_autoclose) && ctx->fd != -1)
       lw_stream_close ((lw_stream) ctx, lw_true);
 
+   if (ctx->map)
+   {
+      lwp_refbuffer_release (ctx->map);
+
+      ctx->map = 0;
+      ctx->map_fd = -1;
+   }
+
    ctx->fd = fd;
+   ctx->flags &= ~ lwp_fdstream_flag_splice_eof;
 
    if (auto_close)
       ctx->flags |= lwp_fdstream_flag_autoclose;
@@ -199,6 +569,8 @@ void lw_fdstream_set_fd (lw_fdstream ctx, lw_fd fd, lw_pump_watch watch,
    if (S_ISSOCK (stat.st_mode))
    {
       ctx->flags |= lwp_fdstream_flag_is_socket;
+
+      lwp_eventpump_busy_poll_socket (lw_stream_pump ((lw_stream) ctx), fd);
    }
    else
    {
@@ -237,11 +609,23 @@ void lw_fdstream_set_fd (lw_fdstream ctx, lw_fd fd, lw_pump_watch watch,
 
 lw_bool lw_fdstream_valid (lw_fdstream ctx)
 {
-   return ctx->fd != -1;
+   return ctx->fd != -1 || ctx->map;
+}
+
+void lwp_fdstream_set_map (lw_fdstream ctx, lwp_refbuffer map, int map_fd)
+{
+   lw_fdstream_set_fd (ctx, -1, 0, lw_false);
+
+   ctx->map = map;
+   ctx->map_fd = map_fd;
+   ctx->map_offset = 0;
+   ctx->size = map->length;
 }
 
 void lw_fdstream_cork (lw_fdstream ctx)
 {
+   ctx->flags &= ~ lwp_fdstream_flag_uncork_pending;
+
    #ifdef lw_cork
       int enabled = 1;
       setsockopt (((lw_fdstream) ctx)->fd, IPPROTO_TCP,
@@ -251,6 +635,17 @@ void lw_fdstream_cork (lw_fdstream ctx)
 
 void lw_fdstream_uncork (lw_fdstream ctx)
 {
+   /* With auto-cork, whatever was written while corked hasn't gone out yet.
+    * Uncorking now would send it in pieces (e.g. the headers written ahead
+    * of a file body in their own segment), so cork_flush does it instead.
+    */
+
+   if (ctx->flags & lwp_fdstream_flag_cork_pending)
+   {
+      ctx->flags |= lwp_fdstream_flag_uncork_pending;
+      return;
+   }
+
    #ifdef lw_cork
       int enabled = 0;
       setsockopt (((lw_fdstream) ctx)->fd, IPPROTO_TCP,
@@ -272,12 +667,318 @@ void lw_fdstream_nagle (lw_fdstream ctx, lw_bool enabled)
    }
 }
 
+void lw_fdstream_pooled_read (lw_fdstream ctx, lw_bool enabled)
+{
+   if (enabled)
+      ctx->flags |= lwp_fdstream_flag_pooled_read;
+   else
+      ctx->flags &= ~ lwp_fdstream_flag_pooled_read;
+}
+
+void lw_fdstream_auto_cork (lw_fdstream ctx, lw_bool enabled)
+{
+   if (enabled)
+      ctx->flags |= lwp_fdstream_flag_auto_cork;
+   else
+      ctx->flags &= ~ lwp_fdstream_flag_auto_cork;
+}
+
+/* Returns true if anything upstream has a known amount left to send, such as
+ * a file being read on the worker pool.
+ */
+
+static lw_bool body_pending (lw_stream stream, int depth)
+{
+   if (depth > lwp_stream_max_graph_depth)
+      return lw_false;
+
+   for (int i = 0; i < stream->prev_expanded.length; ++ i)
+   {
+      lw_stream prev =
+         ((lwp_streamgraph_link) stream->prev_expanded.items [i])->from_exp;
+
+      if (!prev)
+         continue;
+
+      size_t bytes_left = lw_stream_bytes_left (prev);
+
+      if ((bytes_left != -1 && bytes_left > 0) || body_pending (prev, depth + 1))
+         return lw_true;
+   }
+
+   return lw_false;
+}
+
+/* Posted by a cork_flush with lw_fdstream_uncork pending.  A body read from
+ * a file arrives in a later tick (and is held for another flush, which posts
+ * this again), so the socket stays corked until the body is out.
+ */
+
+static void cork_uncork (lw_fdstream ctx)
+{
+   if ((! (ctx->stream.flags & lwp_stream_flag_dead))
+         && (ctx->flags & lwp_fdstream_flag_uncork_pending)
+         && ! (ctx->flags & lwp_fdstream_flag_cork_pending)
+         && !body_pending ((lw_stream) ctx, 0))
+   {
+      ctx->flags &= ~ lwp_fdstream_flag_uncork_pending;
+      lw_fdstream_uncork (ctx);
+   }
+
+   lwp_release (ctx, "fdstream cork_uncork");
+}
+
+/* Posted by the first write held back in a tick, so that it runs once the
+ * pump has finished dispatching.  Everything held will be in the queues, which
+ * write_queue_vec gathers into one writev.
+ */
+
+static void cork_flush (lw_fdstream ctx)
+{
+   ctx->flags &= ~ lwp_fdstream_flag_cork_pending;
+
+   if (! (ctx->stream.flags & lwp_stream_flag_dead))
+   {
+      ctx->flags |= lwp_fdstream_flag_cork_flushing;
+
+      lw_stream_retry ((lw_stream) ctx, lw_stream_retry_now);
+
+      ctx->flags &= ~ lwp_fdstream_flag_cork_flushing;
+
+      if (ctx->flags & lwp_fdstream_flag_uncork_pending)
+      {
+         lwp_retain (ctx, "fdstream cork_uncork");
+         lw_pump_post (lw_stream_pump ((lw_stream) ctx), cork_uncork, ctx);
+      }
+   }
+
+   lwp_release (ctx, "fdstream cork_flush");
+}
+
+/* Returns true if a write should be left in the queues for cork_flush */
+
+static lw_bool cork_hold (lw_fdstream ctx)
+{
+   if ((! (ctx->flags & lwp_fdstream_flag_auto_cork))
+         || (ctx->flags & lwp_fdstream_flag_cork_flushing))
+   {
+      return lw_false;
+   }
+
+   if (! (ctx->flags & lwp_fdstream_flag_cork_pending))
+   {
+      ctx->flags |= lwp_fdstream_flag_cork_pending;
+
+      lwp_retain (ctx, "fdstream cork_flush");
+
+      lw_pump_post (lw_stream_pump ((lw_stream) ctx), cork_flush, ctx);
+   }
+
+   return lw_true;
+}
+
+#ifdef HAVE_SPLICE
+
+/* Most servers ignore SIGPIPE, in which case there's no need to hold it back
+ * around splice.  The disposition is only looked at once, so as not to add a
+ * system call to every flush.
+ */
+
+static lw_bool sigpipe_ignored (void)
+{
+   static int ignored = -1;
+
+   int result = __atomic_load_n (&ignored, __ATOMIC_RELAXED);
+
+   if (result == -1)
+   {
+      struct sigaction action;
+
+      result = sigaction (SIGPIPE, 0, &action) == 0
+                  && action.sa_handler == SIG_IGN;
+
+      __atomic_store_n (&ignored, result, __ATOMIC_RELAXED);
+   }
+
+   return result;
+}
+
+/* Moves anything left in the splice pipe out to the socket.  Returns false if
+ * some of it is still waiting for the socket to become writable.
+ */
+
+static lw_bool splice_flush (lw_fdstream ctx)
+{
+   if (ctx->splice_pending == 0)
+      return lw_true;
+
+   /* Unlike send, splice has no MSG_NOSIGNAL, so unless it's ignored anyway,
+    * SIGPIPE is held back while writing to the socket and swallowed if it
+    * was ours.
+    */
+
+   lw_bool hold_sigpipe = !sigpipe_ignored ();
+
+   sigset_t sigpipe, pending, old_mask;
+   lw_bool was_pending = lw_false;
+
+   if (hold_sigpipe)
+   {
+      sigemptyset (&sigpipe);
+      sigaddset (&sigpipe, SIGPIPE);
+
+      sigpending (&pending);
+      was_pending = sigismember (&pending, SIGPIPE);
+
+      pthread_sigmask (SIG_BLOCK, &sigpipe, &old_mask);
+   }
+
+   while (ctx->splice_pending > 0)
+   {
+      ssize_t moved = splice (ctx->splice_pipe [0], 0, ctx->fd, 0,
+                              ctx->splice_pending,
+                              SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+      if (moved <= 0)
+      {
+         if (moved == -1 && errno == EPIPE && hold_sigpipe && !was_pending)
+         {
+            struct timespec zero = { 0 };
+            sigtimedwait (&sigpipe, 0, &zero);
+         }
+
+         break;
+      }
+
+      ctx->splice_pending -= moved;
+   }
+
+   if (hold_sigpipe)
+      pthread_sigmask (SIG_SETMASK, &old_mask, 0);
+
+   return ctx->splice_pending == 0;
+}
+
+static void splice_eof (lw_fdstream ctx)
+{
+   if (! (ctx->stream.flags & lwp_stream_flag_dead))
+      lw_stream_close ((lw_stream) ctx, lw_true);
+
+   lwp_release (ctx, "fdstream splice_eof");
+}
+
+/* Shifts data from a socket or pipe to a socket through splice_pipe, so that
+ * it never has to be copied in and out of userspace.
+ */
+
+static size_t splice_stream (lw_fdstream dest, lw_fdstream source,
+                             size_t size)
+{
+   if (! (dest->flags & lwp_fdstream_flag_is_socket) || dest->fd == -1)
+      return -1;
+
+   if (source->fd == -1 || (source->flags & lwp_fdstream_flag_splice_eof))
+      return 0;
+
+   if (lwp_stream_is_filtered ((lw_stream) source)
+         || lwp_stream_is_filtered ((lw_stream) dest))
+   {
+      return -1;
+   }
+
+   if (dest->splice_pipe [0] == -1)
+   {
+      if (pipe2 (dest->splice_pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+      {
+         dest->splice_pipe [0] = dest->splice_pipe [1] = -1;
+         return -1;
+      }
+   }
+
+   size_t total = 0;
+
+   for (;;)
+   {
+      if (!splice_flush (dest))
+         break;
+
+      size_t to_move = lwp_default_buffer_size * 16;
+
+      if (size != -1 && to_move > size - total)
+         to_move = size - total;
+
+      if (to_move == 0)
+         break;
+
+      ssize_t moved = splice (source->fd, 0, dest->splice_pipe [1], 0,
+                              to_move, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+      if (moved == -1 && errno == EAGAIN)
+         break;
+
+      if (moved == -1 && errno == EINVAL && total == 0)
+      {
+         /* Not something splice can read from */
+
+         return dest->splice_pending > 0 ? 0 : -1;
+      }
+
+      if (moved <= 0)
+      {
+         /* EOF or error.  The source can't be closed from in here (we're in
+          * the middle of writing it), so leave it for the pump.
+          */
+
+         source->flags |= lwp_fdstream_flag_splice_eof;
+
+         lwp_retain (source, "fdstream splice_eof");
+
+         lw_pump_post (lw_stream_pump ((lw_stream) source),
+                       splice_eof, source);
+
+         break;
+      }
+
+      dest->splice_pending += moved;
+      total += moved;
+   }
+
+   lwp_trace ("spliced " lwp_fmt_size " bytes, " lwp_fmt_size " pending",
+                  total, dest->splice_pending);
+
+   return total;
+}
+
+#endif
+
 static size_t def_sink_data (lw_stream stream, const char * buffer, size_t size)
 {
    lw_fdstream ctx = (lw_fdstream) stream;
 
    lwp_trace ("fdstream sink " lwp_fmt_size " bytes", size);
 
+   if (cork_hold (ctx))
+      return 0;
+
+   if (ctx->flags & lwp_fdstream_flag_async)
+   {
+      /* Anything we can't take yet is queued until op_done retries */
+
+      if (ctx->op)
+         return 0;
+
+      lw_iovec vec = { buffer, size };
+      lwp_fdstream_op op = op_start (ctx, lw_true, &vec, 1);
+
+      if (op)
+         return op->size;
+   }
+
+   #ifdef HAVE_SPLICE
+      if (!splice_flush (ctx))
+         return 0;
+   #endif
+
    size_t written;
 
    #ifdef HAVE_DECL_SO_NOSIGPIPE
@@ -301,6 +1002,70 @@ static size_t def_sink_data (lw_stream stream, const char * buffer, size_t size)
    return written;
 }
 
+static size_t def_sink_data_vec (lw_stream stream, const lw_iovec * vec,
+                                 int count)
+{
+   lw_fdstream ctx = (lw_fdstream) stream;
+
+   lwp_trace ("fdstream sink %d buffers", count);
+
+   if (cork_hold (ctx))
+      return 0;
+
+   if (ctx->flags & lwp_fdstream_flag_async)
+   {
+      if (ctx->op)
+         return 0;
+
+      lwp_fdstream_op op = op_start (ctx, lw_true, vec, count);
+
+      if (op)
+         return op->size;
+   }
+
+   #ifdef HAVE_SPLICE
+      if (!splice_flush (ctx))
+         return 0;
+   #endif
+
+   if (count > IOV_MAX)
+      count = IOV_MAX;
+
+   struct iovec iov [count];
+
+   for (int i = 0; i < count; ++ i)
+   {
+      iov [i].iov_base = (void *) vec [i].buffer;
+      iov [i].iov_len = vec [i].length;
+   }
+
+   size_t written;
+
+   #ifdef HAVE_DECL_SO_NOSIGPIPE
+      written = writev (ctx->fd, iov, count);
+   #else
+      if (ctx->flags & lwp_fdstream_flag_is_socket)
+      {
+         struct msghdr msg = {};
+
+         msg.msg_iov = iov;
+         msg.msg_iovlen = count;
+
+         written = sendmsg (ctx->fd, &msg, MSG_NOSIGNAL);
+      }
+      else
+         written = writev (ctx->fd, iov, count);
+   #endif
+
+   if (written == -1)
+   {
+      lwp_trace ("fdstream sank nothing!  writev failed: %d", errno);
+      return 0;
+   }
+
+   return written;
+}
+
 static size_t def_sink_stream (lw_stream _dest,
                                lw_stream _src,
                                size_t size)
@@ -308,6 +1073,31 @@ static size_t def_sink_stream (lw_stream _dest,
    if (lw_stream_get_def (_src) != &def_fdstream)
       return -1;
 
+   lw_fdstream source = (lw_fdstream) _src;
+   lw_fdstream dest = (lw_fdstream) _dest;
+
+   if (source->map)
+      return -1; /* reading it is already free */
+
+   /* Writing to an async file goes through the worker pool.  Reading one
+    * into a socket is still best done with sendfile, which saves copying
+    * it through a buffer, unless a read is already running on the pool.
+    */
+
+   if (dest->flags & lwp_fdstream_flag_async)
+      return -1;
+
+   if ((source->flags & lwp_fdstream_flag_async)
+         && (source->op || ! (dest->flags & lwp_fdstream_flag_is_socket)))
+   {
+      return -1;
+   }
+
+   #ifdef HAVE_SPLICE
+      if (source->size == -1)
+         return splice_stream (dest, source, size);
+   #endif
+
    if (size == -1)
    {
       size = lw_stream_bytes_left (_src);
@@ -316,9 +1106,6 @@ static size_t def_sink_stream (lw_stream _dest,
          return -1;
    }
 
-   lw_fdstream source = (lw_fdstream) _src;
-   lw_fdstream dest = (lw_fdstream) _dest;
-
    lw_i64 sent = lwp_sendfile (source->fd, dest->fd, size);
 
    lwp_trace ("lwp_sendfile sent " lwp_fmt_size " of " lwp_fmt_size,
@@ -355,6 +1142,9 @@ static size_t def_bytes_left (lw_stream _ctx)
 {
    lw_fdstream ctx = (lw_fdstream) _ctx;
 
+   if (ctx->map)
+      return ctx->map->length - ctx->map_offset;
+
    if (ctx->fd == -1)
       return -1; /* not valid */
 
@@ -390,23 +1180,58 @@ static lw_bool def_close (lw_stream stream_ctx, lw_bool immediate)
 
    ctx->fd = -1;
 
+   if (ctx->map)
+   {
+      lwp_refbuffer_release (ctx->map);
+
+      ctx->map = 0;
+      ctx->map_fd = -1;
+   }
+
    if (fd != -1)
    {
-      if (ctx->flags & lwp_fdstream_flag_autoclose)
+      if (ctx->op && ctx->op->fd == fd)
+      {
+         /* Still in use by the worker - op_done will close it */
+
+         ctx->op->close_fd = (ctx->flags & lwp_fdstream_flag_autoclose) != 0;
+      }
+      else if (ctx->flags & lwp_fdstream_flag_autoclose)
       {
          shutdown (fd, SHUT_RDWR);
          close (fd);
       }
    }
 
+   #ifdef HAVE_SPLICE
+      if (ctx->splice_pipe [0] != -1)
+      {
+         close (ctx->splice_pipe [0]);
+         close (ctx->splice_pipe [1]);
+
+         ctx->splice_pipe [0] = ctx->splice_pipe [1] = -1;
+         ctx->splice_pending = 0;
+      }
+   #endif
+
    lwp_release (ctx, "fdstream close");
 
    return lw_true;
 }
 
+static void def_resume_read (lw_stream _ctx)
+{
+   lw_fdstream ctx = (lw_fdstream) _ctx;
+
+   if (ctx->reading_size != 0)
+      read_ready (ctx);
+}
+
 const static lw_streamdef def_fdstream =
 {
    .sink_data    = def_sink_data,
+   .sink_data_vec = def_sink_data_vec,
+   .resume_read  = def_resume_read,
    .sink_stream  = def_sink_stream,
    .close        = def_close,
    .bytes_left   = def_bytes_left,
@@ -418,9 +1243,13 @@ void lwp_fdstream_init (lw_fdstream ctx, lw_pump pump)
 {
    memset (ctx, 0, sizeof (*ctx));
 
-   ctx->fd = -1;
+   ctx->fd = ctx->map_fd = -1;
    ctx->flags = lwp_fdstream_flag_nagle;
 
+   #ifdef HAVE_SPLICE
+      ctx->splice_pipe [0] = ctx->splice_pipe [1] = -1;
+   #endif
+
    lwp_stream_init (&ctx->stream, &def_fdstream, pump);
 }
 
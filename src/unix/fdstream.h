@@ -40,19 +40,72 @@ struct _lw_fdstream
 
    int fd;
 
-   char flags;
+   int flags;
 
    size_t size;
    size_t reading_size;
+
+   #ifdef HAVE_SPLICE
+
+      /* Used to splice from another socket or pipe into this one.  Anything
+       * in splice_pipe has already been taken from the source.
+       */
+
+      int splice_pipe [2];
+      size_t splice_pending;
+
+   #endif
+
+   /* For an lw_file opened in mmap mode: the mapping, which is read from
+    * instead of fd (there isn't one), and how far into it we've got.  If
+    * map_fd isn't -1, it's the mapped file, checked for truncation before
+    * each slice is read.
+    */
+
+   lwp_refbuffer map;
+   size_t map_offset;
+   int map_fd;
+
+   /* For an lw_file: the read or write running on the pump's worker pool, if
+    * any (there's only ever one at a time)
+    */
+
+   struct _lwp_fdstream_op * op;
 };
 
 #define lwp_fdstream_flag_nagle       1
 #define lwp_fdstream_flag_is_socket   2
 #define lwp_fdstream_flag_autoclose   4
 #define lwp_fdstream_flag_reading     8
+#define lwp_fdstream_flag_pooled_read 16
+#define lwp_fdstream_flag_splice_eof  32
+
+/* lw_fdstream_auto_cork: writes are being held for a cork_flush that has
+ * been posted, and cork_flush is now writing them.
+ */
+#define lwp_fdstream_flag_auto_cork      64
+#define lwp_fdstream_flag_cork_pending   128
+#define lwp_fdstream_flag_cork_flushing  256
+
+/* Reads and writes go through the worker pool (see lwp_fdstream_op) */
+#define lwp_fdstream_flag_async          512
+
+/* lw_fdstream_uncork was called with writes held for cork_flush, so the
+ * socket stays corked until they've gone out (see cork_uncork).
+ */
+#define lwp_fdstream_flag_uncork_pending 1024
+
+/* The most of a mapping map_read passes on at once */
+#define lwp_fdstream_map_chunk  (lwp_default_buffer_size * 4)
 
 void lwp_fdstream_init (lw_fdstream, lw_pump);
 
+/* Takes over a reference to map, closing any FD.  map_fd stays owned by the
+ * caller, and has to stay open for as long as the mapping does.
+ */
+
+void lwp_fdstream_set_map (lw_fdstream, lwp_refbuffer map, int map_fd);
+
 #endif
 
 
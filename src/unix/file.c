@@ -30,6 +30,8 @@
 #include "../common.h"
 #include "fdstream.h"
 
+#include <sys/mman.h>
+
 struct _lw_file
 {
     struct _lw_fdstream fdstream;
@@ -37,6 +39,290 @@ struct _lw_file
     char name [lwp_max_path];
 };
 
+/* Files opened in mmap mode share their mappings through a process-wide
+ * cache, keyed by path and checked against the inode, mtime and size at most
+ * once every lwp_file_cache_check_ms.  Only files up to
+ * lwp_file_cache_max_file are cached, and those are read into the heap
+ * rather than mapped, so truncating one can't make a read fault.  Anything
+ * bigger gets a mapping of its own, and keeps the file open so that map_read
+ * can check it hasn't been truncated.
+ *
+ * A mapping stays valid if the file is replaced by renaming another over it
+ * (the old inode lives on until it's unmapped), but truncating it in place
+ * makes reads past the new end fault with SIGBUS.
+ */
+
+#define lwp_file_cache_check_ms   1000
+#define lwp_file_cache_max_file   (1024 * 1024)
+
+typedef struct _lwp_file_mapping
+{
+   char * path;
+
+   dev_t dev;
+   ino_t ino;
+   time_t mtime;
+
+   void * data;
+   size_t length;
+
+   int fd;  /* -1 for a cached copy, which data was malloc'd for */
+
+   /* One for the cache (while the mapping is in it), and one for each open
+    * lw_file
+    */
+   long refcount;
+
+   lw_i64 checked;
+
+   UT_hash_handle hh;
+
+} * lwp_file_mapping;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static lwp_file_mapping cache = 0;
+static size_t cache_size = 0, cache_limit = 1024 * 1024 * 64;
+
+/* Must be called with cache_lock held */
+
+static void mapping_release (lwp_file_mapping mapping)
+{
+   if (-- mapping->refcount > 0)
+      return;
+
+   if (mapping->fd != -1)
+   {
+      munmap (mapping->data, mapping->length);
+      close (mapping->fd);
+   }
+   else
+      free (mapping->data);
+
+   free (mapping->path);
+   free (mapping);
+}
+
+static void cache_remove (lwp_file_mapping mapping)
+{
+   HASH_DELETE (hh, cache, mapping);
+
+   cache_size -= mapping->length;
+
+   mapping_release (mapping);
+}
+
+/* Evicts the least recently used mappings until there's room for size more
+ * bytes.  The hash keeps insertion order, and a mapping is re-inserted each
+ * time it's used, so they're at the front.
+ */
+
+static void cache_trim (size_t size)
+{
+   while (cache && cache_size + size > cache_limit)
+      cache_remove (cache);
+}
+
+static void lw_callback file_unmapped (void * tag)
+{
+   pthread_mutex_lock (&cache_lock);
+
+      mapping_release ((lwp_file_mapping) tag);
+
+   pthread_mutex_unlock (&cache_lock);
+}
+
+/* Reads a small file for the cache.  If it's been truncated since the
+ * fstat, size is updated to what was actually read.
+ */
+
+static void * read_file (int fd, off_t * size)
+{
+   char * data = malloc (*size);
+
+   if (!data)
+      return 0;
+
+   off_t offset = 0;
+
+   while (offset < *size)
+   {
+      ssize_t bytes = read (fd, data + offset, *size - offset);
+
+      if (bytes == -1 && errno == EINTR)
+         continue;
+
+      if (bytes <= 0)
+         break;
+
+      offset += bytes;
+   }
+
+   if (offset == 0)
+   {
+      free (data);
+      return 0;
+   }
+
+   *size = offset;
+
+   return data;
+}
+
+static lwp_file_mapping map_file (const char * filename, struct stat * st)
+{
+   int fd = open (filename, O_RDONLY);
+
+   if (fd == -1)
+      return 0;
+
+   if (fstat (fd, st) == -1 || !S_ISREG (st->st_mode) || st->st_size == 0)
+   {
+      close (fd);
+      return 0;
+   }
+
+   void * data;
+
+   if (st->st_size <= lwp_file_cache_max_file)
+   {
+      data = read_file (fd, &st->st_size);
+
+      close (fd);
+      fd = -1;
+
+      if (!data)
+         return 0;
+   }
+   else
+   {
+      data = mmap (0, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (data == MAP_FAILED)
+      {
+         close (fd);
+         return 0;
+      }
+   }
+
+   lwp_file_mapping mapping = calloc (sizeof (*mapping), 1);
+
+   if ( (!mapping) || ! (mapping->path = strdup (filename)))
+   {
+      free (mapping);
+
+      if (fd != -1)
+      {
+         munmap (data, st->st_size);
+         close (fd);
+      }
+      else
+         free (data);
+
+      return 0;
+   }
+
+   mapping->fd = fd;
+
+   mapping->dev = st->st_dev;
+   mapping->ino = st->st_ino;
+   mapping->mtime = st->st_mtime;
+
+   mapping->data = data;
+   mapping->length = st->st_size;
+
+   mapping->refcount = 1;
+
+   return mapping;
+}
+
+/* Returns a mapping of the file with a reference for the caller, or 0 if it
+ * can't be mapped.
+ */
+
+static lwp_file_mapping get_mapping (const char * filename)
+{
+   lw_i64 now = lwp_time_ms ();
+
+   struct stat st;
+   lwp_file_mapping mapping;
+
+   pthread_mutex_lock (&cache_lock);
+
+   HASH_FIND_STR (cache, filename, mapping);
+
+   if (mapping && now - mapping->checked >= lwp_file_cache_check_ms)
+   {
+      if (stat (filename, &st) == 0
+            && st.st_dev == mapping->dev && st.st_ino == mapping->ino
+            && st.st_mtime == mapping->mtime && st.st_size == mapping->length)
+      {
+         mapping->checked = now;
+      }
+      else
+      {
+         cache_remove (mapping);
+         mapping = 0;
+      }
+   }
+
+   if (mapping)
+   {
+      HASH_DELETE (hh, cache, mapping);
+      HASH_ADD_KEYPTR (hh, cache, mapping->path, strlen (mapping->path), mapping);
+
+      ++ mapping->refcount;
+
+      pthread_mutex_unlock (&cache_lock);
+
+      return mapping;
+   }
+
+   pthread_mutex_unlock (&cache_lock);
+
+   /* Not cached (or out of date), so map it without holding the lock */
+
+   if (! (mapping = map_file (filename, &st)))
+      return 0;
+
+   if (mapping->length > lwp_file_cache_max_file)
+      return mapping;
+
+   pthread_mutex_lock (&cache_lock);
+
+   if (mapping->length <= cache_limit)
+   {
+      lwp_file_mapping existing;
+      HASH_FIND_STR (cache, filename, existing);
+
+      if (existing)
+         cache_remove (existing);
+
+      cache_trim (mapping->length);
+
+      HASH_ADD_KEYPTR (hh, cache, mapping->path, strlen (mapping->path), mapping);
+
+      mapping->checked = now;
+      ++ mapping->refcount;
+
+      cache_size += mapping->length;
+   }
+
+   pthread_mutex_unlock (&cache_lock);
+
+   return mapping;
+}
+
+void lw_file_set_cache_size (size_t bytes)
+{
+   pthread_mutex_lock (&cache_lock);
+
+      cache_limit = bytes;
+      cache_trim (0);
+
+   pthread_mutex_unlock (&cache_lock);
+}
+
 void lwp_file_init (lw_file ctx, lw_pump pump)
 {
    *ctx->name = 0;
@@ -70,7 +356,7 @@ lw_file lw_file_new_open (lw_pump pump,
    return ctx;
 }
 
-static int get_flags (const char * mode)
+static int get_flags (const char * mode, lw_bool * mapped)
 {
    /* Based on what FreeBSD does to convert the mode string for fopen(3) */
 
@@ -114,6 +400,12 @@ static int get_flags (const char * mode)
       flags |= O_EXCL;
    }
 
+   /* As with glibc's fopen, 'm' asks for the file to be mmapped (which only
+    * makes sense for reading)
+    */
+
+   *mapped = flags == O_RDONLY && strchr (mode, 'm');
+
    return flags;
 }
 
@@ -125,7 +417,8 @@ lw_bool lw_file_open (lw_file ctx,
 
     *ctx->name = 0;
 
-    int flags = get_flags (mode);
+    lw_bool mapped;
+    int flags = get_flags (mode, &mapped);
 
     if (flags == -1)
     {
@@ -133,6 +426,30 @@ lw_bool lw_file_open (lw_file ctx,
         return lw_false;
     }
 
+    if (mapped && strlen (filename) < lwp_max_path)
+    {
+        lwp_file_mapping mapping = get_mapping (filename);
+
+        lwp_refbuffer map = mapping ?
+           lwp_refbuffer_new (mapping->data, mapping->length,
+                              file_unmapped, mapping) : 0;
+
+        if (map)
+        {
+            lwp_fdstream_set_map ((lw_fdstream) ctx, map, mapping->fd);
+
+            strcpy (ctx->name, filename);
+            return lw_true;
+        }
+
+        if (mapping)
+           file_unmapped (mapping);
+
+        /* Can't be mapped (e.g. empty, or not a regular file), so open it
+         * as normal.
+         */
+    }
+
     int fd = open (filename, flags, S_IRWXU);
 
     if (fd == -1)
@@ -143,6 +460,15 @@ lw_bool lw_file_open (lw_file ctx,
 
     lw_fdstream_set_fd ((lw_fdstream) ctx, fd, 0, lw_true);
 
+    /* A regular file never blocks as far as the pump is concerned, so the
+     * reads and writes go to the worker pool instead.
+     */
+
+    if (ctx->fdstream.size != -1)
+       ctx->fdstream.flags |= lwp_fdstream_flag_async;
+    else
+       ctx->fdstream.flags &= ~ lwp_fdstream_flag_async;
+
     if (lw_fdstream_valid ((lw_fdstream) ctx))
     {
         strcpy (ctx->name, filename);
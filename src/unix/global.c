@@ -53,6 +53,14 @@ void lwp_init ()
    #endif
 }
 
+lw_i64 lwp_time_ms ()
+{
+   struct timespec now;
+   clock_gettime (CLOCK_MONOTONIC, &now);
+
+   return ((lw_i64) now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
 lw_bool lw_file_exists (const char * filename)
 {
    struct stat attr;
@@ -36,6 +36,7 @@
 #include "../address.h"
 
 #include "fdstream.h"
+#include "eventpump.h"
 
 static void on_client_close (lw_stream, void * tag);
 
@@ -51,6 +52,7 @@ struct _lw_server
    int socket; 
 
    lw_pump pump;
+   lw_pump_watch pump_watch;
     
    lw_server_hook_connect on_connect;
    lw_server_hook_disconnect on_disconnect;
@@ -59,6 +61,8 @@ struct _lw_server
 
    void * tag;
 
+   size_t send_rate, receive_rate, rate_burst;
+
    #ifdef ENABLE_SSL
       SSL_CTX * ssl_context;
       char ssl_passphrase [128];
@@ -68,6 +72,12 @@ struct _lw_server
       #endif
    #endif
 
+   /* With a threaded pump, clients are spread over the loop threads, so
+    * they may connect and disconnect concurrently.
+    */
+   lw_bool single_threaded;
+
+   lw_sync sync_clients;
    list (lw_server_client, clients);
 };
     
@@ -79,6 +89,11 @@ struct _lw_server_client
 
    lw_bool on_connect_called;
 
+   /* Whether on_client_data is hooked.  Only touched on the client's own
+    * pump thread (see update_data_hook).
+    */
+   lw_bool data_hooked;
+
    #ifdef ENABLE_SSL
       lwp_sslclient ssl;
    #endif
@@ -91,6 +106,29 @@ struct _lw_server_client
    lw_server_client * elem;
 };
 
+/* Added after any SSL filters, so it's the application's data being limited
+ * rather than what ends up on the wire.
+ */
+
+static void add_rate_limits (lw_server ctx, lw_server_client client)
+{
+   lw_pump pump = lw_stream_pump ((lw_stream) client);
+
+   if (ctx->send_rate)
+   {
+      lw_stream_add_filter_upstream ((lw_stream) client,
+            lw_ratelimit_new (pump, ctx->send_rate, ctx->rate_burst),
+            lw_true, lw_false);
+   }
+
+   if (ctx->receive_rate)
+   {
+      lw_stream_add_filter_downstream ((lw_stream) client,
+            lw_ratelimit_new (pump, ctx->receive_rate, ctx->rate_burst),
+            lw_true, lw_false);
+   }
+}
+
 static lw_server_client lwp_server_client_new (lw_server ctx, lw_pump pump, int fd)
 {
    lw_server_client client = calloc (sizeof (*client), 1);
@@ -122,6 +160,8 @@ static lw_server_client lwp_server_client_new (lw_server ctx, lw_pump pump, int
 
     #endif
 
+   add_rate_limits (ctx, client);
+
    lw_fdstream_set_fd (&client->fdstream, fd, 0, lw_true);
 
    return client;
@@ -154,8 +194,12 @@ static lw_server_client lwp_server_client_new (lw_server ctx, lw_pump pump, int
        return;
     }
 
+    lw_sync_lock (server->sync_clients);
+
     list_push (server->clients, client);
     client->elem = list_elem_back (server->clients);
+
+    lw_sync_release (server->sync_clients);
  }
 
 #endif
@@ -179,6 +223,8 @@ lw_server lw_server_new (lw_pump pump)
     
    ctx->socket = -1;
 
+   ctx->sync_clients = lw_sync_new ();
+
    return ctx;
 }
 
@@ -189,9 +235,19 @@ void lw_server_delete (lw_server ctx)
 
    lw_server_unhost (ctx);
 
+   lw_sync_delete (ctx->sync_clients);
+
    free (ctx);
 }
 
+void lw_server_set_rate_limit (lw_server ctx, size_t send_rate,
+                               size_t receive_rate, size_t burst)
+{
+   ctx->send_rate = send_rate;
+   ctx->receive_rate = receive_rate;
+   ctx->rate_burst = burst;
+}
+
 void lw_server_set_tag (lw_server ctx, void * tag)
 {
    ctx->tag = tag;
@@ -202,91 +258,147 @@ void * lw_server_tag (lw_server ctx)
    return ctx->tag;
 }
 
-static void listen_socket_read_ready (void * tag)
+void lwp_server_set_single_threaded (lw_server ctx)
 {
-   lw_server ctx = tag;
+   ctx->single_threaded = lw_true;
+}
 
+struct accepted
+{
+   lw_server server;
+   lw_pump pump;
+
+   int fd;
    struct sockaddr_storage address;
-   socklen_t address_length = sizeof (address);
-    
-   for (;;)
+};
+
+/* Runs on the thread of the pump the client was given to, so everything
+ * to do with the client (including the initial read) stays on that thread.
+ */
+static void client_accepted (struct accepted * accepted)
+{
+   lw_server ctx = accepted->server;
+
+   lw_server_client client = lwp_server_client_new
+      (ctx, accepted->pump, accepted->fd);
+
+   if (!client)
    {
-      int fd;
+      lwp_trace ("Failed allocating client");
 
-      lwp_trace ("Trying to accept...");
+      close (accepted->fd);
+      return;
+   }
 
-      if ((fd = accept (ctx->socket, (struct sockaddr *) &address,
-                        &address_length)) == -1)
-      {
-         lwp_trace ("Failed to accept: %s", strerror (errno));
-         break;
-      }
+   client->address = lwp_addr_new_sockaddr
+      ((struct sockaddr *) &accepted->address);
 
-      lwp_trace ("Accepted FD %d", fd);
+   lw_bool should_read = lw_false;
 
-      lw_server_client client = lwp_server_client_new (ctx, ctx->pump, fd);
+   if (ctx->on_data)
+   {
+      lw_stream_add_hook_data ((lw_stream) client, on_client_data, client);
+      client->data_hooked = lw_true;
 
-      if (!client)
-      {
-         lwp_trace ("Failed allocating client");
-         break;
-      }
+      should_read = lw_true;
+   }
+   
+   #ifdef ENABLE_SSL
+   if (!client->ssl)
+   {
+   #endif
+
+      client->on_connect_called = lw_true;
 
-      client->address = lwp_addr_new_sockaddr ((struct sockaddr *) &address);
+      lwp_retain (client, "on_connect");
 
-      lw_bool should_read = lw_false;
+      if (ctx->on_connect)
+         ctx->on_connect (ctx, client);
 
-      if (ctx->on_data)
+      if (lwp_release (client, "on_connect") ||
+             ((lw_stream) client)->flags & lwp_stream_flag_dead)
       {
-         lw_stream_add_hook_data ((lw_stream) client, on_client_data, client);
-         should_read = lw_true;
+         /* Client was deleted by connect hook
+          */
+         return;
       }
-      
-      #ifdef ENABLE_SSL
-      if (!client->ssl)
-      {
-      #endif
 
-         client->on_connect_called = lw_true;
+      lw_sync_lock (ctx->sync_clients);
+
+      list_push (ctx->clients, client);
+      client->elem = list_elem_back (ctx->clients);
+
+      lw_sync_release (ctx->sync_clients);
 
-         lwp_retain (client, "on_connect");
+   #ifdef ENABLE_SSL
+   }
+   else
+   {
+      should_read = lw_true;
+   }
+   #endif
 
-         if (ctx->on_connect)
-            ctx->on_connect (ctx, client);
+   if (should_read)
+   {
+      lwp_retain (client, "client initial read");
 
-         if (lwp_release (client, "on_connect") ||
-                ((lw_stream) ctx)->flags & lwp_stream_flag_dead)
-         {
-            /* Client was deleted by connect hook
-             */
-            return;
-         }
+      lw_stream_read ((lw_stream) client, -1);
 
-         list_push (ctx->clients, client);
-         client->elem = list_elem_back (ctx->clients);
+      lwp_release (client, "client initial read");
+   }
+}
 
-      #ifdef ENABLE_SSL
-      }
-      else
+static void post_client_accepted (struct accepted * accepted)
+{
+   client_accepted (accepted);
+   free (accepted);
+}
+
+static void listen_socket_read_ready (void * tag)
+{
+   lw_server ctx = tag;
+
+   struct accepted accepted = { ctx };
+   socklen_t address_length;
+    
+   for (;;)
+   {
+      lwp_trace ("Trying to accept...");
+
+      address_length = sizeof (accepted.address);
+
+      if ((accepted.fd = accept (ctx->socket,
+                                 (struct sockaddr *) &accepted.address,
+                                 &address_length)) == -1)
       {
-         should_read = lw_true;
+         lwp_trace ("Failed to accept: %s", strerror (errno));
+         break;
       }
-      #endif
 
-      if (should_read)
+      lwp_trace ("Accepted FD %d", accepted.fd);
+
+      accepted.pump = ctx->single_threaded ?
+            ctx->pump : lwp_eventpump_next (ctx->pump);
+
+      if (accepted.pump == ctx->pump)
       {
-         lwp_retain (client, "client initial read");
+         client_accepted (&accepted);
+         continue;
+      }
 
-         lw_stream_read ((lw_stream) client, -1);
+      /* Handed over to another loop thread
+       */
+      struct accepted * post = malloc (sizeof (*post));
 
-         if (lwp_release (client, "client initial read") ||
-                ((lw_stream) client)->flags & lwp_stream_flag_dead)
-         {
-            /* Client was deleted when performing initial read
-             */
-            return;
-         }
+      if (!post)
+      {
+         close (accepted.fd);
+         continue;
       }
+
+      *post = accepted;
+
+      lw_pump_post (accepted.pump, post_client_accepted, post);
    }
 }
 
@@ -330,7 +442,8 @@ void lw_server_host_filter (lw_server ctx, lw_filter filter)
       return;
    }
 
-   lw_pump_add (ctx->pump, ctx->socket, ctx, listen_socket_read_ready, 0, lw_true);
+   ctx->pump_watch = lw_pump_add (ctx->pump, ctx->socket, ctx,
+                                  listen_socket_read_ready, 0, lw_true);
    
    lw_error_delete (error);
 }
@@ -340,6 +453,12 @@ void lw_server_unhost (lw_server ctx)
    if (!lw_server_hosting (ctx))
       return;
 
+   if (ctx->pump_watch)
+   {
+      lw_pump_remove (ctx->pump, ctx->pump_watch);
+      ctx->pump_watch = 0;
+   }
+
    close (ctx->socket);
    ctx->socket = -1;
 }
@@ -351,7 +470,13 @@ lw_bool lw_server_hosting (lw_server ctx)
 
 size_t lw_server_num_clients (lw_server ctx)
 {
-   return list_length (ctx->clients);
+   lw_sync_lock (ctx->sync_clients);
+
+   size_t num_clients = list_length (ctx->clients);
+
+   lw_sync_release (ctx->sync_clients);
+
+   return num_clients;
 }
 
 long lw_server_port (lw_server ctx)
@@ -536,22 +661,65 @@ lw_addr lw_server_client_addr (lw_server_client client)
    return client->address;
 }
 
+/* Locked, but the client returned may still disconnect straight away on
+ * another loop thread, so walking the list isn't safe with a threaded pump.
+ */
+
 lw_server_client lw_server_client_next (lw_server_client client)
 {
+   lw_server ctx = client->server;
+
+   lw_sync_lock (ctx->sync_clients);
+
    lw_server_client * next_client = list_elem_next (client->elem);
+   lw_server_client next = next_client ? *next_client : NULL;
 
-   if (!next_client)
-      return NULL;
+   lw_sync_release (ctx->sync_clients);
 
-   return *next_client;
+   return next;
 }
 
 lw_server_client lw_server_client_first (lw_server ctx)
 {
-   if (list_length (ctx->clients) == 0)
-      return NULL;
+   lw_server_client client = NULL;
 
-   return list_front (ctx->clients);
+   lw_sync_lock (ctx->sync_clients);
+
+   if (list_length (ctx->clients) > 0)
+      client = list_front (ctx->clients);
+
+   lw_sync_release (ctx->sync_clients);
+
+   return client;
+}
+
+void lw_server_get_stats (lw_server ctx, lw_stream_stats * stats)
+{
+   memset (stats, 0, sizeof (*stats));
+
+   lw_sync_lock (ctx->sync_clients);
+
+   list_each (ctx->clients, client)
+   {
+      lw_stream_stats client_stats;
+      lw_stream_get_stats ((lw_stream) client, &client_stats);
+
+      stats->bytes_sent += client_stats.bytes_sent;
+      stats->bytes_received += client_stats.bytes_received;
+
+      stats->queued_bytes += client_stats.queued_bytes;
+
+      stats->front_queue += client_stats.front_queue;
+      stats->back_queue += client_stats.back_queue;
+
+      if (client_stats.max_queued_bytes > stats->max_queued_bytes)
+         stats->max_queued_bytes = client_stats.max_queued_bytes;
+
+      if (client_stats.queued_ms > stats->queued_ms)
+         stats->queued_ms = client_stats.queued_ms;
+   }
+
+   lw_sync_release (ctx->sync_clients);
 }
 
 void on_client_data (lw_stream stream, void * tag, const char * buffer, size_t size)
@@ -585,7 +753,11 @@ void on_client_close (lw_stream stream, void * tag)
    }
 
    if (client->elem)
+   {
+      lw_sync_lock (ctx->sync_clients);
       list_elem_remove (client->elem);
+      lw_sync_release (ctx->sync_clients);
+   }
 
    #ifdef ENABLE_SSL
       if (client->ssl)
@@ -597,32 +769,97 @@ void on_client_close (lw_stream stream, void * tag)
    lwp_release (client, "server_client_new");
 }
 
-void lw_server_on_data (lw_server ctx, lw_server_hook_data on_data)
+/* Brings the client's data hook in line with the server's on_data.  Must be
+ * called on the client's own pump thread.
+ */
+static void update_data_hook (lw_server ctx, lw_server_client client)
 {
-   ctx->on_data = on_data;
+   if (ctx->on_data)
+   {
+      if (client->data_hooked)
+         return;
+
+      client->data_hooked = lw_true;
+
+      lw_stream_add_hook_data ((lw_stream) client, on_client_data, client);
+      lw_stream_read ((lw_stream) client, -1);
 
-   if (on_data)
+      return;
+   }
+
+   if (client->data_hooked)
    {
-      /* Setting on_data to a handler */
+      client->data_hooked = lw_false;
+      lw_stream_remove_hook_data ((lw_stream) client, on_client_data, client);
+   }
+}
+
+struct data_hook_update
+{
+   lw_server server;
+   lw_server_client client;
+};
+
+static void post_update_data_hook (struct data_hook_update * update)
+{
+   lw_server ctx = update->server;
+   lw_server_client client = update->client;
+
+   free (update);
+
+   /* The client may have disconnected since this was posted, which would
+    * have taken it out of the list on this same thread.
+    */
+   lw_bool connected = lw_false;
 
-      if (!ctx->on_data)
+   lw_sync_lock (ctx->sync_clients);
+
+   list_each (ctx->clients, each)
+   {
+      if (each == client)
       {
-         list_each (ctx->clients, client)
-         {
-            lw_stream_add_hook_data ((lw_stream) client, on_client_data, client);
-            lw_stream_read ((lw_stream) client, -1);
-         }
+         connected = lw_true;
+         break;
       }
-
-      return;
    }
 
-   /* Setting on_data to 0 */
+   lw_sync_release (ctx->sync_clients);
+
+   if (connected)
+      update_data_hook (ctx, client);
+}
+
+void lw_server_on_data (lw_server ctx, lw_server_hook_data on_data)
+{
+   ctx->on_data = on_data;
+
+   lw_sync_lock (ctx->sync_clients);
 
    list_each (ctx->clients, client)
    {
-      lw_stream_remove_hook_data ((lw_stream) client, on_client_data, client);
+      lw_pump pump = lw_stream_pump ((lw_stream) client);
+
+      if (pump == ctx->pump)
+      {
+         update_data_hook (ctx, client);
+         continue;
+      }
+
+      /* The client belongs to another loop thread of a threaded pump, so
+       * its hooks can only be changed from there.
+       */
+      struct data_hook_update * update = malloc (sizeof (*update));
+
+      if (!update)
+         continue;
+
+      update->server = ctx;
+      update->client = client;
+
+      lw_pump_post (pump, post_update_data_hook, update);
    }
+
+   lw_sync_release (ctx->sync_clients);
 }
 
 lwp_def_hook (server, connect)
@@ -35,11 +35,53 @@ struct _lw_thread
    char * name;
 
    pthread_t thread;
-   lw_bool started;
+   lw_bool started, joinable;
 
    void * tag;
 };
 
+/* Procs to call when this thread exits (see lwp_thread_on_exit).  The key's
+ * value is only set so that pthreads calls thread_exit.
+ */
+#define lwp_max_exit_procs  8
+
+static lwp_thread_local struct
+{
+   int count;
+   void (* procs [lwp_max_exit_procs]) (void);
+
+} exit_procs;
+
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+static void thread_exit (void * value)
+{
+   /* A proc may register again (e.g. if a pool was added to by another
+    * proc), in which case the value is set again and pthreads calls this
+    * another time.
+    */
+   while (exit_procs.count > 0)
+      exit_procs.procs [-- exit_procs.count] ();
+}
+
+static void create_exit_key (void)
+{
+   pthread_key_create (&exit_key, thread_exit);
+}
+
+void lwp_thread_on_exit (void (* proc) (void))
+{
+   pthread_once (&exit_key_once, create_exit_key);
+
+   if (exit_procs.count == lwp_max_exit_procs)
+      return;
+
+   exit_procs.procs [exit_procs.count ++] = proc;
+
+   pthread_setspecific (exit_key, (void *) 1);
+}
+
 lw_thread lw_thread_new (const char * name, void * proc)
 {
    lw_thread ctx = calloc (sizeof (*ctx), 1);
@@ -72,7 +114,7 @@ static int thread_proc (lw_thread ctx)
     
    int exit_code = ((int (*) (void *)) ctx->proc) (ctx->param);
 
-   ctx->started = lw_false;
+   __atomic_store_n (&ctx->started, lw_false, __ATOMIC_RELEASE);
 
    return exit_code;
 }
@@ -82,20 +124,28 @@ void lw_thread_start (lw_thread ctx, void * param)
    if (lw_thread_started (ctx))
       return;
 
+   /* Finished, but not yet joined
+    */
+   if (ctx->joinable)
+      lw_thread_join (ctx);
+
    ctx->param = param;
 
-   ctx->started = pthread_create
+   ctx->started = ctx->joinable = pthread_create
       (&ctx->thread, 0, (void * (*) (void *)) thread_proc, ctx) == 0;
 }
 
 lw_bool lw_thread_started (lw_thread ctx)
 {
-   return ctx->started;
+   return __atomic_load_n (&ctx->started, __ATOMIC_ACQUIRE);
 }
 
+/* Joins even if the thread has already finished, so that anything it did
+ * happens-before the caller goes on to free what it was using.
+ */
 void * lw_thread_join (lw_thread ctx)
 {
-   if (!lw_thread_started (ctx))
+   if (!ctx->joinable)
       return (void *) -1;
 
    void * exit_code;
@@ -103,6 +153,8 @@ void * lw_thread_join (lw_thread ctx)
    if (pthread_join (ctx->thread, &exit_code))
       return (void *) -1;
 
+   ctx->joinable = lw_false;
+
    return exit_code;
 }
 
@@ -38,11 +38,12 @@ struct _lw_timer
 
    void * tag;
 
-   lw_bool started;
+   lw_bool started, once;
 
-   #ifdef _lacewing_use_timerfd
-      int fd;
-   #endif
+   /* For an eventpump, the timer lives in the pump's timer wheel.  Any other
+    * pump gets a thread which posts each tick.
+    */
+   struct _lwp_timerwheel_entry entry;
 
    lw_event stop_event;
    long interval;
@@ -50,15 +51,32 @@ struct _lw_timer
    lw_thread timer_thread;
 };
 
-static void timer_tick (lw_timer ctx)
+static lw_bool use_timerwheel (lw_timer ctx)
+{
+   return ctx->pump->def == &def_eventpump;
+}
+
+static void timer_expired (void * tag)
 {
-  if (ctx->on_tick)
+   lw_timer ctx = tag;
+
+   if (ctx->once)
+   {
+      ctx->started = lw_false;
+      lw_pump_remove_user (ctx->pump);
+   }
+
+   if (ctx->on_tick)
       ctx->on_tick (ctx);
+}
+
+static void timer_tick (lw_timer ctx)
+{
+   if (ctx->once)
+      lw_timer_stop (ctx);
 
-  #ifdef _lacewing_use_timerfd
-     lw_i64 expirations;
-     read (ctx->fd, &expirations, sizeof (lw_i64));
-  #endif
+   if (ctx->on_tick)
+      ctx->on_tick (ctx);
 }
 
 static void timer_thread (void * ptr)
@@ -73,6 +91,9 @@ static void timer_thread (void * ptr)
          break;
 
       lw_pump_post (ctx->pump, timer_tick, ctx);
+
+      if (ctx->once)
+         break;
    }
 }
 
@@ -84,13 +105,15 @@ lw_timer lw_timer_new (lw_pump pump)
       return 0;
 
    ctx->pump = pump;
-   ctx->timer_thread = lw_thread_new ("timer_thread", timer_thread);
-   ctx->stop_event = lw_event_new ();
 
-   #ifdef _lacewing_use_timerfd
-      ctx->fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK);
-      lw_pump_add (ctx->pump, ctx->fd, ctx, (lw_pump_callback) timer_tick, 0, lw_true);
-   #endif
+   ctx->entry.on_expire = timer_expired;
+   ctx->entry.tag = ctx;
+
+   if (!use_timerwheel (ctx))
+   {
+      ctx->timer_thread = lw_thread_new ("timer_thread", timer_thread);
+      ctx->stop_event = lw_event_new ();
+   }
 
    return ctx;
 }
@@ -98,109 +121,69 @@ lw_timer lw_timer_new (lw_pump pump)
 void lw_timer_delete (lw_timer ctx)
 {
    lw_timer_stop (ctx);
-   lw_event_delete (ctx->stop_event);
 
-   #ifdef _lacewing_use_timerfd
-      close (ctx->fd);
-   #endif
+   if (!use_timerwheel (ctx))
+   {
+      lw_event_delete (ctx->stop_event);
+      lw_thread_delete (ctx->timer_thread);
+   }
 
    free (ctx);
 }
 
-void lw_timer_start (lw_timer ctx, long interval)
+static void timer_start (lw_timer ctx, long interval, lw_bool once)
 {
    lw_timer_stop (ctx);
 
    ctx->started = lw_true;
+   ctx->once = once;
+
    lw_pump_add_user (ctx->pump);
 
-   #ifdef USE_KQUEUE
-    
-      if (ctx->pump->def == &def_eventpump)
-      {
-         struct kevent event;
-
-         EV_SET (&event, (uintptr_t) ctx, EVFILT_TIMER,
-                    EV_ADD | EV_ENABLE | EV_CLEAR, 0, interval, ctx);
-
-         if (kevent (((lw_eventpump) ctx->pump)->queue,
-                        &event, 1, 0, 0, 0) == -1)
-         {
-            lwp_trace ("Timer: Failed to add timer to kqueue: %s",
-                            strerror (errno));
-
-            return;
-         }
-      }
-      else
-      {
-         ctx->interval = interval;
-         lw_thread_start (ctx->timer_thread, ctx);
-      }
-
-   #else
-      #ifdef _lacewing_use_timerfd
-        
-            struct itimerspec spec;
-
-            spec.it_interval.tv_sec  = interval / 1000;
-            spec.it_interval.tv_nsec = (interval % 1000) * 1000000;
-
-            spec.it_value.tv_sec = 0;
-            spec.it_value.tv_nsec = 1;
- 
-            timerfd_settime (ctx->fd, 0, &spec, 0);
-            
-      #else
-            ctx->interval = interval;
-            lw_thread_start (ctx->timer_thread, ctx);
-      #endif
-   #endif
+   if (use_timerwheel (ctx))
+   {
+      ctx->entry.interval = once ? 0 : interval;
+
+      lwp_eventpump_add_timer ((lw_eventpump) ctx->pump, &ctx->entry, interval);
+   }
+   else
+   {
+      ctx->interval = interval;
+      lw_thread_start (ctx->timer_thread, ctx);
+   }
+}
+
+void lw_timer_start (lw_timer ctx, long interval)
+{
+   timer_start (ctx, interval, lw_false);
+}
+
+void lw_timer_start_once (lw_timer ctx, long delay)
+{
+   timer_start (ctx, delay, lw_true);
 }
 
 void lw_timer_stop (lw_timer ctx)
 {
+   /* Done even if the timer isn't started, as it may still be firing on the
+    * pump's thread (a once timer is stopped as soon as it fires).  Once this
+    * returns it isn't, so the timer can be deleted, and a once timer that
+    * fired meanwhile has already removed its pump user.
+    */
+   if (use_timerwheel (ctx))
+      lwp_eventpump_remove_timer ((lw_eventpump) ctx->pump, &ctx->entry);
+
    if (!lw_timer_started (ctx))
       return;
 
-   /* TODO: What if a tick has been posted and this gets destructed? */
-
-   #ifndef _lacewing_use_timerfd
+   if (!use_timerwheel (ctx))
+   {
+      /* TODO: What if a tick has been posted and this gets destructed? */
 
       lw_event_signal (ctx->stop_event);
       lw_thread_join (ctx->timer_thread);
       lw_event_unsignal (ctx->stop_event);
-
-    #endif
-
-    #ifdef USE_KQUEUE
-
-      if (ctx->pump->def == &def_eventpump)
-      {
-         struct kevent event;
-
-         EV_SET (&event, (uintptr_t) ctx, EVFILT_TIMER, EV_DELETE, 0, 0, ctx);
-
-         if (kevent (((lw_eventpump) ctx->pump)->queue,
-                        &event, 1, 0, 0, 0) == -1)
-         {
-            lwp_trace ("Timer: Failed to remove timer from kqueue: %s",
-                            strerror (errno));
-
-            return;
-         }
-      }
-      else
-      {
-         /* TODO */
-      }
-
-    #else
-        #ifdef _lacewing_use_timerfd
-           struct itimerspec spec = {};
-           timerfd_settime (ctx->fd, 0, &spec, 0);
-        #endif
-    #endif
+   }
 
    ctx->started = lw_false;
    lw_pump_remove_user (ctx->pump);
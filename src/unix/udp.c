@@ -29,10 +29,12 @@
 
 #include "../common.h"
 #include "../address.h"
+#include "eventpump.h"
 
 struct _lw_udp
 {
    lw_pump pump;
+   lw_pump_watch pump_watch;
     
    lw_udp_hook_data on_data;
    lw_udp_hook_error on_error;
@@ -119,7 +121,9 @@ void lw_udp_host_filter (lw_udp ctx, lw_filter filter)
 
    ctx->filter = lw_filter_clone (filter);
 
-   lw_pump_add (ctx->pump, ctx->fd, ctx, read_ready, 0, lw_true);
+   lwp_eventpump_busy_poll_socket (ctx->pump, ctx->fd);
+
+   ctx->pump_watch = lw_pump_add (ctx->pump, ctx->fd, ctx, read_ready, 0, lw_true);
 }
 
 lw_bool lw_udp_hosting (lw_udp ctx)
@@ -134,6 +138,12 @@ long lw_udp_port (lw_udp ctx)
 
 void lw_udp_unhost (lw_udp ctx)
 {
+   if (ctx->pump_watch)
+   {
+      lw_pump_remove (ctx->pump, ctx->pump_watch);
+      ctx->pump_watch = 0;
+   }
+
    lwp_close_socket (ctx->fd);
    ctx->fd = -1;
 
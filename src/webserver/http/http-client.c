@@ -303,7 +303,13 @@ void client_respond (lwp_ws_client client, lw_ws_req request)
    lwp_heapbuffer_addf (&request->buffer, "\r\ncontent-length: " lwp_fmt_size "\r\n\r\n",
                            lw_stream_queued ((lw_stream) ctx->request));
 
-   lw_fdstream_cork ((lw_fdstream) ctx->client.socket);
+   /* A body sent from a file is read in later ticks than the headers, so
+    * auto-cork alone would send the headers in a segment of their own.
+    */
+   lw_bool cork = lwp_stream_queues_stream ((lw_stream) ctx->request);
+
+   if (cork)
+      lw_fdstream_cork ((lw_fdstream) ctx->client.socket);
 
    char * head_buffer = lwp_heapbuffer_buffer (&request->buffer);
    size_t head_length = lwp_heapbuffer_length (&request->buffer);
@@ -315,7 +321,8 @@ void client_respond (lwp_ws_client client, lw_ws_req request)
 
    lwp_heapbuffer_reset (&request->buffer);
 
-   lw_fdstream_uncork ((lw_fdstream) ctx->client.socket);
+   if (cork)
+      lw_fdstream_uncork ((lw_fdstream) ctx->client.socket);
 
    if (!http_should_keep_alive (&ctx->parser))
       lw_stream_close ((lw_stream) ctx->client.socket, lw_false);
@@ -511,7 +511,11 @@ size_t lwp_ws_multipart_process (lwp_ws_multipart ctx,
             if (parsed != lwp_heapbuffer_length (&ctx->request->buffer))
                error = lw_true;
 
+            /* The parser is done with the buffer, so it can go if it grew
+             * (its callbacks only reset it)
+             */
             lwp_heapbuffer_reset (&ctx->request->buffer);
+            lwp_heapbuffer_shrink (&ctx->request->buffer);
          }
          else
          {
@@ -117,7 +117,12 @@ void client_respond (lwp_ws_client client, lw_ws_req request)
 
    assert (!spdy_stream_open_remote (stream));
 
-   lw_fdstream_cork ((lw_fdstream) ctx->client.socket);
+   /* As for HTTP, only a body sent from a file needs the socket corked */
+
+   lw_bool cork = lwp_stream_queues_stream ((lw_stream) request);
+
+   if (cork)
+      lw_fdstream_cork ((lw_fdstream) ctx->client.socket);
 
    spdy_nv_pair * headers = alloca
       (sizeof (spdy_nv_pair) * (list_length (request->headers_out) + 3));
@@ -210,7 +215,8 @@ void client_respond (lwp_ws_client client, lw_ws_req request)
       stream = 0;
    }
 
-   lw_fdstream_uncork ((lw_fdstream) socket);
+   if (cork)
+      lw_fdstream_uncork ((lw_fdstream) ctx->client.socket);
 
    lwp_ws_req_delete (request);
 }
@@ -66,6 +66,13 @@ static void on_connect (lw_server server, lw_server_client client_socket)
 
    lw_stream_set_tag ((lw_stream) client_socket, client);
 
+   /* Responses are written in several pieces (headers, body, etc.), which
+    * this gathers into one write.  client_respond only corks the socket
+    * when the body is sent from a file.
+    */
+
+   lw_fdstream_auto_cork ((lw_fdstream) client_socket, lw_true);
+
    lw_stream_write_stream
       ((lw_stream) client, (lw_stream) client_socket, -1, lw_false);
 }
@@ -149,12 +156,18 @@ lw_ws lw_ws_new (lw_pump pump)
    ctx->socket = lw_server_new (pump);
    lw_server_set_tag (ctx->socket, ctx);
 
+   /* Requests share the webserver's state, so its clients aren't spread
+    * over the threads of a threaded pump.
+    */
+   lwp_server_set_single_threaded (ctx->socket);
+
    lw_server_on_connect (ctx->socket, on_connect);
    lw_server_on_disconnect (ctx->socket, on_disconnect);
    lw_server_on_error (ctx->socket, on_error);
 
    ctx->socket_secure = lw_server_new (pump);
    lw_server_set_tag (ctx->socket_secure, ctx);
+   lwp_server_set_single_threaded (ctx->socket_secure);
 
    lw_server_on_connect (ctx->socket_secure, on_connect);
    lw_server_on_disconnect (ctx->socket_secure, on_disconnect);
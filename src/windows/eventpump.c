@@ -136,6 +136,19 @@ lw_eventpump lw_eventpump_new ()
    return ctx;
 }
 
+lw_eventpump lw_eventpump_new_threaded (int num_threads)
+{
+   /* TODO : Drain the completion port from several threads.  Falls back to a
+    * single thread for now.
+    */
+   return lw_eventpump_new ();
+}
+
+lw_eventpump lw_eventpump_new_uring ()
+{
+   return lw_eventpump_new ();
+}
+
 static void def_cleanup (lw_pump _ctx)
 {
    lw_eventpump ctx = (lw_eventpump) _ctx;
@@ -157,8 +170,14 @@ static void def_cleanup (lw_pump _ctx)
    CloseHandle (ctx->completion_port);
 }
 
-lw_error lw_eventpump_tick (lw_eventpump ctx)
+/* If until is non-zero, stops at that performance counter value even if there
+ * are still completions waiting.  Returns 1 if it did, or 0 if the completion
+ * port was emptied.
+ */
+static long tick (lw_eventpump ctx, LONGLONG until)
 {
+   long remaining = 0;
+
    if (ctx->on_tick_needed)
    {
       /* Process whatever the watcher thread dequeued before telling the caller to tick */
@@ -178,6 +197,18 @@ lw_error lw_eventpump_tick (lw_eventpump ctx)
    {
       int error = 0;
 
+      if (until)
+      {
+         LARGE_INTEGER now;
+         QueryPerformanceCounter (&now);
+
+         if (now.QuadPart >= until)
+         {
+            remaining = 1;
+            break;
+         }
+      }
+
       if (!GetQueuedCompletionStatus (ctx->completion_port,
                                       &bytes_transferred,
                                       (PULONG_PTR) &watch,
@@ -199,9 +230,26 @@ lw_error lw_eventpump_tick (lw_eventpump ctx)
    if (ctx->on_tick_needed)
       lw_event_signal (ctx->watcher.resume_event);
 
+   return remaining;
+}
+
+lw_error lw_eventpump_tick (lw_eventpump ctx)
+{
+   tick (ctx, 0);
+
    return 0;
 }
 
+long lw_eventpump_tick_for (lw_eventpump ctx, long budget_us)
+{
+   LARGE_INTEGER frequency, now;
+
+   QueryPerformanceFrequency (&frequency);
+   QueryPerformanceCounter (&now);
+
+   return tick (ctx, now.QuadPart + (budget_us * frequency.QuadPart) / 1000000);
+}
+
 lw_error lw_eventpump_start_eventloop (lw_eventpump ctx)
 {
    OVERLAPPED * overlapped;
@@ -245,6 +293,32 @@ void lw_eventpump_post_eventloop_exit (lw_eventpump ctx)
     PostQueuedCompletionStatus (ctx->completion_port, 0, 0, sig_exit_event_loop);
 }
 
+/* The Windows eventpump doesn't busy poll its completion port */
+
+lw_bool lw_eventpump_set_busy_poll (lw_eventpump ctx, long microseconds)
+{
+   return lw_false;
+}
+
+/* Stats aren't collected by the Windows eventpump: enabling them fails, and
+ * lw_eventpump_get_stats always returns false with everything zeroed.
+ */
+
+lw_bool lw_eventpump_enable_stats (lw_eventpump ctx, lw_bool enabled)
+{
+   return lw_false;
+}
+
+lw_bool lw_eventpump_get_stats (lw_eventpump ctx, lw_pump_stats * stats)
+{
+   memset (stats, 0, sizeof (*stats));
+   return lw_false;
+}
+
+void lw_eventpump_reset_stats (lw_eventpump ctx)
+{
+}
+
 lw_error lw_eventpump_start_sleepy_ticking
     (lw_eventpump ctx, void (lw_callback * on_tick_needed) (lw_eventpump))
 {
@@ -74,27 +74,42 @@ static void completion (void * tag, OVERLAPPED * _overlapped,
    switch (overlapped->type)
    {
       case overlapped_type_read:
-
+      {
          assert (overlapped == &ctx->read_overlapped);
 
+         lwp_refbuffer ref = ctx->read_ref;
+         ctx->read_ref = 0;
+
          read_completed (ctx);
 
-         if (error == ERROR_OPERATION_ABORTED)
-            break;
+         if (error == ERROR_OPERATION_ABORTED
+               || ctx->stream.flags & lwp_stream_flag_dead)
+         {
+            if (ref)
+               lwp_refbuffer_release (ref);
 
-         if (ctx->stream.flags & lwp_stream_flag_dead)
             break;
+         }
 
          if (error || !bytes_transferred)
          {
+            if (ref)
+               lwp_refbuffer_release (ref);
+
             lw_stream_close ((lw_stream) ctx, lw_true);
             break;
          }
 
-         lw_stream_data ((lw_stream) ctx, ctx->buffer, bytes_transferred);
+         lwp_stream_data_ref ((lw_stream) ctx, ref,
+                              ref ? ref->buffer : ctx->buffer,
+                              bytes_transferred);
+
+         if (ref)
+            lwp_refbuffer_release (ref);
 
          issue_read (ctx);
          break;
+      }
 
       case overlapped_type_write:
 
@@ -224,6 +239,12 @@ void issue_read (lw_fdstream ctx)
    if (ctx->flags & lwp_fdstream_flag_read_pending)
       return;
 
+   /* Don't read any more until whatever we're writing to has room
+    * (def_resume_read will be called)
+    */
+   if (lw_stream_is_paused ((lw_stream) ctx))
+      return;
+
    memset (&ctx->read_overlapped, 0, sizeof (ctx->read_overlapped));
 
    ctx->read_overlapped.type = overlapped_type_read;
@@ -236,13 +257,30 @@ void issue_read (lw_fdstream ctx)
    if (ctx->reading_size != -1 && to_read > ctx->reading_size)
       to_read = ctx->reading_size;
 
-   if (ReadFile (ctx->fd, ctx->buffer, to_read,
+   char * dest = ctx->buffer;
+
+   if ((ctx->flags & lwp_fdstream_flag_pooled_read)
+         && (ctx->read_ref = lwp_refbuffer_new_pooled (to_read)))
+   {
+      dest = (char *) ctx->read_ref->buffer;
+
+      if (ctx->read_ref->length < to_read)
+         to_read = ctx->read_ref->length;
+   }
+
+   if (ReadFile (ctx->fd, dest, to_read,
                  0, &ctx->read_overlapped.overlapped) == -1)
    {
       int error = GetLastError();
 
       if (error != ERROR_IO_PENDING)
 	   {
+         if (ctx->read_ref)
+         {
+            lwp_refbuffer_release (ctx->read_ref);
+            ctx->read_ref = 0;
+         }
+
          lw_stream_close ((lw_stream) ctx, lw_true);
          return;
       }
@@ -548,6 +586,14 @@ void lw_fdstream_nagle (lw_fdstream ctx, lw_bool enabled)
    }
 }
 
+void lw_fdstream_pooled_read (lw_fdstream ctx, lw_bool enabled)
+{
+   if (enabled)
+      ctx->flags |= lwp_fdstream_flag_pooled_read;
+   else
+      ctx->flags &= ~ lwp_fdstream_flag_pooled_read;
+}
+
 /* TODO : Can we do anything here on Windows? */
 
 void lw_fdstream_cork (lw_fdstream ctx)
@@ -558,6 +604,22 @@ void lw_fdstream_uncork (lw_fdstream ctx)
 {
 }
 
+/* Writes are already asynchronous (and never left in the stream's queues),
+ * so there's nothing to hold back.
+ */
+
+void lw_fdstream_auto_cork (lw_fdstream ctx, lw_bool enabled)
+{
+}
+
+static void def_resume_read (lw_stream _ctx)
+{
+   lw_fdstream ctx = (lw_fdstream) _ctx;
+
+   if (ctx->reading_size != 0)
+      issue_read (ctx);
+}
+
 const lw_streamdef def_fdstream =
 {
    def_sink_data,
@@ -567,7 +629,9 @@ const lw_streamdef def_fdstream =
    def_close,
    def_bytes_left,
    def_read,
-   def_cleanup
+   def_cleanup,
+   0, /* sink_data_vec */
+   def_resume_read
 };
 
 void lwp_fdstream_init (lw_fdstream ctx, lw_pump pump)
@@ -54,6 +54,9 @@ struct _lw_fdstream
 
    char buffer [lwp_default_buffer_size];
 
+   /* With lw_fdstream_pooled_read, the pending read goes here instead */
+   lwp_refbuffer read_ref;
+
    HANDLE fd;
 
    lw_pump_watch watch;
@@ -81,6 +84,7 @@ struct _lw_fdstream
 #define lwp_fdstream_flag_is_socket        4
 #define lwp_fdstream_flag_close_asap       8  /* FD close pending on write? */
 #define lwp_fdstream_flag_auto_close       16
+#define lwp_fdstream_flag_pooled_read      32
 
 void lwp_fdstream_init (lw_fdstream, lw_pump);
 
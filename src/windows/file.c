@@ -164,3 +164,11 @@ const char * lw_file_name (lw_file ctx)
    return ctx->name;
 }
 
+
+/* TODO : mmap mode ('m' in the mode string is currently ignored, and the file
+ * opened as normal), so there's no cache to size.
+ */
+
+void lw_file_set_cache_size (size_t bytes)
+{
+}
@@ -43,6 +43,11 @@ void lwp_init ()
     WSAStartup (MAKEWORD (2, 2), &winsock_data);
 }
 
+lw_i64 lwp_time_ms ()
+{
+    return (lw_i64) GetTickCount ();
+}
+
 lw_bool lw_file_exists (const char * filename)
 {
    return (GetFileAttributesA (filename) & FILE_ATTRIBUTE_DIRECTORY) == 0;
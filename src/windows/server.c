@@ -66,6 +66,8 @@ struct _lw_server
    list (lw_server_client, clients);
 
    void * tag;
+
+   size_t send_rate, receive_rate, rate_burst;
 };
     
 struct _lw_server_client
@@ -109,16 +111,51 @@ void lw_server_delete (lw_server ctx)
    free (ctx);
 }
 
+void lw_server_set_rate_limit (lw_server ctx, size_t send_rate,
+                               size_t receive_rate, size_t burst)
+{
+   ctx->send_rate = send_rate;
+   ctx->receive_rate = receive_rate;
+   ctx->rate_burst = burst;
+}
+
 void lw_server_set_tag (lw_server ctx, void * tag)
 {
    ctx->tag = tag;
 }
 
+void lwp_server_set_single_threaded (lw_server ctx)
+{
+   /* The Windows pump only ever runs on one thread
+    */
+}
+
 void * lw_server_tag (lw_server ctx)
 {
    return ctx->tag;
 }
 
+/* Added after any SSL filters, so it's the application's data being limited
+ * rather than what ends up on the wire.
+ */
+
+static void add_rate_limits (lw_server ctx, lw_server_client client)
+{
+   if (ctx->send_rate)
+   {
+      lw_stream_add_filter_upstream ((lw_stream) client,
+            lw_ratelimit_new (ctx->pump, ctx->send_rate, ctx->rate_burst),
+            lw_true, lw_false);
+   }
+
+   if (ctx->receive_rate)
+   {
+      lw_stream_add_filter_downstream ((lw_stream) client,
+            lw_ratelimit_new (ctx->pump, ctx->receive_rate, ctx->rate_burst),
+            lw_true, lw_false);
+   }
+}
+
 lw_server_client lwp_server_client_new (lw_server ctx, SOCKET socket)
 {
    lw_server_client client = (lw_server_client) calloc (sizeof (*client), 1);
@@ -141,6 +178,8 @@ lw_server_client lwp_server_client_new (lw_server ctx, SOCKET socket)
       lwp_serverssl_init (&client->ssl, ctx->ssl_creds, (lw_stream) client);
    }
 
+   add_rate_limits (ctx, client);
+
    lw_fdstream_set_fd ((lw_fdstream) client, (HANDLE) socket, 0, lw_true);
 
    return client;
@@ -750,6 +789,31 @@ lw_server_client lw_server_client_first (lw_server ctx)
    return list_front (ctx->clients);
 }
 
+void lw_server_get_stats (lw_server ctx, lw_stream_stats * stats)
+{
+   memset (stats, 0, sizeof (*stats));
+
+   list_each (ctx->clients, client)
+   {
+      lw_stream_stats client_stats;
+      lw_stream_get_stats ((lw_stream) client, &client_stats);
+
+      stats->bytes_sent += client_stats.bytes_sent;
+      stats->bytes_received += client_stats.bytes_received;
+
+      stats->queued_bytes += client_stats.queued_bytes;
+
+      stats->front_queue += client_stats.front_queue;
+      stats->back_queue += client_stats.back_queue;
+
+      if (client_stats.max_queued_bytes > stats->max_queued_bytes)
+         stats->max_queued_bytes = client_stats.max_queued_bytes;
+
+      if (client_stats.queued_ms > stats->queued_ms)
+         stats->queued_ms = client_stats.queued_ms;
+   }
+}
+
 void on_client_data (lw_stream stream, void * tag, const char * buffer, size_t size)
 {
    lw_server_client client = (lw_server_client) tag;
@@ -64,6 +64,24 @@ void lw_thread_delete (lw_thread ctx)
    free (ctx);
 }
 
+/* Without pthread keys to hang a destructor on, the procs are only run for
+ * threads started by lw_thread_start.
+ */
+#define lwp_max_exit_procs  8
+
+static lwp_thread_local struct
+{
+   int count;
+   void (* procs [lwp_max_exit_procs]) (void);
+
+} exit_procs;
+
+void lwp_thread_on_exit (void (* proc) (void))
+{
+   if (exit_procs.count < lwp_max_exit_procs)
+      exit_procs.procs [exit_procs.count ++] = proc;
+}
+
 static int thread_proc (lw_thread ctx)
 {
    struct
@@ -91,7 +109,12 @@ static int thread_proc (lw_thread ctx)
    {
    } */
 
-   return ((int (*) (void *)) ctx->proc) (ctx->param);
+   int exit_code = ((int (*) (void *)) ctx->proc) (ctx->param);
+
+   while (exit_procs.count > 0)
+      exit_procs.procs [-- exit_procs.count] ();
+
+   return exit_code;
 }
 
 void lw_thread_start (lw_thread ctx, void * param)
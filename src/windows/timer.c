@@ -41,7 +41,7 @@ struct _lw_timer
    HANDLE timer_handle;
    HANDLE shutdown_event;
 
-   lw_bool started;
+   lw_bool started, once;
 
    lw_timer_hook_tick on_tick;
 
@@ -85,6 +85,9 @@ static void timer_completion (void * ptr)
 {
    lw_timer ctx = (lw_timer) ptr;
 
+   if (ctx->once)
+      lw_timer_stop (ctx);
+
    if (ctx->on_tick)
       ctx->on_tick (ctx);
 }
@@ -107,22 +110,35 @@ void timer_thread (lw_timer ctx)
    }
 }
 
-void lw_timer_start (lw_timer ctx, long interval)
+static void timer_start (lw_timer ctx, long interval, lw_bool once)
 {
    lw_timer_stop (ctx);
 
    LARGE_INTEGER due_time;
    due_time.QuadPart = 0 - (interval * 1000 * 10);
 
-   if (!SetWaitableTimer (ctx->timer_handle, &due_time, interval, 0, 0, 0))
+   if (!SetWaitableTimer (ctx->timer_handle, &due_time,
+                          once ? 0 : interval, 0, 0, 0))
    {
       assert (0);
    }
 
    ctx->started = lw_true;
+   ctx->once = once;
+
    lw_pump_add_user (ctx->pump);
 }
 
+void lw_timer_start (lw_timer ctx, long interval)
+{
+   timer_start (ctx, interval, lw_false);
+}
+
+void lw_timer_start_once (lw_timer ctx, long delay)
+{
+   timer_start (ctx, delay, lw_true);
+}
+
 void lw_timer_stop (lw_timer ctx)
 {
    if (!lw_timer_started (ctx))
@@ -0,0 +1,432 @@
+
+/* vim: set et ts=3 sw=3 ft=c:
+ *
+ * Copyright (C) 2013 James McLaughlin et al.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+#include "workpool.h"
+
+struct work
+{
+   void (lw_callback * work) (void * param);
+   void (lw_callback * done) (void * param);
+
+   void * param;
+
+   /* The pool it was posted to, whose pump runs the done function
+    */
+   lwp_workpool pool;
+
+   /* For the pool's list of completed work
+    */
+   struct work * next;
+};
+
+struct worker
+{
+   lwp_workpool pool;
+
+   lw_thread thread;
+
+   lw_sync sync;
+
+   struct work * queue [lwp_workpool_queue_size];
+   size_t head, tail;
+};
+
+struct _lwp_workpool
+{
+   lw_pump pump;
+
+   /* If set, the pool whose workers run this pool's work
+    */
+   lwp_workpool shared;
+
+   lw_bool shutdown;
+
+   /* Guards pending, shutdown and signalled.  Idle workers sleep on
+    * work_available, which is only signalled while pending is non-zero.
+    */
+   lw_sync sync;
+   lw_event work_available;
+   lw_bool signalled;
+
+   long pending;
+
+   /* Work that has finished, waiting for its done function to be run on the
+    * pump.  Only one post to the pump is outstanding at a time.
+    */
+   struct work * completed, * completed_tail;
+   lw_bool completion_posted;
+
+   volatile long next_worker;
+
+   int num_workers;
+   struct worker workers [1];
+};
+
+static int num_cpus ()
+{
+   #ifdef _WIN32
+
+      SYSTEM_INFO info;
+      GetSystemInfo (&info);
+
+      return info.dwNumberOfProcessors;
+
+   #else
+
+      long num = sysconf (_SC_NPROCESSORS_ONLN);
+
+      return num > 0 ? num : 1;
+
+   #endif
+}
+
+static lw_bool push_back (struct worker * worker, struct work * work)
+{
+   lw_bool pushed = lw_false;
+
+   lw_sync_lock (worker->sync);
+
+   if (worker->tail - worker->head < lwp_workpool_queue_size)
+   {
+      worker->queue [worker->tail ++ % lwp_workpool_queue_size] = work;
+      pushed = lw_true;
+   }
+
+   lw_sync_release (worker->sync);
+
+   return pushed;
+}
+
+/* The owner takes the most recently pushed work, which is likeliest to still
+ * be in cache ...
+ */
+static struct work * pop_back (struct worker * worker)
+{
+   struct work * work = 0;
+
+   lw_sync_lock (worker->sync);
+
+   if (worker->tail != worker->head)
+      work = worker->queue [-- worker->tail % lwp_workpool_queue_size];
+
+   lw_sync_release (worker->sync);
+
+   return work;
+}
+
+/* ... while thieves take the oldest, so nothing is left waiting behind a
+ * busy owner for long.
+ */
+static struct work * steal_front (struct worker * worker)
+{
+   struct work * work = 0;
+
+   lw_sync_lock (worker->sync);
+
+   if (worker->tail != worker->head)
+      work = worker->queue [worker->head ++ % lwp_workpool_queue_size];
+
+   lw_sync_release (worker->sync);
+
+   return work;
+}
+
+static struct work * next_work (struct worker * worker)
+{
+   lwp_workpool pool = worker->pool;
+   struct work * work;
+   int index, i;
+
+   if ((work = pop_back (worker)))
+      return work;
+
+   index = worker - pool->workers;
+
+   for (i = 1; i < pool->num_workers; ++ i)
+   {
+      if ((work = steal_front (&pool->workers [(index + i) % pool->num_workers])))
+         return work;
+   }
+
+   return 0;
+}
+
+static void run_completed (lwp_workpool pool)
+{
+   lw_sync_lock (pool->sync);
+
+   struct work * work = pool->completed;
+
+   pool->completed = pool->completed_tail = 0;
+   pool->completion_posted = lw_false;
+
+   lw_sync_release (pool->sync);
+
+   while (work)
+   {
+      struct work * next = work->next;
+
+      if (work->done)
+         work->done (work->param);
+
+      lw_pump_remove_user (pool->pump);
+
+      free (work);
+
+      work = next;
+   }
+}
+
+static void work_completed (lwp_workpool pool, struct work * work)
+{
+   lw_bool post;
+
+   work->next = 0;
+
+   lw_sync_lock (pool->sync);
+
+   if (pool->completed_tail)
+      pool->completed_tail->next = work;
+   else
+      pool->completed = work;
+
+   pool->completed_tail = work;
+
+   post = !pool->completion_posted;
+   pool->completion_posted = lw_true;
+
+   lw_sync_release (pool->sync);
+
+   if (post)
+      lw_pump_post (pool->pump, run_completed, pool);
+}
+
+static int worker_proc (struct worker * worker)
+{
+   lwp_workpool pool = worker->pool;
+   struct work * work;
+
+   for (;;)
+   {
+      if ((work = next_work (worker)))
+      {
+         lw_sync_lock (pool->sync);
+         -- pool->pending;
+         lw_sync_release (pool->sync);
+
+         work->work (work->param);
+
+         work_completed (work->pool, work);
+
+         continue;
+      }
+
+      lw_sync_lock (pool->sync);
+
+      if (pool->pending == 0)
+      {
+         if (pool->shutdown)
+         {
+            lw_sync_release (pool->sync);
+            break;
+         }
+
+         if (pool->signalled)
+         {
+            lw_event_unsignal (pool->work_available);
+            pool->signalled = lw_false;
+         }
+      }
+
+      lw_sync_release (pool->sync);
+
+      lw_event_wait (pool->work_available, -1);
+   }
+
+   return 0;
+}
+
+lwp_workpool lwp_workpool_new (lw_pump pump, int num_workers)
+{
+   lwp_workpool ctx;
+   int i;
+
+   if (num_workers <= 0)
+      num_workers = num_cpus ();
+
+   ctx = calloc (sizeof (*ctx) + sizeof (struct worker) * (num_workers - 1), 1);
+
+   if (!ctx)
+      return 0;
+
+   ctx->pump = pump;
+   ctx->sync = lw_sync_new ();
+   ctx->work_available = lw_event_new ();
+   ctx->num_workers = num_workers;
+
+   for (i = 0; i < num_workers; ++ i)
+   {
+      struct worker * worker = &ctx->workers [i];
+
+      worker->pool = ctx;
+      worker->sync = lw_sync_new ();
+      worker->thread = lw_thread_new ("lw_workpool", worker_proc);
+
+      lw_thread_start (worker->thread, worker);
+   }
+
+   return ctx;
+}
+
+lwp_workpool lwp_workpool_new_shared (lw_pump pump, lwp_workpool workers)
+{
+   lwp_workpool ctx = calloc (sizeof (*ctx), 1);
+
+   if (!ctx)
+      return 0;
+
+   ctx->pump = pump;
+   ctx->shared = workers;
+   ctx->sync = lw_sync_new ();
+
+   return ctx;
+}
+
+void lwp_workpool_delete (lwp_workpool ctx)
+{
+   int i;
+
+   if (!ctx)
+      return;
+
+   if (ctx->shared)
+   {
+      run_completed (ctx);
+
+      lw_sync_delete (ctx->sync);
+      free (ctx);
+
+      return;
+   }
+
+   /* Workers finish anything still queued before they exit
+    */
+   lw_sync_lock (ctx->sync);
+
+   ctx->shutdown = lw_true;
+
+   if (!ctx->signalled)
+   {
+      lw_event_signal (ctx->work_available);
+      ctx->signalled = lw_true;
+   }
+
+   lw_sync_release (ctx->sync);
+
+   for (i = 0; i < ctx->num_workers; ++ i)
+   {
+      lw_thread_delete (ctx->workers [i].thread);
+      lw_sync_delete (ctx->workers [i].sync);
+   }
+
+   /* The pump is going away, so any completion posted to it will never run.
+    * Done functions still have to be called, as they release whatever the
+    * work was using.
+    */
+   run_completed (ctx);
+
+   lw_event_delete (ctx->work_available);
+   lw_sync_delete (ctx->sync);
+
+   free (ctx);
+}
+
+lw_bool lwp_workpool_post (lwp_workpool ctx, void * proc, void * done,
+                           void * param)
+{
+   struct work * work = malloc (sizeof (*work));
+   int first, i;
+
+   if (!work)
+      return lw_false;
+
+   work->work = proc;
+   work->done = done;
+   work->param = param;
+   work->pool = ctx;
+
+   if (ctx->shared)
+      ctx = ctx->shared;
+
+   /* Counted before the push, so that a worker taking the work straight
+    * away never sees pending go negative.
+    */
+   lw_sync_lock (ctx->sync);
+   ++ ctx->pending;
+   lw_sync_release (ctx->sync);
+
+   /* Work may be posted from any thread
+    */
+   #ifdef _WIN32
+      first = (unsigned long) (InterlockedIncrement (&ctx->next_worker) - 1)
+                  % ctx->num_workers;
+   #else
+      first = (unsigned long) __sync_fetch_and_add (&ctx->next_worker, 1)
+                  % ctx->num_workers;
+   #endif
+
+   for (i = 0; i < ctx->num_workers; ++ i)
+   {
+      if (push_back (&ctx->workers [(first + i) % ctx->num_workers], work))
+         break;
+   }
+
+   lw_sync_lock (ctx->sync);
+
+   if (i == ctx->num_workers)
+   {
+      -- ctx->pending;
+      lw_sync_release (ctx->sync);
+
+      free (work);
+      return lw_false;
+   }
+
+   if (!ctx->signalled)
+   {
+      lw_event_signal (ctx->work_available);
+      ctx->signalled = lw_true;
+   }
+
+   lw_sync_release (ctx->sync);
+
+   return lw_true;
+}
+
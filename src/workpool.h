@@ -0,0 +1,60 @@
+
+/* vim: set et ts=3 sw=3 ft=c:
+ *
+ * Copyright (C) 2013 James McLaughlin et al.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _lw_workpool_h
+#define _lw_workpool_h
+
+/* A pool of worker threads attached to a pump.  Each worker has a bounded
+ * deque of its own: new work is spread across the workers round-robin, a
+ * worker takes the newest work from the back of its own deque, and an idle
+ * worker steals the oldest from the front of the others.  Once the work
+ * function has run, the done function is run on the pump.
+ *
+ * Deleting the pool waits for any queued work, then runs the done functions
+ * that haven't been run yet on the calling thread.
+ *
+ * A shared pool has no workers of its own: its work goes to the workers of
+ * another pool, but is done on its own pump.  It must be deleted after that
+ * pool, so that none of its work is still running.
+ */
+
+#define lwp_workpool_queue_size  256
+
+typedef struct _lwp_workpool * lwp_workpool;
+
+lwp_workpool lwp_workpool_new (lw_pump, int num_workers);
+lwp_workpool lwp_workpool_new_shared (lw_pump, lwp_workpool workers);
+void lwp_workpool_delete (lwp_workpool);
+
+/* Returns false if every worker's queue is full
+ */
+lw_bool lwp_workpool_post (lwp_workpool, void * work, void * done, void * param);
+
+#endif
+
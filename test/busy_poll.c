@@ -0,0 +1,121 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+
+/* A busy polling pump has to deliver every event and fire timers on time
+ * while it spins, and has to go to sleep rather than spin once idle.
+ */
+
+#define num_messages 2000
+
+static lw_eventpump pump;
+static lw_pump_watch watch;
+static lw_timer timer;
+
+static int fds [2];
+static int num_received;
+
+static struct timespec timer_started;
+static long timer_late_us;
+
+static long elapsed_us (struct timespec * since)
+{
+   struct timespec now;
+   clock_gettime (CLOCK_MONOTONIC, &now);
+
+   return (now.tv_sec - since->tv_sec) * 1000000
+            + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+static void on_read_ready (void * tag)
+{
+   char c;
+
+   while (read (fds [1], &c, 1) == 1)
+   {
+      ++ num_received;
+      write (fds [1], &c, 1);
+   }
+}
+
+static void on_tick (lw_timer timer)
+{
+   timer_late_us = elapsed_us (&timer_started) - 100000;
+
+   lw_timer_stop (timer);
+   lw_eventpump_post_eventloop_exit (pump);
+}
+
+static void * peer (void * param)
+{
+   for (int i = 0; i < num_messages; ++ i)
+   {
+      char c = 'x';
+
+      write (fds [0], &c, 1);
+      assert (read (fds [0], &c, 1) == 1 && c == 'x');
+   }
+
+   /* Nothing else happens until the timer, which the pump should sleep
+    * until
+    */
+   clock_gettime (CLOCK_MONOTONIC, &timer_started);
+   lw_timer_start (timer, 100);
+
+   return 0;
+}
+
+int main (int argc, char * argv [])
+{
+   pump = lw_eventpump_new ();
+   assert (lw_eventpump_set_busy_poll (pump, 200));
+
+   socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+   fcntl (fds [1], F_SETFL, fcntl (fds [1], F_GETFL) | O_NONBLOCK);
+
+   watch = lw_pump_add ((lw_pump) pump, fds [1], 0, on_read_ready, 0, lw_false);
+
+   timer = lw_timer_new ((lw_pump) pump);
+   lw_timer_on_tick (timer, on_tick);
+
+   lw_thread thread = lw_thread_new ("peer", (void *) peer);
+   lw_thread_start (thread, 0);
+
+   clock_t cpu_started = clock ();
+
+   lw_eventpump_start_eventloop (pump);
+
+   long cpu_us = (long) ((clock () - cpu_started) * 1000000 / CLOCKS_PER_SEC);
+
+   lw_thread_join (thread);
+   lw_thread_delete (thread);
+
+   printf ("received %d, timer late by %ld us, %ld us cpu\n",
+              num_received, timer_late_us, cpu_us);
+
+   assert (num_received == num_messages);
+   /* Timers are kept in milliseconds
+    */
+   assert (timer_late_us > -1000 && timer_late_us < 50000);
+
+   /* The peer's thread is included, but the 100ms sleep mustn't be spent
+    * spinning
+    */
+   assert (cpu_us < 100000);
+
+   lw_pump_remove ((lw_pump) pump, watch);
+   lw_timer_delete (timer);
+   lw_pump_delete ((lw_pump) pump);
+
+   close (fds [0]);
+   close (fds [1]);
+
+   return 0;
+}
@@ -0,0 +1,136 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+
+/* Data written through a deflate filter has to inflate back to what went
+ * in, in each format and whether or not it's flushed as it goes.  The
+ * z_streams pooled by the worker threads are freed when they exit, so
+ * LeakSanitizer shouldn't report anything allocated by deflateInit2.
+ */
+
+#define input_size (256 * 1024)
+#define num_threads 8
+
+struct output
+{
+   unsigned char * data;
+   size_t length, size;
+};
+
+static char input [input_size];
+
+static void on_data (lw_stream stream, void * tag, const char * buffer,
+                     size_t length)
+{
+   struct output * output = tag;
+
+   if (output->length + length > output->size)
+   {
+      output->size = (output->length + length) * 2;
+      output->data = realloc (output->data, output->size);
+   }
+
+   memcpy (output->data + output->length, buffer, length);
+   output->length += length;
+}
+
+static void round_trip (lw_pump pump, int format, lw_bool auto_flush)
+{
+   static const int window_bits [] = { -MAX_WBITS, MAX_WBITS, MAX_WBITS + 16 };
+
+   struct output output = { 0 };
+
+   lw_stream filter = lw_deflate_filter_new (pump, 6, format);
+
+   assert (filter);
+
+   lw_deflate_filter_auto_flush (filter, auto_flush);
+   lw_stream_add_hook_data (filter, on_data, &output);
+
+   /* Uneven writes, so the flushes fall part way through the input
+    */
+   for (size_t offset = 0; offset < input_size; )
+   {
+      size_t size = 1 + rand () % 5000;
+
+      if (size > input_size - offset)
+         size = input_size - offset;
+
+      lw_stream_write (filter, input + offset, size);
+      offset += size;
+   }
+
+   lw_deflate_filter_finish (filter);
+   lw_stream_delete (filter);
+
+   assert (output.length > 0 && output.length < input_size);
+
+   char * inflated = malloc (input_size + 1);
+   z_stream z = { 0 };
+
+   assert (inflateInit2 (&z, window_bits [format]) == Z_OK);
+
+   z.next_in = output.data;
+   z.avail_in = (uInt) output.length;
+   z.next_out = (Bytef *) inflated;
+   z.avail_out = input_size + 1;
+
+   assert (inflate (&z, Z_FINISH) == Z_STREAM_END);
+   assert (z.total_out == input_size);
+   assert (!memcmp (inflated, input, input_size));
+
+   inflateEnd (&z);
+
+   free (inflated);
+   free (output.data);
+}
+
+static void * worker (void * param)
+{
+   lw_pump pump = (lw_pump) lw_eventpump_new ();
+
+   for (int format = lw_deflate_raw; format <= lw_deflate_gzip; ++ format)
+      round_trip (pump, format, lw_false);
+
+   lw_pump_delete (pump);
+
+   return 0;
+}
+
+int main (int argc, char * argv [])
+{
+   srand (argc > 1 ? atoi (argv [1]) : 1);
+
+   /* Compressible, but not trivially so
+    */
+   for (int i = 0; i < input_size; ++ i)
+      input [i] = "lacewing" [rand () % 8] + (i % 1024 == 0);
+
+   lw_pump pump = (lw_pump) lw_eventpump_new ();
+
+   for (int format = lw_deflate_raw; format <= lw_deflate_gzip; ++ format)
+   {
+      round_trip (pump, format, lw_true);
+      round_trip (pump, format, lw_false);
+   }
+
+   lw_pump_delete (pump);
+
+   pthread_t threads [num_threads];
+
+   for (int i = 0; i < num_threads; ++ i)
+      pthread_create (&threads [i], 0, worker, 0);
+
+   for (int i = 0; i < num_threads; ++ i)
+      pthread_join (threads [i], 0);
+
+   printf ("OK\n");
+
+   return 0;
+}
@@ -0,0 +1,115 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+/* Runs a pump from a poll() loop of our own through lw_eventpump_fd and
+ * lw_eventpump_dispatch, with no watcher thread: more ready watches than
+ * one batch holds, posts from another thread and a timer all get through.
+ */
+
+#define num_pipes 40
+#define num_posts 1000
+
+static lw_eventpump pump;
+static lw_timer timer;
+
+static int pipes [num_pipes][2];
+static lw_pump_watch watches [num_pipes];
+
+static int num_read, num_run, num_ticks;
+
+static void on_read_ready (void * tag)
+{
+   char c;
+
+   while (read (pipes [(long) tag][0], &c, 1) == 1)
+      ++ num_read;
+}
+
+static void on_post (void * param)
+{
+   ++ num_run;
+}
+
+static void on_tick (lw_timer timer)
+{
+   if (++ num_ticks == 5)
+      lw_timer_stop (timer);
+}
+
+static void * poster (void * param)
+{
+   for (int i = 0; i < num_posts; ++ i)
+      lw_pump_post ((lw_pump) pump, (void *) on_post, 0);
+
+   return 0;
+}
+
+int main (int argc, char * argv [])
+{
+   pump = lw_eventpump_new ();
+
+   for (long i = 0; i < num_pipes; ++ i)
+   {
+      pipe (pipes [i]);
+      fcntl (pipes [i][0], F_SETFL, O_NONBLOCK);
+
+      watches [i] = lw_pump_add ((lw_pump) pump, pipes [i][0], (void *) i,
+                                 on_read_ready, 0, lw_true);
+
+      write (pipes [i][1], "xy", 2);
+   }
+
+   timer = lw_timer_new ((lw_pump) pump);
+   lw_timer_on_tick (timer, on_tick);
+   lw_timer_start (timer, 10);
+
+   lw_thread thread = lw_thread_new ("poster", (void *) poster);
+   lw_thread_start (thread, 0);
+
+   int num_polls = 0;
+
+   while (num_read < num_pipes * 2 || num_run < num_posts || num_ticks < 5)
+   {
+      struct pollfd pfd = { lw_eventpump_fd (pump), POLLIN, 0 };
+
+      long timeout = lw_eventpump_timeout (pump);
+
+      assert (timeout != -1 || num_ticks == 5);
+      assert (poll (&pfd, 1, timeout == -1 ? 1000 : (int) timeout) >= 0);
+
+      lw_eventpump_dispatch (pump);
+
+      ++ num_polls;
+      assert (num_polls < 10000);
+   }
+
+   lw_thread_join (thread);
+   lw_thread_delete (thread);
+
+   printf ("read %d, %d posts, %d ticks in %d polls\n",
+             num_read, num_run, num_ticks, num_polls);
+
+   /* Nothing left over for the next poll
+    */
+   assert (lw_eventpump_timeout (pump) == -1);
+
+   for (int i = 0; i < num_pipes; ++ i)
+   {
+      lw_pump_remove ((lw_pump) pump, watches [i]);
+
+      close (pipes [i][0]);
+      close (pipes [i][1]);
+   }
+
+   lw_timer_delete (timer);
+   lw_pump_delete ((lw_pump) pump);
+
+   return 0;
+}
@@ -0,0 +1,170 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+/* Regular files are read and written on the pump's worker pool.  Data
+ * written in uneven pieces, copied to another file and then sent to a
+ * socket (with sendfile) has to come out the same at each step.
+ */
+
+#define file_size (3 * 1024 * 1024 + 123)
+
+static lw_eventpump pump;
+static char * contents;
+
+static void exit_on_close (lw_stream stream, void * tag)
+{
+   lw_eventpump_post_eventloop_exit (pump);
+}
+
+static void close_on_close (lw_stream stream, void * tag)
+{
+   lw_stream_close ((lw_stream) tag, lw_false);
+}
+
+static void check_file (const char * filename)
+{
+   char * data = malloc (file_size + 1);
+
+   FILE * file = fopen (filename, "rb");
+   assert (fread (data, 1, file_size + 1, file) == file_size);
+   fclose (file);
+
+   assert (!memcmp (data, contents, file_size));
+
+   free (data);
+}
+
+static void write_file (void)
+{
+   lw_file file = lw_file_new_open ((lw_pump) pump, "file_async.1", "wb");
+
+   assert (file);
+
+   lw_stream_add_hook_close ((lw_stream) file, exit_on_close, 0);
+
+   for (size_t offset = 0; offset < file_size; )
+   {
+      size_t size = 1 + rand () % 100000;
+
+      if (size > file_size - offset)
+         size = file_size - offset;
+
+      lw_stream_write ((lw_stream) file, contents + offset, size);
+      offset += size;
+   }
+
+   /* Waits for the writes still running or queued */
+
+   lw_stream_close ((lw_stream) file, lw_false);
+   lw_eventpump_start_eventloop (pump);
+
+   /* Deleting it would run the close hooks again */
+
+   lw_stream_remove_hook_close ((lw_stream) file, exit_on_close, 0);
+   lw_stream_delete ((lw_stream) file);
+
+   check_file ("file_async.1");
+}
+
+static void copy_file (void)
+{
+   lw_file source = lw_file_new_open ((lw_pump) pump, "file_async.1", "rb");
+   lw_file dest = lw_file_new_open ((lw_pump) pump, "file_async.2", "wb");
+
+   assert (source && dest);
+
+   lw_stream_add_hook_close ((lw_stream) source, close_on_close, dest);
+   lw_stream_add_hook_close ((lw_stream) dest, exit_on_close, 0);
+
+   /* The source is deleted once it's all been written, which closes dest */
+
+   lw_stream_write_stream ((lw_stream) dest, (lw_stream) source, -1, lw_true);
+
+   lw_eventpump_start_eventloop (pump);
+
+   lw_stream_remove_hook_close ((lw_stream) dest, exit_on_close, 0);
+   lw_stream_delete ((lw_stream) dest);
+
+   check_file ("file_async.2");
+}
+
+static int fds [2];
+static char * received;
+
+static void * receive (void * param)
+{
+   size_t length = 0;
+
+   while (length < file_size)
+   {
+      ssize_t bytes = read (fds [1], received + length, file_size - length);
+
+      assert (bytes > 0);
+      length += bytes;
+   }
+
+   return 0;
+}
+
+static void send_file (void)
+{
+   socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+
+   received = malloc (file_size);
+
+   pthread_t thread;
+   pthread_create (&thread, 0, receive, 0);
+
+   lw_fdstream socket = lw_fdstream_new ((lw_pump) pump);
+   lw_fdstream_set_fd (socket, fds [0], 0, lw_true);
+
+   lw_stream_write_file ((lw_stream) socket, "file_async.2");
+   lw_stream_add_hook_close ((lw_stream) socket, exit_on_close, 0);
+
+   lw_stream_close ((lw_stream) socket, lw_false);
+   lw_eventpump_start_eventloop (pump);
+
+   pthread_join (thread, 0);
+
+   assert (!memcmp (received, contents, file_size));
+
+   lw_stream_remove_hook_close ((lw_stream) socket, exit_on_close, 0);
+   lw_stream_delete ((lw_stream) socket);
+
+   close (fds [1]);
+   free (received);
+}
+
+int main (int argc, char * argv [])
+{
+   srand (argc > 1 ? atoi (argv [1]) : 1);
+
+   contents = malloc (file_size);
+
+   for (int i = 0; i < file_size; ++ i)
+      contents [i] = (char) rand ();
+
+   pump = lw_eventpump_new ();
+
+   write_file ();
+   copy_file ();
+   send_file ();
+
+   printf ("OK\n");
+
+   unlink ("file_async.1");
+   unlink ("file_async.2");
+
+   lw_pump_delete ((lw_pump) pump);
+   free (contents);
+
+   return 0;
+}
@@ -0,0 +1,114 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* A file too big for the mapping cache is read from its own mapping.  If
+ * another file is renamed over it part way through, the rest comes from the
+ * old mapping as before; if it's truncated instead, the stream stops short
+ * rather than faulting on the pages past the new end.  A small file comes
+ * from the cache, which keeps a copy, so it's read in full either way.
+ */
+
+#define file_size (4 * 1024 * 1024)
+#define small_size (512 * 1024)
+
+static const char * filename = "file_map.tmp";
+static char * contents;
+
+static size_t received, size;
+static int replace;
+
+static void on_data (lw_stream stream, void * tag, const char * buffer,
+                     size_t length)
+{
+   assert (!memcmp (buffer, contents + received, length));
+
+   if (received == 0)
+   {
+      if (replace)
+      {
+         FILE * file = fopen ("file_map.new", "wb");
+         fputs ("replaced", file);
+         fclose (file);
+
+         assert (rename ("file_map.new", filename) == 0);
+      }
+      else
+         assert (truncate (filename, 0) == 0);
+   }
+
+   received += length;
+
+   if (received == size)
+      lw_eventpump_post_eventloop_exit ((lw_eventpump) tag);
+}
+
+static void on_close (lw_stream stream, void * tag)
+{
+   lw_eventpump_post_eventloop_exit ((lw_eventpump) tag);
+}
+
+static size_t send_file (lw_eventpump pump, size_t length)
+{
+   FILE * file = fopen (filename, "wb");
+   fwrite (contents, 1, length, file);
+   fclose (file);
+
+   received = 0;
+   size = length;
+
+   lw_file source = lw_file_new_open ((lw_pump) pump, filename, "rbm");
+
+   assert (source);
+
+   lw_stream_add_hook_data ((lw_stream) source, on_data, pump);
+   lw_stream_add_hook_close ((lw_stream) source, on_close, pump);
+
+   lw_stream_read ((lw_stream) source, -1);
+   lw_eventpump_start_eventloop (pump);
+
+   lw_stream_delete ((lw_stream) source);
+
+   return received;
+}
+
+int main (int argc, char * argv [])
+{
+   contents = malloc (file_size);
+
+   for (int i = 0; i < file_size; ++ i)
+      contents [i] = (char) rand ();
+
+   lw_eventpump pump = lw_eventpump_new ();
+
+   replace = 1;
+   size_t replaced = send_file (pump, file_size);
+
+   replace = 0;
+   size_t truncated = send_file (pump, file_size);
+
+   printf ("%d bytes after a rename, %d after a truncate\n",
+           (int) replaced, (int) truncated);
+
+   assert (replaced == file_size);
+   assert (truncated > 0 && truncated < file_size);
+
+   size_t small_truncated = send_file (pump, small_size);
+
+   printf ("%d bytes of a small file after a truncate\n",
+           (int) small_truncated);
+
+   assert (small_truncated == small_size);
+
+   unlink (filename);
+
+   lw_pump_delete ((lw_pump) pump);
+   free (contents);
+
+   return 0;
+}
@@ -0,0 +1,95 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A sink with an upstream filter only takes part of what it's given, so the
+ * rest (already filtered) is queued.  When the queue drains, that data has
+ * to go straight to the sink rather than through the filter a second time.
+ */
+
+#define size 20
+
+static char received [size * 2];
+static size_t num_received, sink_limit;
+
+static size_t plus_one (lw_stream stream, const char * buffer, size_t length)
+{
+   char * copy = malloc (length);
+
+   for (size_t i = 0; i < length; ++ i)
+      copy [i] = buffer [i] + 1;
+
+   lw_stream_data (stream, copy, length);
+
+   free (copy);
+
+   return length;
+}
+
+static size_t sink_data (lw_stream stream, const char * buffer, size_t length)
+{
+   if (length > sink_limit)
+      length = sink_limit;
+
+   assert (num_received + length <= sizeof (received));
+
+   memcpy (received + num_received, buffer, length);
+
+   num_received += length;
+   sink_limit -= length;
+
+   return length;
+}
+
+static const lw_streamdef def_filter =
+{
+   .sink_data = plus_one
+};
+
+static const lw_streamdef def_sink =
+{
+   .sink_data = sink_data
+};
+
+int main (int argc, char * argv [])
+{
+   lw_pump pump = (lw_pump) lw_eventpump_new ();
+
+   lw_stream sink = lw_stream_new (&def_sink, pump);
+   lw_stream filter = lw_stream_new (&def_filter, pump);
+
+   lw_stream_add_filter_upstream (sink, filter, lw_true, lw_false);
+
+   char data [size];
+
+   for (int i = 0; i < size; ++ i)
+      data [i] = 'a' + i;
+
+   /* Half goes straight through, and the rest waits
+    */
+   sink_limit = size / 2;
+
+   lw_stream_write (sink, data, size);
+
+   assert (num_received == size / 2);
+
+   sink_limit = -1;
+   lw_stream_retry (sink, lw_stream_retry_now);
+
+   printf ("%d bytes received: %.*s\n", (int) num_received,
+            (int) num_received, received);
+
+   assert (num_received == size);
+
+   for (int i = 0; i < size; ++ i)
+      assert (received [i] == data [i] + 1);
+
+   lw_stream_delete (sink);
+   lw_pump_delete (pump);
+
+   return 0;
+}
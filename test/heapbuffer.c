@@ -0,0 +1,145 @@
+
+#include "../src/common.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* Random adds and trims checked against a plain copy of the data, and the
+ * reset/shrink rules: resetting (or trimming everything) never frees the
+ * buffer, since a parser may still be reading it, and only shrink gives
+ * back a big one.
+ *
+ * The threads at the end leave blocks in their pools when they exit; run
+ * under LeakSanitizer to check those are freed.
+ */
+
+static char reference [1024 * 1024];
+static size_t ref_start, ref_end;
+
+static void fuzz (void)
+{
+   lwp_heapbuffer buffer = 0;
+   char data [8192];
+
+   for (int i = 0; i < sizeof (data); ++ i)
+      data [i] = (char) rand ();
+
+   ref_start = ref_end = 0;
+
+   for (int i = 0; i < 20000; ++ i)
+   {
+      size_t length = lwp_heapbuffer_length (&buffer);
+
+      if (rand () % 3 && ref_end + sizeof (data) < sizeof (reference))
+      {
+         size_t size = rand () % sizeof (data);
+
+         assert (lwp_heapbuffer_add (&buffer, data, size));
+
+         memcpy (reference + ref_end, data, size);
+         ref_end += size;
+      }
+      else if (length > 0)
+      {
+         size_t size = rand () % (length + 1);
+
+         lwp_heapbuffer_trim_left (&buffer, size);
+         ref_start += size;
+      }
+
+      if (ref_start == ref_end)
+         ref_start = ref_end = 0;
+
+      assert (lwp_heapbuffer_length (&buffer) == ref_end - ref_start);
+
+      if (ref_end > ref_start)
+      {
+         assert (!memcmp (lwp_heapbuffer_buffer (&buffer),
+                          reference + ref_start, ref_end - ref_start));
+      }
+   }
+
+   lwp_heapbuffer_free (&buffer);
+}
+
+static void test_reset (void)
+{
+   static char big [256 * 1024];
+
+   lwp_heapbuffer buffer = 0;
+
+   assert (lwp_heapbuffer_add (&buffer, big, sizeof (big)));
+
+   lwp_heapbuffer kept = buffer;
+   char * data = lwp_heapbuffer_buffer (&buffer);
+
+   lwp_heapbuffer_reset (&buffer);
+
+   assert (buffer == kept);
+   assert (lwp_heapbuffer_length (&buffer) == 0);
+
+   assert (lwp_heapbuffer_add (&buffer, big, sizeof (big)));
+   lwp_heapbuffer_trim_left (&buffer, sizeof (big));
+
+   assert (buffer == kept);
+   assert (lwp_heapbuffer_buffer (&buffer) == data);
+
+   /* Not empty, so shrink leaves it alone */
+
+   lwp_heapbuffer_add (&buffer, "x", 1);
+   lwp_heapbuffer_shrink (&buffer);
+
+   assert (buffer == kept);
+
+   lwp_heapbuffer_reset (&buffer);
+   lwp_heapbuffer_shrink (&buffer);
+
+   assert (buffer == 0);
+
+   /* A small buffer is worth keeping */
+
+   lwp_heapbuffer_add (&buffer, "hello", 5);
+   kept = buffer;
+
+   lwp_heapbuffer_reset (&buffer);
+   lwp_heapbuffer_shrink (&buffer);
+
+   assert (buffer == kept);
+
+   lwp_heapbuffer_free (&buffer);
+}
+
+static void * pool_thread (void * param)
+{
+   lwp_heapbuffer buffers [32] = {};
+
+   for (int i = 0; i < 32; ++ i)
+      lwp_heapbuffer_addf (&buffers [i], "%*s", 64 << (i % 10), "");
+
+   for (int i = 0; i < 32; ++ i)
+      lwp_heapbuffer_free (&buffers [i]);
+
+   return 0;
+}
+
+int main (int argc, char * argv [])
+{
+   srand (argc > 1 ? atoi (argv [1]) : 1);
+
+   test_reset ();
+   fuzz ();
+
+   for (int i = 0; i < 8; ++ i)
+   {
+      pthread_t thread;
+
+      pthread_create (&thread, 0, pool_thread, 0);
+      pthread_join (thread, 0);
+   }
+
+   printf ("ok\n");
+
+   return 0;
+}
@@ -6,8 +6,30 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <pthread.h>
 
-int main (int argc, char * argv [])
+/* Values for the fuzz test: small enough to be inline in the head, pooled,
+ * and too big for the pools (so malloc'd).
+ */
+
+struct small
+{
+   char value;
+};
+
+struct medium
+{
+   int value;
+   char padding [100];
+};
+
+struct big
+{
+   int value;
+   char padding [300];
+};
+
+static void test_basic (void)
 {
    list (int, list);
    memset (&list, 0, sizeof (list));
@@ -80,6 +102,132 @@ int main (int argc, char * argv [])
 
    assert (list_length (list) == 0);
 
+   list_clear (list);
+}
+
+/* Random operations on a list, checked against an array of what should be
+ * in it, in order both ways.
+ */
+
+#define fuzz_max 200
+
+#define fuzz(list, model, length, next)                                       \
+do {                                                                          \
+   int op = rand () % 8;                                                      \
+                                                                              \
+   if (op <= 1 && length < fuzz_max)                                          \
+   {                                                                          \
+      list_push (list, ((typeof (*list)) { next }));                          \
+      model [length ++] = next ++;                                            \
+   }                                                                          \
+   else if (op == 2 && length < fuzz_max)                                     \
+   {                                                                          \
+      list_push_front (list, ((typeof (*list)) { next }));                    \
+      memmove (model + 1, model, sizeof (*model) * length ++);                \
+      model [0] = next ++;                                                    \
+   }                                                                          \
+   else if (op == 3 && length > 0)                                            \
+   {                                                                          \
+      list_pop_front (list);                                                  \
+      memmove (model, model + 1, sizeof (*model) * -- length);                \
+   }                                                                          \
+   else if (op == 4 && length > 0)                                            \
+   {                                                                          \
+      list_pop_back (list);                                                   \
+      -- length;                                                              \
+   }                                                                          \
+   else if (op == 5 && length > 0)                                            \
+   {                                                                          \
+      /* Remove one from the middle while iterating */                        \
+                                                                              \
+      int index = rand () % length, i = 0;                                    \
+                                                                              \
+      list_each_elem (list, elem)                                             \
+      {                                                                       \
+         if (i ++ == index)                                                   \
+         {                                                                    \
+            assert (elem->value == model [index]);                            \
+            list_elem_remove (elem);                                          \
+         }                                                                    \
+      }                                                                       \
+                                                                              \
+      memmove (model + index, model + index + 1,                              \
+               sizeof (*model) * (-- length - index));                        \
+   }                                                                          \
+   else if (op == 6 && rand () % 50 == 0)                                     \
+   {                                                                          \
+      list_clear (list);                                                      \
+      length = 0;                                                             \
+   }                                                                          \
+                                                                              \
+   assert (list_length (list) == length);                                     \
+                                                                              \
+   int i = 0;                                                                 \
+                                                                              \
+   list_each_elem (list, elem)                                                \
+      assert (elem->value == model [i ++]);                                   \
+                                                                              \
+   list_each_r_elem (list, elem)                                              \
+      assert (elem->value == model [-- i]);                                   \
+                                                                              \
+   assert (i == 0);                                                           \
+} while (0)
+
+static void test_fuzz (int iterations)
+{
+   list (struct small, smalls);
+   list (struct medium, mediums);
+   list (struct big, bigs);
+
+   int model_smalls [fuzz_max], model_mediums [fuzz_max], model_bigs [fuzz_max];
+   size_t num_smalls = 0, num_mediums = 0, num_bigs = 0;
+   int next_small = 0, next_medium = 0, next_big = 0;
+
+   memset (&smalls, 0, sizeof (smalls));
+   memset (&mediums, 0, sizeof (mediums));
+   memset (&bigs, 0, sizeof (bigs));
+
+   for (int n = 0; n < iterations; ++ n)
+   {
+      next_small %= 100;  /* has to fit in a char */
+
+      fuzz (smalls, model_smalls, num_smalls, next_small);
+      fuzz (mediums, model_mediums, num_mediums, next_medium);
+      fuzz (bigs, model_bigs, num_bigs, next_big);
+   }
+
+   list_clear (smalls);
+   list_clear (mediums);
+   list_clear (bigs);
+}
+
+/* Threads that leave nodes in their pools when they exit (which shows up
+ * under LeakSanitizer if the pools aren't freed)
+ */
+
+static void * fuzz_thread (void * param)
+{
+   test_fuzz (2000);
+   return 0;
+}
+
+int main (int argc, char * argv [])
+{
+   srand (argc > 1 ? atoi (argv [1]) : 1);
+
+   test_basic ();
+   test_fuzz (100000);
+
+   pthread_t threads [8];
+
+   for (int i = 0; i < 8; ++ i)
+      pthread_create (&threads [i], 0, fuzz_thread, 0);
+
+   for (int i = 0; i < 8; ++ i)
+      pthread_join (threads [i], 0);
+
+   printf ("OK\n");
+
    return 0;
 }
 
@@ -0,0 +1,76 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* Posts from several threads at once, enough to overflow the post ring.
+ * Each thread's posts must all run, in the order they were made.
+ */
+
+#define num_posters 4
+#define posts_each 20000
+
+struct post
+{
+   int poster, seq;
+};
+
+static lw_eventpump pump;
+
+static int next_seq [num_posters];
+static long num_run;
+
+static void on_post (struct post * post)
+{
+   assert (post->seq == next_seq [post->poster]);
+   ++ next_seq [post->poster];
+
+   free (post);
+
+   if (++ num_run == num_posters * posts_each)
+      lw_eventpump_post_eventloop_exit (pump);
+}
+
+static void * poster (void * param)
+{
+   int index = (int) (long) param;
+
+   for (int i = 0; i < posts_each; ++ i)
+   {
+      struct post * post = malloc (sizeof (*post));
+
+      post->poster = index;
+      post->seq = i;
+
+      lw_pump_post ((lw_pump) pump, (void *) on_post, post);
+   }
+
+   return 0;
+}
+
+int main (int argc, char * argv [])
+{
+   pump = lw_eventpump_new ();
+
+   pthread_t posters [num_posters];
+
+   for (long i = 0; i < num_posters; ++ i)
+      pthread_create (&posters [i], 0, poster, (void *) i);
+
+   lw_eventpump_start_eventloop (pump);
+
+   for (int i = 0; i < num_posters; ++ i)
+      pthread_join (posters [i], 0);
+
+   printf ("%ld posts run\n", num_run);
+
+   for (int i = 0; i < num_posters; ++ i)
+      assert (next_seq [i] == posts_each);
+
+   lw_pump_delete ((lw_pump) pump);
+
+   return 0;
+}
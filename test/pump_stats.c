@@ -0,0 +1,97 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Event loop instrumentation: posts, timers and watch callbacks are counted
+ * once stats are enabled, and a slow callback shows up as the slowest.
+ */
+
+static lw_eventpump pump;
+static lw_timer timer;
+static lw_pump_watch watch;
+
+static int fds [2];
+static int num_posts, num_ticks;
+
+static void on_post (void * param)
+{
+   ++ num_posts;
+}
+
+static void on_read_ready (void * tag)
+{
+   char buffer [16];
+   read (fds [0], buffer, sizeof (buffer));
+
+   usleep (20000);
+
+   lw_pump_remove ((lw_pump) pump, watch);
+}
+
+static void on_tick (lw_timer timer)
+{
+   if (++ num_ticks == 3)
+   {
+      lw_timer_stop (timer);
+      lw_eventpump_post_eventloop_exit (pump);
+   }
+}
+
+int main (int argc, char * argv [])
+{
+   pump = lw_eventpump_new ();
+
+   lw_pump_stats stats;
+
+   assert (!lw_eventpump_get_stats (pump, &stats));
+
+   assert (lw_eventpump_enable_stats (pump, lw_true));
+
+   for (int i = 0; i < 100; ++ i)
+      lw_pump_post ((lw_pump) pump, (void *) on_post, 0);
+
+   pipe (fds);
+   watch = lw_pump_add ((lw_pump) pump, fds [0], (void *) 0x1234,
+                        on_read_ready, 0, lw_false);
+   write (fds [1], "x", 1);
+
+   timer = lw_timer_new ((lw_pump) pump);
+   lw_timer_on_tick (timer, on_tick);
+   lw_timer_start (timer, 10);
+
+   lw_eventpump_start_eventloop (pump);
+
+   assert (lw_eventpump_get_stats (pump, &stats));
+
+   printf ("%llu posts, %llu timers, %llu events, slowest %llu us\n",
+           (unsigned long long) stats.posts,
+           (unsigned long long) stats.timers,
+           (unsigned long long) stats.events,
+           (unsigned long long) stats.slowest_us);
+
+   assert (num_posts == 100);
+   assert (stats.posts >= 100);
+   assert (stats.timers == 3);
+   assert (stats.timer_lag_us.count == 3);
+   assert (stats.events >= 1);
+   assert (stats.callback_us.count >= 1);
+   assert (stats.slowest_us >= 20000);
+   assert (stats.slowest_tag == (void *) 0x1234);
+
+   lw_eventpump_reset_stats (pump);
+   lw_eventpump_get_stats (pump, &stats);
+
+   assert (stats.posts == 0 && stats.timers == 0 && stats.slowest_us == 0);
+
+   lw_timer_delete (timer);
+   lw_pump_delete ((lw_pump) pump);
+
+   close (fds [0]);
+   close (fds [1]);
+
+   return 0;
+}
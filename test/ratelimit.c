@@ -0,0 +1,93 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* Data written in one go through a rate limit comes out at the rate, after
+ * the first burst - and all at once when the limit is lifted.
+ */
+
+#define rate (256 * 1024)
+#define burst (32 * 1024)
+#define total (rate + burst)
+
+static lw_eventpump pump;
+static lw_stream limit;
+
+static char input [total];
+static size_t received;
+
+static double now_ms (void)
+{
+   struct timeval tv;
+   gettimeofday (&tv, 0);
+
+   return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void on_data (lw_stream stream, void * tag, const char * buffer,
+                     size_t length)
+{
+   assert (!memcmp (buffer, input + received, length));
+
+   received += length;
+
+   if (received == total)
+      lw_eventpump_post_eventloop_exit (pump);
+}
+
+static double run (void)
+{
+   received = 0;
+
+   double start = now_ms ();
+
+   lw_stream_write (limit, input, total);
+   lw_eventpump_start_eventloop (pump);
+
+   return now_ms () - start;
+}
+
+int main (int argc, char * argv [])
+{
+   for (int i = 0; i < total; ++ i)
+      input [i] = (char) rand ();
+
+   pump = lw_eventpump_new ();
+
+   limit = lw_ratelimit_new ((lw_pump) pump, rate, burst);
+   lw_stream_add_hook_data (limit, on_data, 0);
+
+   /* The burst goes straight away, leaving the bucket empty for the rest
+    */
+   lw_stream_write (limit, input, burst);
+
+   assert (received == burst);
+
+   received = 0;
+
+   double elapsed = run ();
+
+   printf ("%d bytes at %d/s in %.0f ms\n", total, rate, elapsed);
+
+   assert (elapsed > 900 && elapsed < 1500);
+
+   /* Lifted, nothing is held back
+    */
+   lw_ratelimit_set (limit, 0, 0);
+
+   elapsed = run ();
+
+   printf ("%d bytes unlimited in %.0f ms\n", total, elapsed);
+
+   assert (elapsed < 100);
+
+   lw_stream_delete (limit);
+   lw_pump_delete ((lw_pump) pump);
+
+   return 0;
+}
@@ -0,0 +1,104 @@
+
+#include "../src/common.h"
+#include "../src/refbuffer.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* References to one refbuffer taken and dropped from several threads at
+ * once: the free function has to run exactly once, after the last release.
+ *
+ * Pooled buffers released by a thread stay in its pool until it exits; run
+ * under LeakSanitizer to check they're freed then.
+ */
+
+#define num_threads 4
+#define num_refs 100000
+
+static lwp_refbuffer refbuffer;
+static volatile long num_freed;
+
+static void on_free (void * tag)
+{
+   assert (tag == (void *) 0x1234);
+   __sync_add_and_fetch (&num_freed, 1);
+}
+
+static void * worker (void * param)
+{
+   for (int i = 0; i < num_refs; ++ i)
+   {
+      lwp_refbuffer_retain (refbuffer);
+      lwp_refbuffer_retain (refbuffer);
+
+      lwp_refbuffer_release (refbuffer);
+      lwp_refbuffer_release (refbuffer);
+   }
+
+   /* Each thread was handed a reference of its own
+    */
+   lwp_refbuffer_release (refbuffer);
+
+   return 0;
+}
+
+static void * pool_thread (void * param)
+{
+   lwp_refbuffer buffers [8];
+
+   for (int i = 0; i < 8; ++ i)
+      buffers [i] = lwp_refbuffer_new_pooled (1 << (i + 8));
+
+   for (int i = 0; i < 8; ++ i)
+      lwp_refbuffer_release (buffers [i]);
+
+   return 0;
+}
+
+int main (int argc, char * argv [])
+{
+   static char data [64];
+
+   refbuffer = lwp_refbuffer_new (data, sizeof (data), on_free, (void *) 0x1234);
+
+   for (int i = 0; i < num_threads - 1; ++ i)
+      lwp_refbuffer_retain (refbuffer);
+
+   pthread_t threads [num_threads];
+
+   for (int i = 0; i < num_threads; ++ i)
+      pthread_create (&threads [i], 0, worker, 0);
+
+   for (int i = 0; i < num_threads; ++ i)
+      pthread_join (threads [i], 0);
+
+   printf ("freed %ld times\n", num_freed);
+
+   assert (num_freed == 1);
+
+   /* Pooled buffers are recycled by size class
+    */
+   lwp_refbuffer pooled = lwp_refbuffer_new_pooled (100);
+
+   assert (pooled->length >= 100);
+   assert (lwp_refbuffer_contains (pooled, pooled->buffer, pooled->length));
+   assert (!lwp_refbuffer_contains (pooled, pooled->buffer, pooled->length + 1));
+
+   lwp_refbuffer_release (pooled);
+
+   assert (lwp_refbuffer_new_pooled (100) == pooled);
+
+   lwp_refbuffer_release (pooled);
+
+   for (int i = 0; i < 4; ++ i)
+   {
+      pthread_t thread;
+
+      pthread_create (&thread, 0, pool_thread, 0);
+      pthread_join (thread, 0);
+   }
+
+   return 0;
+}
@@ -0,0 +1,105 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <semaphore.h>
+
+/* Sleepy ticking with watches being removed and re-added from their own
+ * callbacks.  A removed watch mustn't be reused while the watcher thread
+ * could still be reading it, or its events would go to the new watch.
+ */
+
+#define num_pipes 8
+#define num_rounds 20000
+
+static lw_eventpump pump;
+static sem_t tick_needed;
+
+static struct
+{
+   int fds [2];
+   lw_pump_watch watch;
+   int live;
+
+} pipes [num_pipes];
+
+static long num_read;
+
+static void on_read_ready (void * tag)
+{
+   long index = (long) tag;
+
+   assert (pipes [index].live);
+
+   char c;
+
+   if (read (pipes [index].fds [0], &c, 1) != 1)
+      return;
+
+   assert (c == (char) index);
+
+   ++ num_read;
+
+   /* Swap the watch for a new one, which will probably get the same slot
+    */
+   lw_pump_remove ((lw_pump) pump, pipes [index].watch);
+
+   pipes [index].watch = lw_pump_add ((lw_pump) pump, pipes [index].fds [0],
+                                      tag, on_read_ready, 0, lw_false);
+}
+
+static void on_tick_needed (lw_eventpump pump)
+{
+   sem_post (&tick_needed);
+}
+
+int main (int argc, char * argv [])
+{
+   pump = lw_eventpump_new ();
+   sem_init (&tick_needed, 0, 0);
+
+   for (long i = 0; i < num_pipes; ++ i)
+   {
+      pipe (pipes [i].fds);
+      fcntl (pipes [i].fds [0], F_SETFL, O_NONBLOCK);
+
+      pipes [i].live = 1;
+      pipes [i].watch = lw_pump_add ((lw_pump) pump, pipes [i].fds [0],
+                                     (void *) i, on_read_ready, 0, lw_false);
+   }
+
+   lw_eventpump_start_sleepy_ticking (pump, on_tick_needed);
+
+   for (int round = 0; round < num_rounds; ++ round)
+   {
+      char c = (char) (round % num_pipes);
+      write (pipes [(int) c].fds [1], &c, 1);
+
+      /* Ticking when the watcher hasn't asked for it as well, so that it's
+       * still draining while watches are removed
+       */
+      if (sem_trywait (&tick_needed) == 0 || round % 3 == 0)
+         lw_eventpump_tick (pump);
+   }
+
+   while (num_read < num_rounds)
+   {
+      sem_wait (&tick_needed);
+      lw_eventpump_tick (pump);
+   }
+
+   printf ("%ld read\n", num_read);
+
+   assert (num_read == num_rounds);
+
+   for (int i = 0; i < num_pipes; ++ i)
+      lw_pump_remove ((lw_pump) pump, pipes [i].watch);
+
+   lw_pump_delete ((lw_pump) pump);
+
+   return 0;
+}
@@ -0,0 +1,113 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/* One socket written to another (which uses splice where it's available),
+ * with the reader hanging up part way through.  Whether SIGPIPE is ignored
+ * or not, the process must survive, and SIGPIPE mustn't be left blocked or
+ * pending afterwards.  Each case runs in a child process, as the
+ * disposition is only checked once.
+ */
+
+static int a [2], b [2];
+static lw_eventpump pump;
+
+static void * writer (void * param)
+{
+   char buffer [65536] = {};
+
+   for (int i = 0; i < 256; ++ i)
+   {
+      if (write (a [0], buffer, sizeof (buffer)) <= 0)
+         break;
+   }
+
+   return 0;
+}
+
+static void * reader (void * param)
+{
+   char buffer [65536];
+   size_t got = 0;
+   ssize_t bytes;
+
+   while (got < 1024 * 1024
+            && (bytes = read (b [1], buffer, sizeof (buffer))) > 0)
+   {
+      got += bytes;
+   }
+
+   close (b [1]);
+
+   usleep (200000);
+   lw_eventpump_post_eventloop_exit (pump);
+
+   return 0;
+}
+
+static int run (void)
+{
+   socketpair (AF_UNIX, SOCK_STREAM, 0, a);
+   socketpair (AF_UNIX, SOCK_STREAM, 0, b);
+
+   pump = lw_eventpump_new ();
+
+   lw_fdstream source = lw_fdstream_new ((lw_pump) pump),
+               dest = lw_fdstream_new ((lw_pump) pump);
+
+   lw_fdstream_set_fd (source, a [1], 0, lw_true);
+   lw_fdstream_set_fd (dest, b [0], 0, lw_true);
+
+   lw_stream_write_stream ((lw_stream) dest, (lw_stream) source, -1, lw_false);
+
+   pthread_t threads [2];
+
+   pthread_create (&threads [0], 0, writer, 0);
+   pthread_create (&threads [1], 0, reader, 0);
+
+   lw_eventpump_start_eventloop (pump);
+
+   pthread_join (threads [1], 0);
+
+   sigset_t mask, pending;
+
+   pthread_sigmask (SIG_BLOCK, 0, &mask);
+   sigpending (&pending);
+
+   assert (!sigismember (&mask, SIGPIPE));
+   assert (!sigismember (&pending, SIGPIPE));
+
+   return 0;
+}
+
+int main (int argc, char * argv [])
+{
+   for (int ignore = 0; ignore < 2; ++ ignore)
+   {
+      pid_t child = fork ();
+
+      if (child == 0)
+      {
+         signal (SIGPIPE, ignore ? SIG_IGN : SIG_DFL);
+         _exit (run ());
+      }
+
+      int status;
+      waitpid (child, &status, 0);
+
+      printf ("SIGPIPE %s: %s\n", ignore ? "ignored" : "default",
+              WIFEXITED (status) ? "exited" : "killed");
+
+      assert (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+   }
+
+   return 0;
+}
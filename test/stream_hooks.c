@@ -0,0 +1,124 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* One source fanned out to several streams and data hooks.  Some of the
+ * links finish part way through a write, and one hook removes another, so
+ * the expanded graph changes while data is being delivered.
+ */
+
+#define num_targets 4
+#define num_writes 50
+#define write_size 100
+
+struct target
+{
+   char data [num_writes * write_size];
+   size_t length;
+};
+
+static struct target targets [num_targets], hooked [3];
+
+static const size_t link_sizes [num_targets] =
+{
+   -1, 250, write_size * 10, 1
+};
+
+static lw_stream source;
+
+static size_t sink_data (lw_stream stream, const char * buffer, size_t size)
+{
+   struct target * target = lw_stream_tail (stream);
+
+   memcpy (target->data + target->length, buffer, size);
+   target->length += size;
+
+   return size;
+}
+
+static const lw_streamdef def_target =
+{
+   .sink_data  = sink_data,
+   .tail_size  = sizeof (struct target)
+};
+
+static const lw_streamdef def_source =
+{
+   0
+};
+
+static void on_data (lw_stream stream, void * tag, const char * buffer,
+                     size_t length)
+{
+   struct target * target = tag;
+
+   memcpy (target->data + target->length, buffer, length);
+   target->length += length;
+
+   /* The first hook takes the last one out once it's seen half the data
+    */
+   if (target == &hooked [0]
+         && target->length == (num_writes / 2) * write_size)
+   {
+      lw_stream_remove_hook_data (stream, on_data, &hooked [2]);
+   }
+}
+
+int main (int argc, char * argv [])
+{
+   lw_pump pump = (lw_pump) lw_eventpump_new ();
+
+   source = lw_stream_new (&def_source, pump);
+
+   lw_stream streams [num_targets];
+
+   for (int i = 0; i < num_targets; ++ i)
+   {
+      streams [i] = lw_stream_new (&def_target, pump);
+      lw_stream_write_stream (streams [i], source, link_sizes [i], lw_false);
+   }
+
+   for (int i = 0; i < 3; ++ i)
+      lw_stream_add_hook_data (source, on_data, &hooked [i]);
+
+   char sent [num_writes * write_size];
+
+   for (int i = 0; i < sizeof (sent); ++ i)
+      sent [i] = (char) rand ();
+
+   for (int i = 0; i < num_writes; ++ i)
+      lw_stream_data (source, sent + i * write_size, write_size);
+
+   for (int i = 0; i < num_targets; ++ i)
+   {
+      struct target * target = lw_stream_tail (streams [i]);
+
+      size_t expected = link_sizes [i] < sizeof (sent) ?
+                           link_sizes [i] : sizeof (sent);
+
+      printf ("target %d got %d of %d\n",
+                 i, (int) target->length, (int) expected);
+
+      assert (target->length == expected);
+      assert (!memcmp (target->data, sent, expected));
+   }
+
+   assert (hooked [0].length == sizeof (sent));
+   assert (hooked [1].length == sizeof (sent));
+   assert (hooked [2].length == (num_writes / 2) * write_size);
+
+   for (int i = 0; i < 3; ++ i)
+      assert (!memcmp (hooked [i].data, sent, hooked [i].length));
+
+   for (int i = 0; i < num_targets; ++ i)
+      lw_stream_delete (streams [i]);
+
+   lw_stream_delete (source);
+   lw_pump_delete (pump);
+
+   return 0;
+}
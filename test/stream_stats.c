@@ -0,0 +1,110 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* A source pushes into a sink that only takes part of what it's given, so
+ * the rest is queued.  The counters on both ends have to add up, and the
+ * queue figures follow the queue as it fills and drains.
+ */
+
+#define chunk 100
+#define num_chunks 20
+
+static size_t sink_limit;
+
+static size_t sink_data (lw_stream stream, const char * buffer, size_t size)
+{
+   if (size > sink_limit)
+      size = sink_limit;
+
+   sink_limit -= size;
+
+   return size;
+}
+
+static const lw_streamdef def_sink =
+{
+   .sink_data = sink_data
+};
+
+static const lw_streamdef def_source =
+{
+   0
+};
+
+int main (int argc, char * argv [])
+{
+   lw_pump pump = (lw_pump) lw_eventpump_new ();
+
+   lw_stream source = lw_stream_new (&def_source, pump);
+   lw_stream sink = lw_stream_new (&def_sink, pump);
+
+   lw_stream_write_stream (sink, source, -1, lw_false);
+
+   lw_stream_stats stats;
+
+   lw_stream_get_stats (sink, &stats);
+
+   assert (stats.bytes_sent == 0 && stats.bytes_received == 0);
+   assert (stats.queued_bytes == 0 && stats.queued_ms == 0);
+
+   /* Half goes straight through, and the rest waits
+    */
+   char data [chunk];
+   memset (data, 'x', sizeof (data));
+
+   sink_limit = chunk * num_chunks / 2;
+
+   for (int i = 0; i < num_chunks; ++ i)
+      lw_stream_data (source, data, chunk);
+
+   usleep (20000);
+
+   lw_stream_get_stats (source, &stats);
+
+   assert (stats.bytes_received == chunk * num_chunks);
+
+   lw_stream_get_stats (sink, &stats);
+
+   printf ("sent %llu, queued %d in %d + %d items for %llu ms\n",
+           (unsigned long long) stats.bytes_sent, (int) stats.queued_bytes,
+           (int) stats.front_queue, (int) stats.back_queue,
+           (unsigned long long) stats.queued_ms);
+
+   assert (stats.bytes_sent == chunk * num_chunks / 2);
+   assert (stats.queued_bytes == chunk * num_chunks / 2);
+   assert (stats.max_queued_bytes == stats.queued_bytes);
+   assert (stats.front_queue + stats.back_queue > 0);
+   assert (stats.queued_ms >= 15);
+
+   /* Resetting keeps the queue figures, since the data is still there
+    */
+   lw_stream_reset_stats (sink);
+   lw_stream_get_stats (sink, &stats);
+
+   assert (stats.bytes_sent == 0);
+   assert (stats.max_queued_bytes == chunk * num_chunks / 2);
+
+   /* Drained, the queue figures go back to nothing bar the maximum
+    */
+   sink_limit = -1;
+   lw_stream_retry (sink, lw_stream_retry_now);
+
+   lw_stream_get_stats (sink, &stats);
+
+   assert (stats.bytes_sent == chunk * num_chunks / 2);
+   assert (stats.queued_bytes == 0 && stats.queued_ms == 0);
+   assert (stats.front_queue == 0 && stats.back_queue == 0);
+   assert (stats.max_queued_bytes == chunk * num_chunks / 2);
+
+   lw_stream_delete (sink);
+   lw_stream_delete (source);
+   lw_pump_delete (pump);
+
+   return 0;
+}
@@ -0,0 +1,156 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* Echo server on a threaded pump: each client's hooks must always run on
+ * the same thread, and the clients should end up spread over more than one.
+ */
+
+#define port 12391
+#define num_senders 8
+#define connections_each 25
+#define messages_each 50
+
+static lw_eventpump pump;
+static lw_server server;
+
+static volatile long num_connected, num_disconnected, num_echoed;
+
+static pthread_mutex_t seen_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t seen_threads [16];
+static long num_seen_threads;
+
+static void note_thread (pthread_t thread)
+{
+   pthread_mutex_lock (&seen_lock);
+
+   long i = 0;
+
+   while (i < num_seen_threads && !pthread_equal (seen_threads [i], thread))
+      ++ i;
+
+   if (i == num_seen_threads)
+   {
+      assert (num_seen_threads < 16);
+      seen_threads [num_seen_threads ++] = thread;
+   }
+
+   pthread_mutex_unlock (&seen_lock);
+}
+
+static void on_connect (lw_server server, lw_server_client client)
+{
+   pthread_t * thread = malloc (sizeof (*thread));
+   *thread = pthread_self ();
+
+   lw_stream_set_tag ((lw_stream) client, thread);
+   note_thread (*thread);
+
+   __sync_add_and_fetch (&num_connected, 1);
+}
+
+static void on_data (lw_server server, lw_server_client client,
+                     const char * buffer, size_t size)
+{
+   pthread_t * thread = lw_stream_tag ((lw_stream) client);
+   assert (pthread_equal (*thread, pthread_self ()));
+
+   lw_stream_write ((lw_stream) client, buffer, size);
+}
+
+static void on_disconnect (lw_server server, lw_server_client client)
+{
+   pthread_t * thread = lw_stream_tag ((lw_stream) client);
+   assert (pthread_equal (*thread, pthread_self ()));
+
+   free (thread);
+
+   if (__sync_add_and_fetch (&num_disconnected, 1)
+         == num_senders * connections_each)
+   {
+      lw_eventpump_post_eventloop_exit (pump);
+   }
+}
+
+static void * sender (void * param)
+{
+   struct sockaddr_in addr = {};
+
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons (port);
+   addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+   for (int i = 0; i < connections_each; ++ i)
+   {
+      int fd = socket (AF_INET, SOCK_STREAM, 0);
+
+      while (connect (fd, (struct sockaddr *) &addr, sizeof (addr)) == -1)
+         usleep (1000);
+
+      for (int j = 0; j < messages_each; ++ j)
+      {
+         char buffer [8];
+         size_t received = 0;
+
+         write (fd, "hello", 5);
+
+         while (received < 5)
+         {
+            ssize_t bytes = read (fd, buffer + received, 5 - received);
+            assert (bytes > 0);
+            received += bytes;
+         }
+
+         assert (!memcmp (buffer, "hello", 5));
+         __sync_add_and_fetch (&num_echoed, 1);
+      }
+
+      close (fd);
+   }
+
+   return 0;
+}
+
+int main (int argc, char * argv [])
+{
+   pump = lw_eventpump_new_threaded (4);
+   server = lw_server_new ((lw_pump) pump);
+
+   lw_server_on_connect (server, on_connect);
+   lw_server_on_data (server, on_data);
+   lw_server_on_disconnect (server, on_disconnect);
+
+   lw_server_host (server, port);
+
+   pthread_t senders [num_senders];
+
+   for (int i = 0; i < num_senders; ++ i)
+      pthread_create (&senders [i], 0, sender, 0);
+
+   lw_eventpump_start_eventloop (pump);
+
+   for (int i = 0; i < num_senders; ++ i)
+      pthread_join (senders [i], 0);
+
+   printf ("%ld connected, %ld echoed on %ld threads\n",
+            num_connected, num_echoed, num_seen_threads);
+
+   assert (num_connected == num_senders * connections_each);
+   assert (num_echoed == num_senders * connections_each * messages_each);
+   assert (num_seen_threads > 1);
+   assert (lw_server_num_clients (server) == 0);
+
+   lw_server_delete (server);
+   lw_pump_delete ((lw_pump) pump);
+
+   return 0;
+}
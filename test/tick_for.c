@@ -0,0 +1,81 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+/* lw_eventpump_tick_for stops once its budget is used up, says how much is
+ * left, and picks up from there on the next call.
+ */
+
+#define num_posts 100
+
+static lw_eventpump pump;
+static int num_run;
+static long last_started;
+
+static long now_us (void)
+{
+   struct timespec now;
+   clock_gettime (CLOCK_MONOTONIC, &now);
+
+   return now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void slow_post (void * param)
+{
+   assert ((long) param == num_run);
+
+   last_started = now_us ();
+
+   ++ num_run;
+   usleep (1000);
+}
+
+int main (int argc, char * argv [])
+{
+   pump = lw_eventpump_new ();
+
+   /* Nothing to do
+    */
+   assert (lw_eventpump_tick_for (pump, 10000) == 0);
+
+   for (long i = 0; i < num_posts; ++ i)
+      lw_pump_post ((lw_pump) pump, slow_post, (void *) i);
+
+   int num_frames = 0;
+
+   for (;;)
+   {
+      int run_before = num_run;
+      long started = now_us ();
+
+      long remaining = lw_eventpump_tick_for (pump, 5000);
+
+      ++ num_frames;
+
+      /* Can only overrun by the post that was running when the budget ran
+       * out, so none of them started after it.  (How long the posts take
+       * is up to the scheduler.)
+       */
+      assert (last_started - started < 5000 + 1000);
+      assert (num_run > run_before);
+
+      if (!remaining)
+         break;
+
+      assert (remaining == num_posts - num_run);
+   }
+
+   printf ("%d posts in %d frames\n", num_run, num_frames);
+
+   assert (num_run == num_posts);
+   assert (num_frames > 1 && num_frames < num_posts);
+
+   lw_pump_delete ((lw_pump) pump);
+
+   return 0;
+}
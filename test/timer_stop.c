@@ -0,0 +1,76 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Once timers are started, stopped and deleted from another thread while
+ * the pump is firing them.  Stopping or deleting a timer has to wait for a
+ * tick that's already running, and the pump's use count has to come back
+ * to zero.
+ */
+
+#define num_timers 3000
+
+static lw_eventpump pump;
+static volatile long ticks;
+
+static void on_tick (lw_timer timer)
+{
+   /* Long enough for the other thread to get to the delete */
+   usleep (100);
+
+   if (lw_timer_tag (timer) == &ticks)
+      __sync_add_and_fetch (&ticks, 1);
+}
+
+static void * start_timers (void * param)
+{
+   for (int i = 0; i < num_timers; ++ i)
+   {
+      lw_timer timer = lw_timer_new ((lw_pump) pump);
+
+      lw_timer_set_tag (timer, (void *) &ticks);
+      lw_timer_on_tick (timer, on_tick);
+
+      lw_timer_start_once (timer, 0);
+
+      usleep (i % 200);
+
+      if (i & 1)
+         lw_timer_stop (timer);
+
+      lw_timer_delete (timer);
+   }
+
+   lw_eventpump_post_eventloop_exit (pump);
+
+   return 0;
+}
+
+int main (int argc, char * argv [])
+{
+   pump = lw_eventpump_new ();
+
+   /* Keeps the loop running between timers */
+   lw_pump_add_user ((lw_pump) pump);
+
+   pthread_t thread;
+   pthread_create (&thread, 0, start_timers, 0);
+
+   lw_eventpump_start_eventloop (pump);
+
+   pthread_join (thread, 0);
+
+   lw_pump_remove_user ((lw_pump) pump);
+
+   printf ("%ld of %d timers ticked\n", ticks, num_timers);
+
+   assert (!lw_pump_in_use ((lw_pump) pump));
+
+   lw_pump_delete ((lw_pump) pump);
+
+   return 0;
+}
@@ -0,0 +1,154 @@
+
+#include "../src/common.h"
+#include "../src/timerwheel.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Drives the timer wheel with a fake clock.  Every timer has to expire on
+ * the first advance that reaches its deadline - never early, never late -
+ * and in deadline order.
+ */
+
+#define num_timers 5000
+
+static struct _lwp_timerwheel wheel;
+static struct _lwp_timerwheel_entry timers [num_timers];
+
+static int num_fired;
+
+static void check_expired (lw_i64 previous, lw_i64 now)
+{
+   lw_i64 last_due = -1;
+   lwp_timerwheel_entry entry;
+
+   while ((entry = lwp_timerwheel_pop_expired (&wheel)))
+   {
+      assert (entry->due > previous || entry->due == now);
+      assert (entry->due <= now);
+      assert (entry->due >= last_due);
+
+      last_due = entry->due;
+      ++ num_fired;
+   }
+}
+
+static void test_random (void)
+{
+   lw_i64 now = 1000;
+
+   lwp_timerwheel_init (&wheel, now);
+
+   for (int i = 0; i < num_timers; ++ i)
+   {
+      /* Mostly near, with some far enough away for the overflow list
+       */
+      lw_i64 delay = (i % 10 == 0) ? rand () % (1 << 26) : rand () % 5000;
+
+      lwp_timerwheel_add (&wheel, &timers [i], now + delay);
+   }
+
+   num_fired = 0;
+
+   while (num_fired < num_timers)
+   {
+      long timeout = lwp_timerwheel_timeout (&wheel, now);
+
+      assert (timeout >= 0);
+
+      /* Either step to exactly when the wheel says something is due, or
+       * somewhere short of it (which must fire nothing)
+       */
+      lw_i64 previous = now;
+
+      now += (rand () % 2) ? timeout : rand () % (timeout + 1);
+
+      int fired_before = num_fired;
+
+      lwp_timerwheel_advance (&wheel, now);
+      check_expired (previous, now);
+
+      if (now - previous < timeout)
+         assert (num_fired == fired_before);
+   }
+
+   assert (lwp_timerwheel_timeout (&wheel, now) == -1);
+}
+
+static void test_delay_zero (void)
+{
+   lwp_timerwheel_init (&wheel, 500);
+   lwp_timerwheel_advance (&wheel, 600);
+
+   lwp_timerwheel_add (&wheel, &timers [0], 600);
+
+   /* Due now, so it has to go out without the clock moving on
+    */
+   assert (lwp_timerwheel_timeout (&wheel, 600) == 0);
+
+   lwp_timerwheel_advance (&wheel, 600);
+
+   lwp_timerwheel_entry entry = lwp_timerwheel_pop_expired (&wheel);
+
+   assert (entry == &timers [0]);
+   assert (entry->due == 600);
+   assert (!lwp_timerwheel_pop_expired (&wheel));
+}
+
+static void test_interval_and_remove (void)
+{
+   lwp_timerwheel_init (&wheel, 0);
+
+   timers [0].interval = 10;
+   lwp_timerwheel_add (&wheel, &timers [0], 10);
+
+   timers [1].interval = 0;
+   lwp_timerwheel_add (&wheel, &timers [1], 15);
+   lwp_timerwheel_remove (&wheel, &timers [1]);
+
+   assert (!lwp_timerwheel_scheduled (&timers [1]));
+
+   int ticks = 0;
+
+   for (lw_i64 now = 1; now <= 100; ++ now)
+   {
+      lwp_timerwheel_advance (&wheel, now);
+
+      lwp_timerwheel_entry entry;
+
+      while ((entry = lwp_timerwheel_pop_expired (&wheel)))
+      {
+         assert (entry == &timers [0]);
+         assert (entry->due == now);
+
+         ++ ticks;
+      }
+   }
+
+   assert (ticks == 10);
+
+   /* Falling behind skips the missed ticks rather than firing them all
+    */
+   lwp_timerwheel_advance (&wheel, 1000);
+
+   assert (lwp_timerwheel_pop_expired (&wheel) == &timers [0]);
+   assert (!lwp_timerwheel_pop_expired (&wheel));
+   assert (timers [0].expires == 1010);
+
+   lwp_timerwheel_remove (&wheel, &timers [0]);
+   timers [0].interval = 0;
+}
+
+int main (int argc, char * argv [])
+{
+   srand (argc > 1 ? atoi (argv [1]) : 1);
+
+   test_delay_zero ();
+   test_interval_and_remove ();
+   test_random ();
+
+   printf ("%d timers fired in order\n", num_fired);
+
+   return 0;
+}
@@ -0,0 +1,93 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+/* Raw watches on an io_uring pump (which falls back to epoll where the
+ * kernel doesn't support it): a socketpair is echoed until the peer hangs
+ * up, and the watch has to keep firing after each event.
+ */
+
+#define num_messages 1000
+
+static lw_eventpump pump;
+static lw_pump_watch watch;
+
+static int fds [2];
+static int num_received, hung_up;
+
+static void on_read_ready (void * tag)
+{
+   char buffer [64];
+
+   for (;;)
+   {
+      ssize_t bytes = read (fds [1], buffer, sizeof (buffer));
+
+      if (bytes == -1)
+         return;
+
+      if (bytes == 0)
+      {
+         hung_up = 1;
+
+         lw_pump_remove ((lw_pump) pump, watch);
+         close (fds [1]);
+
+         lw_eventpump_post_eventloop_exit (pump);
+         return;
+      }
+
+      num_received += bytes;
+      write (fds [1], buffer, bytes);
+   }
+}
+
+static void * peer (void * param)
+{
+   for (int i = 0; i < num_messages; ++ i)
+   {
+      char c = 'x';
+
+      write (fds [0], &c, 1);
+      assert (read (fds [0], &c, 1) == 1 && c == 'x');
+   }
+
+   shutdown (fds [0], SHUT_WR);
+
+   return 0;
+}
+
+int main (int argc, char * argv [])
+{
+   pump = lw_eventpump_new_uring ();
+
+   socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+   fcntl (fds [1], F_SETFL, fcntl (fds [1], F_GETFL) | O_NONBLOCK);
+
+   watch = lw_pump_add ((lw_pump) pump, fds [1], 0, on_read_ready, 0, lw_true);
+
+   lw_thread thread = lw_thread_new ("peer", (void *) peer);
+   lw_thread_start (thread, 0);
+
+   lw_eventpump_start_eventloop (pump);
+
+   lw_thread_join (thread);
+   lw_thread_delete (thread);
+
+   printf ("received %d, hung up %d\n", num_received, hung_up);
+
+   assert (num_received == num_messages);
+   assert (hung_up);
+
+   close (fds [0]);
+   lw_pump_delete ((lw_pump) pump);
+
+   return 0;
+}
@@ -0,0 +1,137 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A source reads into a sink that isn't taking any data.  Once the sink's
+ * queue passes its high watermark the source is paused, and it's only
+ * resumed when the queue drains back down to the low watermark.
+ */
+
+#define high 1000
+#define low 200
+#define chunk 100
+
+static lw_stream source, sink;
+
+static char received [high * 4];
+static size_t num_received, sink_limit;
+
+static int num_resumed, num_full, num_drained;
+
+static size_t sink_data (lw_stream stream, const char * buffer, size_t size)
+{
+   if (size > sink_limit)
+      size = sink_limit;
+
+   sink_limit -= size;
+
+   memcpy (received + num_received, buffer, size);
+   num_received += size;
+
+   return size;
+}
+
+static void resume_read (lw_stream stream)
+{
+   assert (stream == source);
+   ++ num_resumed;
+}
+
+static const lw_streamdef def_sink =
+{
+   .sink_data = sink_data
+};
+
+static const lw_streamdef def_source =
+{
+   .resume_read = resume_read
+};
+
+static void on_queue_full (lw_stream stream)
+{
+   ++ num_full;
+}
+
+static void on_queue_drained (lw_stream stream)
+{
+   ++ num_drained;
+}
+
+/* What the source would do when it can read: push until told to stop */
+
+static size_t produce (char * sent, size_t num_sent)
+{
+   while (!lw_stream_is_paused (source))
+   {
+      for (int i = 0; i < chunk; ++ i)
+         sent [num_sent + i] = (char) rand ();
+
+      lw_stream_data (source, sent + num_sent, chunk);
+      num_sent += chunk;
+
+      assert (num_sent < sizeof (received));
+   }
+
+   return num_sent;
+}
+
+int main (int argc, char * argv [])
+{
+   lw_pump pump = (lw_pump) lw_eventpump_new ();
+
+   source = lw_stream_new (&def_source, pump);
+   sink = lw_stream_new (&def_sink, pump);
+
+   lw_stream_set_watermarks (sink, high, low);
+   lw_stream_on_queue_full (sink, on_queue_full);
+   lw_stream_on_queue_drained (sink, on_queue_drained);
+
+   lw_stream_write_stream (sink, source, -1, lw_false);
+
+   char sent [sizeof (received)];
+   size_t num_sent = produce (sent, 0);
+
+   printf ("paused after %d bytes\n", (int) num_sent);
+
+   assert (num_sent > high && num_sent <= high + chunk);
+   assert (num_full == 1 && num_resumed == 0);
+
+   /* Draining part of the queue isn't enough to resume */
+
+   sink_limit = num_sent - low - 1;
+   lw_stream_retry (sink, lw_stream_retry_now);
+
+   assert (lw_stream_is_paused (source));
+   assert (num_resumed == 0 && num_drained == 0);
+
+   /* Down to the low watermark */
+
+   sink_limit = 1;
+   lw_stream_retry (sink, lw_stream_retry_now);
+
+   assert (!lw_stream_is_paused (source));
+   assert (num_resumed == 1 && num_drained == 1);
+
+   /* Fill it up again, then let everything through */
+
+   num_sent = produce (sent, num_sent);
+
+   assert (num_full == 2);
+
+   sink_limit = -1;
+   lw_stream_retry (sink, lw_stream_retry_now);
+
+   assert (num_resumed == 2 && num_drained == 2);
+   assert (num_received == num_sent);
+   assert (!memcmp (received, sent, num_sent));
+
+   lw_stream_delete (sink);
+   lw_stream_delete (source);
+   lw_pump_delete (pump);
+
+   return 0;
+}
@@ -0,0 +1,93 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Work posted to the pump's pool runs on the workers, and every done
+ * function runs on the pump's thread - including those still outstanding
+ * when the pump is deleted.
+ */
+
+#define num_work 10000
+
+static lw_eventpump pump;
+static pthread_t pump_thread;
+
+static volatile long num_worked;
+static long num_done;
+
+static void work (void * param)
+{
+   assert (!pthread_equal (pthread_self (), pump_thread));
+
+   __sync_add_and_fetch (&num_worked, 1);
+}
+
+static void done (void * param)
+{
+   assert (pthread_equal (pthread_self (), pump_thread));
+
+   if (++ num_done == num_work)
+      lw_eventpump_post_eventloop_exit (pump);
+}
+
+static void slow_work (void * param)
+{
+   usleep (1000);
+   __sync_add_and_fetch (&num_worked, 1);
+}
+
+static void count_done (void * param)
+{
+   ++ num_done;
+}
+
+int main (int argc, char * argv [])
+{
+   pump_thread = pthread_self ();
+
+   /* Everything completes while the pump is running
+    */
+   pump = lw_eventpump_new ();
+
+   for (int i = 0; i < num_work; )
+   {
+      if (lw_pump_post_work ((lw_pump) pump, work, done, 0))
+         ++ i;
+      else
+         lw_eventpump_tick (pump);  /* queues full */
+   }
+
+   lw_eventpump_start_eventloop (pump);
+
+   assert (num_worked == num_work);
+   assert (num_done == num_work);
+   assert (!lw_pump_in_use ((lw_pump) pump));
+
+   lw_pump_delete ((lw_pump) pump);
+
+   /* Deleted without ever running, so none of the done functions have been
+    * run by the pump
+    */
+   num_worked = num_done = 0;
+
+   pump = lw_eventpump_new ();
+
+   for (int i = 0; i < 64; ++ i)
+      assert (lw_pump_post_work ((lw_pump) pump, slow_work, count_done, 0));
+
+   assert (lw_pump_in_use ((lw_pump) pump));
+
+   lw_pump_delete ((lw_pump) pump);
+
+   printf ("%ld worked, %ld done after delete\n", num_worked, num_done);
+
+   assert (num_worked == 64);
+   assert (num_done == 64);
+
+   return 0;
+}
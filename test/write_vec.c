@@ -0,0 +1,133 @@
+
+#include <lacewing.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* lw_stream_write_vec through a stream with a sink_data_vec that only takes
+ * part of each write, so that the rest is queued and drained by retrying,
+ * and through one without sink_data_vec at all.  Either way the data has to
+ * come out whole and in order.
+ */
+
+static char sunk [65536];
+static size_t num_sunk, max_sink;
+static int num_vec_calls, num_data_calls;
+
+static size_t sink_data (lw_stream stream, const char * buffer, size_t size)
+{
+   ++ num_data_calls;
+
+   if (size > max_sink)
+      size = max_sink;
+
+   memcpy (sunk + num_sunk, buffer, size);
+   num_sunk += size;
+
+   return size;
+}
+
+static size_t sink_data_vec (lw_stream stream, const lw_iovec * vec, int count)
+{
+   ++ num_vec_calls;
+
+   size_t total = 0;
+
+   for (int i = 0; i < count && total < max_sink; ++ i)
+   {
+      size_t size = vec [i].length;
+
+      if (total + size > max_sink)
+         size = max_sink - total;
+
+      memcpy (sunk + num_sunk, vec [i].buffer, size);
+      num_sunk += size;
+      total += size;
+   }
+
+   return total;
+}
+
+static const lw_streamdef def_vec =
+{
+   .sink_data      = sink_data,
+   .sink_data_vec  = sink_data_vec
+};
+
+static const lw_streamdef def_plain =
+{
+   .sink_data      = sink_data
+};
+
+static void check (const lw_streamdef * def)
+{
+   lw_pump pump = (lw_pump) lw_eventpump_new ();
+   lw_stream stream = lw_stream_new (def, pump);
+
+   char expected [sizeof (sunk)];
+   size_t length = 0;
+
+   lw_iovec vec [100];
+
+   for (int i = 0; i < 100; ++ i)
+   {
+      size_t size = 1 + (rand () % 300);
+      char * buffer = malloc (size);
+
+      for (size_t j = 0; j < size; ++ j)
+         buffer [j] = (char) rand ();
+
+      memcpy (expected + length, buffer, size);
+      length += size;
+
+      vec [i].buffer = buffer;
+      vec [i].length = size;
+   }
+
+   num_sunk = 0;
+   max_sink = 1000;
+
+   lw_stream_write_vec (stream, vec, 100);
+
+   /* The queue has its own copy, so the buffers can go straight away
+    */
+   for (int i = 0; i < 100; ++ i)
+      free ((char *) vec [i].buffer);
+
+   while (num_sunk < length)
+   {
+      size_t before = num_sunk;
+
+      lw_stream_retry (stream, lw_stream_retry_now);
+
+      assert (num_sunk > before);
+   }
+
+   assert (num_sunk == length);
+   assert (!memcmp (sunk, expected, length));
+   lw_stream_stats stats;
+   lw_stream_get_stats (stream, &stats);
+
+   assert (stats.bytes_sent == length);
+
+   lw_stream_delete (stream);
+   lw_pump_delete (pump);
+}
+
+int main (int argc, char * argv [])
+{
+   check (&def_vec);
+
+   assert (num_vec_calls > 0);
+
+   num_data_calls = 0;
+   check (&def_plain);
+
+   assert (num_data_calls > 0);
+
+   printf ("%d vec calls, %d data calls\n", num_vec_calls, num_data_calls);
+
+   return 0;
+}